@@ -0,0 +1,32 @@
+#ifndef _ARRAYVIEW_H_D39D504E_633B_4B89_B3E1_B3D9E771401B
+#define _ARRAYVIEW_H_D39D504E_633B_4B89_B3E1_B3D9E771401B
+
+#include <stddef.h>
+
+namespace FileLoader {
+    // non-owning view over contiguous elements, used where the storage may either be a std::vector or a file mapping
+    template< typename val_T >
+    struct ArrayView {
+        ArrayView() = default;
+        ArrayView( val_T* pData, const size_t size )
+            : mpData( pData )
+            , mSize( size )
+        {}
+
+        operator ArrayView< const val_T >() const { return ArrayView< const val_T >( mpData, mSize ); }
+
+        inline val_T* data() const { return mpData; }
+        inline size_t size() const { return mSize; }
+        inline bool empty() const { return mSize == 0; }
+
+        inline val_T& operator[]( const size_t idx ) const { return mpData[idx]; }
+
+        inline val_T* begin() const { return mpData; }
+        inline val_T* end() const { return mpData + mSize; }
+
+    private:
+        val_T*  mpData = nullptr;
+        size_t  mSize = 0;
+    };
+}
+#endif // _ARRAYVIEW_H_D39D504E_633B_4B89_B3E1_B3D9E771401B
@@ -0,0 +1,34 @@
+#ifndef _DEFAULTINITALLOCATOR_H_DAB70B59_8EDF_470F_A3BD_F30B24242EAD
+#define _DEFAULTINITALLOCATOR_H_DAB70B59_8EDF_470F_A3BD_F30B24242EAD
+
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace FileLoader {
+    // std::allocator that default-initializes instead of value-initializes, so that resize() on a vector of 
+    // trivial types does not touch (zero) the memory. Large buffers then only get committed page by page, when they are written.
+    template< typename val_T, typename base_T = std::allocator< val_T > >
+    struct DefaultInitAllocator : public base_T {
+        using base_traits_t = std::allocator_traits< base_T >;
+
+        template< typename other_T >
+        struct rebind {
+            using other = DefaultInitAllocator< other_T, typename base_traits_t::template rebind_alloc< other_T > >;
+        };
+
+        using base_T::base_T;
+        DefaultInitAllocator() = default;
+
+        template< typename elem_T >
+        void construct( elem_T* ptr ) noexcept( std::is_nothrow_default_constructible< elem_T >::value ) {
+            ::new( static_cast< void* >( ptr ) ) elem_T;
+        }
+
+        template< typename elem_T, typename... args_T >
+        void construct( elem_T* ptr, args_T&&... args ) {
+            base_traits_t::construct( static_cast< base_T& >( *this ), ptr, std::forward< args_T >( args )... );
+        }
+    };
+}
+#endif // _DEFAULTINITALLOCATOR_H_DAB70B59_8EDF_470F_A3BD_F30B24242EAD
@@ -0,0 +1,236 @@
+#include "executionContext.h"
+
+#include <omp.h>
+
+#include <algorithm>
+
+#if defined( _WIN32 )
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#elif defined( __linux__ )
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+using namespace FileLoader;
+
+namespace {
+    // identifies pool workers, so that they push to and pop from their own deque
+    thread_local const WorkStealingPool*    tpWorkerPool = nullptr;
+    thread_local int32_t                    tWorkerIdx = -1;
+
+    static uint32_t numHardwareThreads() { return std::max( 1u, std::thread::hardware_concurrency() ); }
+
+    static void pinCurrentThread( const uint32_t threadIdx, const uint32_t numThreads, const threadAffinity_t affinity ) {
+        if (affinity == threadAffinity_t::NONE) { return; }
+        const uint32_t numCores = numHardwareThreads();
+        const uint32_t core = ( affinity == threadAffinity_t::COMPACT )
+            ? threadIdx % numCores
+            : static_cast<uint32_t>( ( static_cast<uint64_t>( threadIdx ) * numCores / std::max( 1u, numThreads ) ) % numCores );
+    #if defined( _WIN32 )
+        if (core < 64) { SetThreadAffinityMask( GetCurrentThread(), DWORD_PTR( 1 ) << core ); }
+    #elif defined( __linux__ )
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        CPU_SET( core, &cpuSet );
+        pthread_setaffinity_np( pthread_self(), sizeof( cpuSet ), &cpuSet );
+    #else
+        (void)core;
+    #endif
+    }
+
+    using chunkFunc_t = std::function< void( const int64_t chunkBegin, const int64_t chunkEnd, const uint32_t slot ) >;
+
+    // chunks of a loop on the work-stealing pool, shared by the runner tasks; runners that start after
+    // the last chunk was taken return without touching pChunkFunc, which lives on the stack of the caller
+    struct poolLoop_t {
+        std::atomic< int64_t >  nextChunk{ 0 };
+        std::atomic< int64_t >  numChunksDone{ 0 };
+        int64_t                 numChunks = 0;
+        int64_t                 begin = 0;
+        int64_t                 end = 0;
+        int64_t                 grainSize = 1;
+        const chunkFunc_t*      pChunkFunc = nullptr;
+    };
+
+    static void runLoopChunks( poolLoop_t& loop, const uint32_t slot ) {
+        for (;;) {
+            const int64_t chunk = loop.nextChunk.fetch_add( 1 );
+            if (chunk >= loop.numChunks) { return; }
+            const int64_t chunkBegin = loop.begin + chunk * loop.grainSize;
+            ( *loop.pChunkFunc )( chunkBegin, std::min( chunkBegin + loop.grainSize, loop.end ), slot );
+            loop.numChunksDone.fetch_add( 1, std::memory_order_release );
+        }
+    }
+
+    // orphaned worksharing loop, called inside the parallel regions of forEachChunk()
+    static void ompLoopChunks( const int64_t begin, const int64_t end, const int64_t grainSize, const int64_t numChunks, const chunkFunc_t& chunkFunc ) {
+        const uint32_t slot = static_cast<uint32_t>( omp_get_thread_num() );
+        #pragma omp for schedule(dynamic, 1) // OpenMP
+        for (int64_t chunk = 0; chunk < numChunks; chunk++) {
+            const int64_t chunkBegin = begin + chunk * grainSize;
+            chunkFunc( chunkBegin, std::min( chunkBegin + grainSize, end ), slot );
+        }
+    }
+}
+
+WorkStealingPool::WorkStealingPool( const uint32_t numWorkers, const threadAffinity_t affinity ) {
+    const uint32_t workerCount = ( numWorkers > 0 ) ? numWorkers : std::max( 1u, numHardwareThreads() - 1 );
+    for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+        mWorkers.emplace_back( new worker_t );
+    }
+    for (uint32_t workerIdx = 0; workerIdx < workerCount; workerIdx++) {
+        mThreads.emplace_back( [this, workerIdx, workerCount, affinity]() {
+            pinCurrentThread( workerIdx, workerCount, affinity );
+            workerLoop( workerIdx );
+        } );
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard< std::mutex > lock( mWakeMutex );
+        mStop = true;
+    }
+    mWakeCondition.notify_all();
+    for (auto& thread : mThreads) { thread.join(); }
+}
+
+std::shared_ptr< WorkStealingPool > WorkStealingPool::getShared() {
+    static std::shared_ptr< WorkStealingPool > pSharedPool = std::make_shared< WorkStealingPool >();
+    return pSharedPool;
+}
+
+void WorkStealingPool::submit( task_t task ) {
+    const uint32_t workerIdx = ( tpWorkerPool == this )
+        ? static_cast<uint32_t>( tWorkerIdx )
+        : mNextSubmitWorker.fetch_add( 1, std::memory_order_relaxed ) % getNumWorkers();
+    {
+        std::lock_guard< std::mutex > lock( mWorkers[workerIdx]->mutex );
+        mWorkers[workerIdx]->tasks.push_back( std::move( task ) );
+    }
+    {
+        // the sleeping workers check the counter under this mutex, so the wakeup cannot get lost
+        std::lock_guard< std::mutex > lock( mWakeMutex );
+        mNumQueuedTasks.fetch_add( 1 );
+    }
+    mWakeCondition.notify_one();
+}
+
+bool WorkStealingPool::tryPopTask( const int32_t ownWorkerIdx, task_t& task ) {
+    if (ownWorkerIdx >= 0) {
+        worker_t& worker = *mWorkers[ownWorkerIdx];
+        std::lock_guard< std::mutex > lock( worker.mutex );
+        if (!worker.tasks.empty()) {
+            task = std::move( worker.tasks.back() );
+            worker.tasks.pop_back();
+            mNumQueuedTasks.fetch_sub( 1 );
+            return true;
+        }
+    }
+
+    const uint32_t numWorkers = getNumWorkers();
+    const uint32_t firstVictim = static_cast<uint32_t>( ownWorkerIdx + 1 );
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        const uint32_t victimIdx = ( firstVictim + i ) % numWorkers;
+        if (static_cast<int32_t>( victimIdx ) == ownWorkerIdx) { continue; }
+        worker_t& victim = *mWorkers[victimIdx];
+        std::lock_guard< std::mutex > lock( victim.mutex );
+        if (!victim.tasks.empty()) {
+            task = std::move( victim.tasks.front() );
+            victim.tasks.pop_front();
+            mNumQueuedTasks.fetch_sub( 1 );
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkStealingPool::tryRunOneTask() {
+    task_t task;
+    if (!tryPopTask( ( tpWorkerPool == this ) ? tWorkerIdx : -1, task )) { return false; }
+    task();
+    return true;
+}
+
+void WorkStealingPool::workerLoop( const uint32_t workerIdx ) {
+    tpWorkerPool = this;
+    tWorkerIdx = static_cast<int32_t>( workerIdx );
+
+    for (;;) {
+        task_t task;
+        if (tryPopTask( tWorkerIdx, task )) {
+            task();
+            continue;
+        }
+        std::unique_lock< std::mutex > lock( mWakeMutex );
+        mWakeCondition.wait( lock, [this]() { return mStop || mNumQueuedTasks.load() > 0; } );
+        if (mStop && mNumQueuedTasks.load() == 0) { return; }
+    }
+}
+
+
+ExecutionContext::ExecutionContext( const options_t& options ) : mOptions( options ) {
+    if (mOptions.backend == backend_t::WORK_STEALING_POOL) {
+        if (!mOptions.pPool) { mOptions.pPool = WorkStealingPool::getShared(); }
+        const uint32_t maxThreads = mOptions.pPool->getNumWorkers() + 1; // + the calling thread
+        mNumThreads = ( mOptions.numThreads > 0 ) ? std::min( mOptions.numThreads, maxThreads ) : maxThreads;
+    } else {
+        mNumThreads = ( mOptions.numThreads > 0 ) ? mOptions.numThreads : static_cast<uint32_t>( std::max( 1, omp_get_max_threads() ) );
+    }
+}
+
+std::shared_ptr< const ExecutionContext > ExecutionContext::getDefault() {
+    static const std::shared_ptr< const ExecutionContext > pDefaultContext = std::make_shared< const ExecutionContext >();
+    return pDefaultContext;
+}
+
+void ExecutionContext::forEachChunk( const int64_t begin, const int64_t end, const int64_t grainSize, const chunkFunc_t& chunkFunc ) const {
+    if (end <= begin) { return; }
+    const int64_t chunkSize = std::max( grainSize, int64_t( 1 ) );
+    const int64_t numChunks = ( end - begin + chunkSize - 1 ) / chunkSize;
+    const int32_t numThreads = static_cast<int32_t>( std::min( static_cast<int64_t>( mNumThreads ), numChunks ) );
+
+    if (numThreads <= 1) {
+        for (int64_t chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize) {
+            chunkFunc( chunkBegin, std::min( chunkBegin + chunkSize, end ), 0 );
+        }
+        return;
+    }
+
+    if (mOptions.backend == backend_t::WORK_STEALING_POOL) {
+        auto pLoop = std::make_shared< poolLoop_t >();
+        pLoop->numChunks = numChunks;
+        pLoop->begin = begin;
+        pLoop->end = end;
+        pLoop->grainSize = chunkSize;
+        pLoop->pChunkFunc = &chunkFunc;
+
+        for (int32_t slot = 1; slot < numThreads; slot++) {
+            mOptions.pPool->submit( [pLoop, slot]() { runLoopChunks( *pLoop, static_cast<uint32_t>( slot ) ); } );
+        }
+        runLoopChunks( *pLoop, 0 );
+        while (pLoop->numChunksDone.load( std::memory_order_acquire ) < numChunks) {
+            if (!mOptions.pPool->tryRunOneTask()) { std::this_thread::yield(); }
+        }
+        return;
+    }
+
+    // proc_bind needs OpenMP 4.0, which MSVC does not have
+#if defined( _OPENMP ) && ( _OPENMP >= 201307 )
+    if (mOptions.affinity == threadAffinity_t::COMPACT) {
+        #pragma omp parallel num_threads( numThreads ) proc_bind( close )
+        ompLoopChunks( begin, end, chunkSize, numChunks, chunkFunc );
+        return;
+    }
+    if (mOptions.affinity == threadAffinity_t::SPREAD) {
+        #pragma omp parallel num_threads( numThreads ) proc_bind( spread )
+        ompLoopChunks( begin, end, chunkSize, numChunks, chunkFunc );
+        return;
+    }
+#endif
+    #pragma omp parallel num_threads( numThreads )
+    ompLoopChunks( begin, end, chunkSize, numChunks, chunkFunc );
+}
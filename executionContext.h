@@ -0,0 +1,113 @@
+#ifndef _EXECUTIONCONTEXT_H_3D0C8B7E_52A1_4F4C_9E0B_6A1F27C4D913
+#define _EXECUTIONCONTEXT_H_3D0C8B7E_52A1_4F4C_9E0B_6A1F27C4D913
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FileLoader {
+
+    enum class threadAffinity_t {
+        NONE    = 0, // the OS places the threads
+        COMPACT = 1, // consecutive threads on consecutive cores
+        SPREAD  = 2, // threads spread evenly over all cores
+    };
+
+    // Worker threads with one task deque each. A worker pops its own deque from the back and steals from the front
+    // of the others when it runs dry. Threads that wait for their tasks to finish help with any queued task meanwhile,
+    // so nested parallel loops cannot deadlock. A pool can be shared by any number of ExecutionContexts.
+    struct WorkStealingPool {
+        using task_t = std::function< void() >;
+
+        // numWorkers == 0: one worker less than hardware threads, the thread that waits for a loop works as well
+        explicit WorkStealingPool( const uint32_t numWorkers = 0, const threadAffinity_t affinity = threadAffinity_t::NONE );
+        ~WorkStealingPool();
+
+        WorkStealingPool( const WorkStealingPool& ) = delete;
+        WorkStealingPool& operator=( const WorkStealingPool& ) = delete;
+
+        // process-wide pool, created on first use
+        static std::shared_ptr< WorkStealingPool > getShared();
+
+        inline uint32_t getNumWorkers() const { return static_cast<uint32_t>( mWorkers.size() ); }
+
+        void submit( task_t task );
+        // runs one queued task on the calling thread, returns false if there was none
+        bool tryRunOneTask();
+
+    private:
+        struct worker_t {
+            std::mutex              mutex;
+            std::deque< task_t >    tasks;
+        };
+
+        bool tryPopTask( const int32_t ownWorkerIdx, task_t& task );
+        void workerLoop( const uint32_t workerIdx );
+
+        std::vector< std::unique_ptr< worker_t > >  mWorkers;
+        std::vector< std::thread >                  mThreads;
+        std::mutex                                  mWakeMutex;
+        std::condition_variable                     mWakeCondition;
+        std::atomic< int64_t >                      mNumQueuedTasks{ 0 };
+        std::atomic< uint32_t >                     mNextSubmitWorker{ 0 };
+        bool                                        mStop = false;
+    };
+
+    // How the parallel passes of the loaders run: thread count, affinity and backend. Nothing in here touches
+    // global OpenMP state, the settings are applied per parallel region.
+    struct ExecutionContext {
+        enum class backend_t {
+            OPENMP              = 0,
+            WORK_STEALING_POOL  = 1,
+        };
+
+        struct options_t {
+            uint32_t                            numThreads  = 0; // 0: all threads of the backend
+            threadAffinity_t                    affinity    = threadAffinity_t::NONE; // OpenMP only, pools are pinned when they are created
+            backend_t                           backend     = backend_t::OPENMP;
+            std::shared_ptr< WorkStealingPool > pPool;           // WORK_STEALING_POOL only, nullptr: WorkStealingPool::getShared()
+        };
+
+        ExecutionContext() : ExecutionContext( options_t{} ) {}
+        explicit ExecutionContext( const options_t& options );
+
+        // OpenMP with its default thread count
+        static std::shared_ptr< const ExecutionContext > getDefault();
+
+        inline const options_t& getOptions() const { return mOptions; }
+        // upper bound of the threads working on one loop, parallelForSlots() passes slots in [0, getNumThreads())
+        inline uint32_t getNumThreads() const { return mNumThreads; }
+
+        // func( idx ) for all idx in [begin, end), chunks of grainSize indices are handed out dynamically
+        template< typename func_T >
+        void parallelFor( const int64_t begin, const int64_t end, const int64_t grainSize, const func_T& func ) const {
+            forEachChunk( begin, end, grainSize, [&func]( const int64_t chunkBegin, const int64_t chunkEnd, const uint32_t ) {
+                for (int64_t idx = chunkBegin; idx < chunkEnd; idx++) { func( idx ); }
+            } );
+        }
+
+        // func( idx, slot ); no two calls with the same slot run at the same time, so the slot can index per-thread
+        // scratch memory or partial results of a reduction
+        template< typename func_T >
+        void parallelForSlots( const int64_t begin, const int64_t end, const int64_t grainSize, const func_T& func ) const {
+            forEachChunk( begin, end, grainSize, [&func]( const int64_t chunkBegin, const int64_t chunkEnd, const uint32_t slot ) {
+                for (int64_t idx = chunkBegin; idx < chunkEnd; idx++) { func( idx, slot ); }
+            } );
+        }
+
+    private:
+        using chunkFunc_t = std::function< void( const int64_t chunkBegin, const int64_t chunkEnd, const uint32_t slot ) >;
+        void forEachChunk( const int64_t begin, const int64_t end, const int64_t grainSize, const chunkFunc_t& chunkFunc ) const;
+
+        options_t   mOptions;
+        uint32_t    mNumThreads = 1;
+    };
+}
+#endif // _EXECUTIONCONTEXT_H_3D0C8B7E_52A1_4F4C_9E0B_6A1F27C4D913
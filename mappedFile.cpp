@@ -0,0 +1,108 @@
+#include "mappedFile.h"
+
+#include <utility>
+
+#if defined( _WIN32 )
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace FileLoader;
+
+MappedFile::MappedFile( MappedFile&& other ) noexcept {
+    *this = std::move( other );
+}
+
+MappedFile& MappedFile::operator=( MappedFile&& other ) noexcept {
+    if (this != &other) {
+        close();
+        std::swap( mpData, other.mpData );
+        std::swap( mSize, other.mSize );
+    #if defined( _WIN32 )
+        std::swap( mFileHandle, other.mFileHandle );
+        std::swap( mMappingHandle, other.mMappingHandle );
+    #endif
+    }
+    return *this;
+}
+
+eRetVal MappedFile::open( const std::string& fileUrl, const accessMode_t accessMode ) {
+    close();
+
+#if defined( _WIN32 )
+    HANDLE hFile = CreateFileA( fileUrl.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if (hFile == INVALID_HANDLE_VALUE) { return eRetVal::ERROR; }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx( hFile, &fileSize ) || fileSize.QuadPart == 0) {
+        CloseHandle( hFile );
+        return eRetVal::ERROR;
+    }
+
+    const DWORD protection = ( accessMode == accessMode_t::COPY_ON_WRITE ) ? PAGE_WRITECOPY : PAGE_READONLY;
+    HANDLE hMapping = CreateFileMappingA( hFile, nullptr, protection, 0, 0, nullptr );
+    if (hMapping == nullptr) {
+        CloseHandle( hFile );
+        return eRetVal::ERROR;
+    }
+
+    const DWORD access = ( accessMode == accessMode_t::COPY_ON_WRITE ) ? FILE_MAP_COPY : FILE_MAP_READ;
+    void* pView = MapViewOfFile( hMapping, access, 0, 0, 0 );
+    if (pView == nullptr) {
+        CloseHandle( hMapping );
+        CloseHandle( hFile );
+        return eRetVal::ERROR;
+    }
+
+    mFileHandle = hFile;
+    mMappingHandle = hMapping;
+    mpData = static_cast<uint8_t*>( pView );
+    mSize = static_cast<size_t>( fileSize.QuadPart );
+#else
+    const int fd = ::open( fileUrl.c_str(), O_RDONLY );
+    if (fd < 0) { return eRetVal::ERROR; }
+
+    struct stat fileStat;
+    if (fstat( fd, &fileStat ) != 0 || fileStat.st_size == 0) {
+        ::close( fd );
+        return eRetVal::ERROR;
+    }
+
+    const int protection = ( accessMode == accessMode_t::COPY_ON_WRITE ) ? ( PROT_READ | PROT_WRITE ) : PROT_READ;
+    void* pView = mmap( nullptr, static_cast<size_t>( fileStat.st_size ), protection, MAP_PRIVATE, fd, 0 );
+    ::close( fd ); // the mapping keeps its own reference to the file
+    if (pView == MAP_FAILED) { return eRetVal::ERROR; }
+
+    mpData = static_cast<uint8_t*>( pView );
+    mSize = static_cast<size_t>( fileStat.st_size );
+#endif
+
+    return eRetVal::OK;
+}
+
+void MappedFile::close() {
+    if (mpData == nullptr) { return; }
+
+#if defined( _WIN32 )
+    UnmapViewOfFile( mpData );
+    CloseHandle( static_cast<HANDLE>( mMappingHandle ) );
+    CloseHandle( static_cast<HANDLE>( mFileHandle ) );
+    mMappingHandle = nullptr;
+    mFileHandle = nullptr;
+#else
+    munmap( mpData, mSize );
+#endif
+
+    mpData = nullptr;
+    mSize = 0;
+}
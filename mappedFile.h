@@ -0,0 +1,43 @@
+#ifndef _MAPPEDFILE_H_2FC5AE9C_7CB4_4D7A_82B2_91CE52D25385
+#define _MAPPEDFILE_H_2FC5AE9C_7CB4_4D7A_82B2_91CE52D25385
+
+#include "eRetVal_FileLoader.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+namespace FileLoader {
+    // Memory mapping of a whole file. Pages are only faulted in when they are accessed.
+    struct MappedFile {
+        enum class accessMode_t {
+            READ_ONLY       = 0,
+            COPY_ON_WRITE   = 1, // writes go to private pages and never reach the file
+        };
+
+        MappedFile() = default;
+        ~MappedFile() { close(); }
+
+        MappedFile( const MappedFile& ) = delete;
+        MappedFile& operator=( const MappedFile& ) = delete;
+        MappedFile( MappedFile&& other ) noexcept;
+        MappedFile& operator=( MappedFile&& other ) noexcept;
+
+        eRetVal open( const std::string& fileUrl, const accessMode_t accessMode = accessMode_t::READ_ONLY );
+        void close();
+
+        inline bool isOpen() const { return mpData != nullptr; }
+        inline uint8_t* data() const { return mpData; }
+        inline size_t size() const { return mSize; }
+
+    private:
+        uint8_t*    mpData = nullptr;
+        size_t      mSize = 0;
+    #if defined( _WIN32 )
+        void*       mFileHandle = nullptr;
+        void*       mMappingHandle = nullptr;
+    #endif
+    };
+}
+#endif // _MAPPEDFILE_H_2FC5AE9C_7CB4_4D7A_82B2_91CE52D25385
@@ -0,0 +1,142 @@
+#include "meshNormals.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using namespace FileLoader;
+using namespace FileLoader::meshNormals;
+
+namespace {
+    using vec3_t = std::array<float, 3>;
+
+    constexpr int64_t trisPerTask = 1 << 14;
+    constexpr int64_t verticesPerTask = 1 << 14;
+
+    static vec3_t cross( const vec3_t& a, const vec3_t& b ) {
+        return vec3_t{ a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    }
+
+    static float dot( const vec3_t& a, const vec3_t& b ) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    static vec3_t coordOf( const triangleMesh_t& mesh, const uint32_t vertex ) {
+        const float* const pCoord = mesh.pCoords + vertex * mesh.coordStride;
+        return vec3_t{ pCoord[0], pCoord[1], pCoord[2] };
+    }
+
+    // The adjacency counters only need atomic increments if more than one thread runs the passes, a locked increment
+    // of a random counter costs more than the cache miss of a plain one.
+    static uint32_t incrementCounter( std::atomic< uint32_t >& counter, const bool concurrent ) {
+        if (concurrent) { return counter.fetch_add( 1, std::memory_order_relaxed ); }
+        const uint32_t value = counter.load( std::memory_order_relaxed );
+        counter.store( value + 1, std::memory_order_relaxed );
+        return value;
+    }
+
+    static int64_t numTasksOf( const size_t count, const int64_t perTask ) {
+        return ( static_cast<int64_t>( count ) + perTask - 1 ) / perTask;
+    }
+}
+
+void meshNormals::computeVertexNormals( const ExecutionContext& executionContext, const triangleMesh_t& mesh, const normalWeighting_t weighting,
+                                        float* pNormals, const size_t normalStride ) {
+    const size_t numCorners = mesh.numTris * 3;
+    const uint32_t numVertices = static_cast<uint32_t>( mesh.numVertices );
+    const bool concurrent = ( executionContext.getNumThreads() > 1 );
+
+    // corners per vertex, later the write cursor of each vertex in the adjacency
+    std::unique_ptr< std::atomic< uint32_t >[] > vertexCorners( new std::atomic< uint32_t >[numVertices] );
+    executionContext.parallelFor( 0, numTasksOf( numVertices, verticesPerTask ), 1, [&]( const int64_t task ) {
+        const uint32_t vertexEnd = static_cast<uint32_t>( std::min< int64_t >( numVertices, ( task + 1 ) * verticesPerTask ) );
+        for (uint32_t vertex = static_cast<uint32_t>( task * verticesPerTask ); vertex < vertexEnd; vertex++) { vertexCorners[vertex].store( 0, std::memory_order_relaxed ); }
+    } );
+
+    // Weighted normals of the faces (AREA: the cross product of two edges, twice the area) or of the corners (ANGLE).
+    // Corners with an index out of range are left out of the adjacency.
+    const bool perCorner = ( weighting == normalWeighting_t::ANGLE );
+    std::vector< vec3_t > weightedNormals( perCorner ? numCorners : mesh.numTris );
+    executionContext.parallelFor( 0, numTasksOf( mesh.numTris, trisPerTask ), 1, [&]( const int64_t task ) {
+        const size_t triEnd = std::min< size_t >( mesh.numTris, size_t( task + 1 ) * trisPerTask );
+        for (size_t tri = size_t( task ) * trisPerTask; tri < triEnd; tri++) {
+            const uint32_t* const pTri = mesh.pTris + tri * 3;
+            if (pTri[0] >= numVertices || pTri[1] >= numVertices || pTri[2] >= numVertices) {
+                for (uint32_t corner = 0; corner < 3; corner++) {
+                    if (pTri[corner] < numVertices) { incrementCounter( vertexCorners[pTri[corner]], concurrent ); }
+                    if (perCorner) { weightedNormals[tri * 3 + corner] = vec3_t{ 0.0f, 0.0f, 0.0f }; }
+                }
+                if (!perCorner) { weightedNormals[tri] = vec3_t{ 0.0f, 0.0f, 0.0f }; }
+                continue;
+            }
+
+            const vec3_t p[3] = { coordOf( mesh, pTri[0] ), coordOf( mesh, pTri[1] ), coordOf( mesh, pTri[2] ) };
+            const vec3_t faceNormal = cross( vec3_t{ p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] },
+                                             vec3_t{ p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] } );
+            for (uint32_t corner = 0; corner < 3; corner++) { incrementCounter( vertexCorners[pTri[corner]], concurrent ); }
+            if (!perCorner) {
+                weightedNormals[tri] = faceNormal;
+                continue;
+            }
+
+            const float faceNormalLength = sqrtf( dot( faceNormal, faceNormal ) );
+            const float invLength = ( faceNormalLength > 0.0f ) ? 1.0f / faceNormalLength : 0.0f;
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                const vec3_t& p0 = p[corner];
+                const vec3_t& p1 = p[( corner + 1 ) % 3];
+                const vec3_t& p2 = p[( corner + 2 ) % 3];
+                const vec3_t e1{ p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+                const vec3_t e2{ p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+                const vec3_t e1xe2 = cross( e1, e2 );
+                const float weight = atan2f( sqrtf( dot( e1xe2, e1xe2 ) ), dot( e1, e2 ) ) * invLength;
+                weightedNormals[tri * 3 + corner] = vec3_t{ faceNormal[0] * weight, faceNormal[1] * weight, faceNormal[2] * weight };
+            }
+        }
+    } );
+
+    // CSR offsets, the counts turn into the write cursors
+    std::vector< uint32_t > adjacencyOffsets( size_t( numVertices ) + 1 );
+    adjacencyOffsets[0] = 0;
+    for (uint32_t vertex = 0; vertex < numVertices; vertex++) {
+        adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + vertexCorners[vertex].load( std::memory_order_relaxed );
+        vertexCorners[vertex].store( adjacencyOffsets[vertex], std::memory_order_relaxed );
+    }
+
+    std::vector< uint32_t > adjacentCorners( adjacencyOffsets[numVertices] );
+    executionContext.parallelFor( 0, numTasksOf( mesh.numTris, trisPerTask ), 1, [&]( const int64_t task ) {
+        const size_t cornerEnd = std::min< size_t >( numCorners, size_t( task + 1 ) * trisPerTask * 3 );
+        for (size_t corner = size_t( task ) * trisPerTask * 3; corner < cornerEnd; corner++) {
+            const uint32_t vertex = mesh.pTris[corner];
+            if (vertex < numVertices) { adjacentCorners[incrementCounter( vertexCorners[vertex], concurrent )] = static_cast<uint32_t>( corner ); }
+        }
+    } );
+    vertexCorners.reset();
+
+    // the cursors hand out the slots of a vertex in any order, sorting its corners fixes the order of the sum
+    executionContext.parallelFor( 0, numTasksOf( numVertices, verticesPerTask ), 1, [&]( const int64_t task ) {
+        const uint32_t vertexEnd = static_cast<uint32_t>( std::min< int64_t >( numVertices, ( task + 1 ) * verticesPerTask ) );
+        for (uint32_t vertex = static_cast<uint32_t>( task * verticesPerTask ); vertex < vertexEnd; vertex++) {
+            uint32_t* const pBegin = adjacentCorners.data() + adjacencyOffsets[vertex];
+            uint32_t* const pEnd = adjacentCorners.data() + adjacencyOffsets[vertex + 1];
+            std::sort( pBegin, pEnd );
+
+            vec3_t sum{ 0.0f, 0.0f, 0.0f };
+            for (const uint32_t* pCorner = pBegin; pCorner < pEnd; pCorner++) {
+                const vec3_t& weightedNormal = weightedNormals[perCorner ? *pCorner : *pCorner / 3];
+                sum[0] += weightedNormal[0];
+                sum[1] += weightedNormal[1];
+                sum[2] += weightedNormal[2];
+            }
+            const float length = sqrtf( dot( sum, sum ) );
+            const float invLength = ( length > 0.0f ) ? 1.0f / length : 0.0f;
+            float* const pNormal = pNormals + size_t( vertex ) * normalStride;
+            pNormal[0] = sum[0] * invLength;
+            pNormal[1] = sum[1] * invLength;
+            pNormal[2] = sum[2] * invLength;
+        }
+    } );
+}
@@ -0,0 +1,36 @@
+#ifndef _MESHNORMALS_H_F6EDEB07_9E85_411B_9AE8_BEED315A17FD
+#define _MESHNORMALS_H_F6EDEB07_9E85_411B_9AE8_BEED315A17FD
+
+#include "executionContext.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace FileLoader {
+    namespace meshNormals {
+
+        enum class normalWeighting_t {
+            AREA    = 0, // each face contributes its normal scaled by its area
+            ANGLE   = 1, // each face contributes its unit normal scaled by the angle of its corner at the vertex
+        };
+
+        // Indexed triangle mesh. The strides are in floats, so interleaved vertex buffers (e.g. ObjModel's VertexData)
+        // can be passed without a copy; tightly packed xyz triples have a stride of 3. Face indices of a signed type
+        // (e.g. the int32_t triples of the OFF loader) can be passed reinterpreted as long as they are not negative.
+        struct triangleMesh_t {
+            const float*    pCoords;
+            size_t          coordStride;
+            size_t          numVertices;
+            const uint32_t* pTris;
+            size_t          numTris;
+        };
+
+        // Unit vertex normals from the weighted face normals of the triangles around each vertex, written to
+        // pNormals[vertex * normalStride + 0..2]. Vertices without a triangle or with a zero sum get (0, 0, 0).
+        // The faces of a vertex are gathered through a vertex-to-corner adjacency (CSR) and summed in corner order,
+        // so there are no write races and the result does not depend on the thread count.
+        void computeVertexNormals( const ExecutionContext& executionContext, const triangleMesh_t& mesh, const normalWeighting_t weighting,
+                                   float* pNormals, const size_t normalStride );
+    }
+}
+#endif // _MESHNORMALS_H_F6EDEB07_9E85_411B_9AE8_BEED315A17FD
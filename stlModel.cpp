@@ -1,8 +1,23 @@
 #include "stlModel.h"
+#include "mappedFile.h"
+#include "meshNormals.h"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <iostream>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
 #include "stl_reader/stl_reader.h"
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+    #define STL_DECODE_SSE2     1
+    #include <emmintrin.h>
+#else
+    #define STL_DECODE_SSE2     0
+#endif
+
 #ifndef _USE_MATH_DEFINES
     #define _USE_MATH_DEFINES
 #endif
@@ -21,6 +36,366 @@ namespace {
         }
         return result;
     }
+
+    using coordWithIndex_t = stl_reader::stl_reader_impl::CoordWithIndex< float, uint32_t >;
+    static_assert( sizeof( coordWithIndex_t ) == 4 * sizeof( float ), "a corner is decoded as one 16 byte vector" );
+
+    // binary STL: 80 byte header, uint32_t triangle count, then per triangle the face normal, three corners and a 16 bit attribute
+    constexpr size_t binaryHeaderSize = 84;
+    constexpr size_t binaryRecordSize = 50;
+    constexpr int64_t binaryRecordsPerTask = 1 << 14;
+
+    // Decodes the records [firstTri, endTri) into corners indexed in file order and the triangles over them. The face normals 
+    // of the file are skipped, the vertex normals are computed from the welded geometry.
+    // The SSE2 path loads each corner with the 4 bytes behind it and replaces those with the index. The last corner of a 
+    // record reads 2 bytes into the next record, so the last record of the file is decoded by the scalar path.
+    static void decodeBinaryRecords( const uint8_t* pRecords, const size_t numRecords, const size_t firstTri, const size_t endTri,
+                                     coordWithIndex_t* corners, uint32_t* tris ) {
+        size_t tri = firstTri;
+    #if ( STL_DECODE_SSE2 != 0 )
+        const __m128i xyzMask = _mm_set_epi32( 0, -1, -1, -1 );
+        for (const size_t simdEnd = std::min( endTri, numRecords - 1 ); tri < simdEnd; tri++) {
+            const uint8_t* const pRecord = pRecords + tri * binaryRecordSize;
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                const uint32_t cornerIdx = static_cast<uint32_t>( tri * 3 + corner );
+                const __m128i xyz = _mm_and_si128( _mm_loadu_si128( reinterpret_cast< const __m128i* >( pRecord + 12 + corner * 12 ) ), xyzMask );
+                _mm_storeu_si128( reinterpret_cast< __m128i* >( corners + cornerIdx ), _mm_or_si128( xyz, _mm_slli_si128( _mm_cvtsi32_si128( static_cast<int32_t>( cornerIdx ) ), 12 ) ) );
+                tris[cornerIdx] = cornerIdx;
+            }
+        }
+    #endif
+        for (; tri < endTri; tri++) {
+            const uint8_t* const pRecord = pRecords + tri * binaryRecordSize;
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                const uint32_t cornerIdx = static_cast<uint32_t>( tri * 3 + corner );
+                memcpy( corners[cornerIdx].data, pRecord + 12 + corner * 12, 3 * sizeof( float ) );
+                corners[cornerIdx].index = cornerIdx;
+                tris[cornerIdx] = cornerIdx;
+            }
+        }
+    }
+
+    // slot of the weld table, its corner is the smallest one with the coordinates of the slot
+    struct weldSlot_t {
+        float                   coord[3];
+        std::atomic< uint32_t > corner;
+    };
+    constexpr uint32_t emptySlot = 0xFFFFFFFFu;
+    constexpr uint32_t busySlot = 0xFFFFFFFEu; // claimed, coord is being written
+    constexpr int64_t weldCornersPerTask = 3 << 13; // whole triangles
+
+    // Corners are equal if their coordinates compare equal like in the SORT weld, so -0 is hashed as +0 and a corner 
+    // with a NaN coordinate stays a vertex of its own.
+    static uint64_t hashCoord( const float* coord ) {
+        uint32_t bits[3];
+        for (uint32_t i = 0; i < 3; i++) {
+            const float positiveZero = coord[i] + 0.0f;
+            memcpy( &bits[i], &positiveZero, sizeof( positiveZero ) );
+        }
+        uint64_t key = ( ( uint64_t( bits[0] ) << 32 ) | bits[1] ) ^ ( uint64_t( bits[2] ) * 0x9E3779B97F4A7C15ull );
+        key = ( key ^ ( key >> 33 ) ) * 0xFF51AFD7ED558CCDull;
+        key = ( key ^ ( key >> 33 ) ) * 0xC4CEB9FE1A85EC53ull;
+        return key ^ ( key >> 33 );
+    }
+
+    static bool equalCoords( const float* a, const float* b ) {
+        return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+    }
+
+    // Welds the corners (in file order, three per triangle) into coords and the triangles over them, triangles with two 
+    // equal corners are removed. The slots hold the coordinates next to the corner, so an insert
+    // touches one cache line per probe. Every slot ends up with the smallest corner of its coordinates, the vertices are 
+    // numbered in the order of their first corner whatever the thread count.
+    static void weldCornersHashed( const ExecutionContext& executionContext, const std::vector< coordWithIndex_t >& corners,
+                                   std::vector< float >& coords, std::vector< uint32_t >& tris ) {
+        const int64_t numCorners = static_cast<int64_t>( corners.size() );
+        const int64_t numTasks = ( numCorners + weldCornersPerTask - 1 ) / weldCornersPerTask;
+        uint64_t capacity = 1;
+        while (capacity < uint64_t( numCorners ) + uint64_t( numCorners ) / 4 && capacity < ( uint64_t( 1 ) << 32 )) { capacity *= 2; }
+        const uint64_t mask = capacity - 1;
+        std::unique_ptr< weldSlot_t[] > slots( new weldSlot_t[capacity] );
+        executionContext.parallelFor( 0, static_cast<int64_t>( ( capacity + weldCornersPerTask - 1 ) / weldCornersPerTask ), 1, [&]( const int64_t task ) {
+            const uint64_t slotEnd = std::min< uint64_t >( capacity, uint64_t( task + 1 ) * weldCornersPerTask );
+            for (uint64_t slot = uint64_t( task ) * weldCornersPerTask; slot < slotEnd; slot++) { slots[slot].corner.store( emptySlot, std::memory_order_relaxed ); }
+        } );
+
+        // insert, tris[corner] = slot of the corner's coordinates
+        executionContext.parallelFor( 0, numTasks, 1, [&]( const int64_t task ) {
+            const uint32_t cornerEnd = static_cast<uint32_t>( std::min( numCorners, ( task + 1 ) * weldCornersPerTask ) );
+            for (uint32_t cornerIdx = static_cast<uint32_t>( task * weldCornersPerTask ); cornerIdx < cornerEnd; cornerIdx++) {
+                const float* const coord = corners[cornerIdx].data;
+                for (uint64_t slot = hashCoord( coord ) & mask;; slot = ( slot + 1 ) & mask) {
+                    weldSlot_t& weldSlot = slots[slot];
+                    uint32_t slotCorner = weldSlot.corner.load( std::memory_order_acquire );
+                    if (slotCorner == emptySlot && weldSlot.corner.compare_exchange_strong( slotCorner, busySlot, std::memory_order_acquire )) {
+                        memcpy( weldSlot.coord, coord, sizeof( weldSlot.coord ) );
+                        weldSlot.corner.store( cornerIdx, std::memory_order_release );
+                        tris[cornerIdx] = static_cast<uint32_t>( slot );
+                        break;
+                    }
+                    while (slotCorner == busySlot) { slotCorner = weldSlot.corner.load( std::memory_order_acquire ); }
+                    if (equalCoords( weldSlot.coord, coord )) {
+                        while (cornerIdx < slotCorner && !weldSlot.corner.compare_exchange_weak( slotCorner, cornerIdx, std::memory_order_relaxed )) {}
+                        tris[cornerIdx] = static_cast<uint32_t>( slot );
+                        break;
+                    }
+                }
+            }
+        } );
+
+        // tris[corner] = first corner of its coordinates, the first corners are counted per task
+        std::vector< uint32_t > numTaskVertices( numTasks + 1, 0 );
+        executionContext.parallelFor( 0, numTasks, 1, [&]( const int64_t task ) {
+            const uint32_t cornerEnd = static_cast<uint32_t>( std::min( numCorners, ( task + 1 ) * weldCornersPerTask ) );
+            uint32_t numVertices = 0;
+            for (uint32_t cornerIdx = static_cast<uint32_t>( task * weldCornersPerTask ); cornerIdx < cornerEnd; cornerIdx++) {
+                tris[cornerIdx] = slots[tris[cornerIdx]].corner.load( std::memory_order_relaxed );
+                numVertices += ( tris[cornerIdx] == cornerIdx );
+            }
+            numTaskVertices[task + 1] = numVertices;
+        } );
+        slots.reset();
+        for (int64_t task = 0; task < numTasks; task++) { numTaskVertices[task + 1] += numTaskVertices[task]; }
+
+        // number the first corners and copy their coordinates
+        std::vector< uint32_t > cornerVertex( corners.size() );
+        coords.resize( size_t( numTaskVertices[numTasks] ) * 3 );
+        executionContext.parallelFor( 0, numTasks, 1, [&]( const int64_t task ) {
+            const uint32_t cornerEnd = static_cast<uint32_t>( std::min( numCorners, ( task + 1 ) * weldCornersPerTask ) );
+            uint32_t vertexIdx = numTaskVertices[task];
+            for (uint32_t cornerIdx = static_cast<uint32_t>( task * weldCornersPerTask ); cornerIdx < cornerEnd; cornerIdx++) {
+                if (tris[cornerIdx] != cornerIdx) { continue; }
+                memcpy( &coords[size_t( vertexIdx ) * 3], corners[cornerIdx].data, 3 * sizeof( float ) );
+                cornerVertex[cornerIdx] = vertexIdx++;
+            }
+        } );
+
+        std::atomic< bool > hasDegenerateTris{ false };
+        executionContext.parallelFor( 0, numTasks, 1, [&]( const int64_t task ) {
+            const uint32_t cornerEnd = static_cast<uint32_t>( std::min( numCorners, ( task + 1 ) * weldCornersPerTask ) );
+            for (uint32_t cornerIdx = static_cast<uint32_t>( task * weldCornersPerTask ); cornerIdx < cornerEnd; cornerIdx++) { tris[cornerIdx] = cornerVertex[tris[cornerIdx]]; }
+            for (uint32_t cornerIdx = static_cast<uint32_t>( task * weldCornersPerTask ); cornerIdx < cornerEnd; cornerIdx += 3) {
+                if (tris[cornerIdx] == tris[cornerIdx + 1] || tris[cornerIdx] == tris[cornerIdx + 2] || tris[cornerIdx + 1] == tris[cornerIdx + 2]) { 
+                    hasDegenerateTris.store( true, std::memory_order_relaxed ); 
+                }
+            }
+        } );
+        if (!hasDegenerateTris.load()) { return; }
+
+        size_t numKept = 0;
+        for (size_t triIdx = 0, numTris = tris.size() / 3; triIdx < numTris; triIdx++) {
+            const uint32_t* const tri = &tris[triIdx * 3];
+            if (tri[0] == tri[1] || tri[0] == tri[2] || tri[1] == tri[2]) { continue; }
+            memmove( &tris[numKept * 3], tri, 3 * sizeof( uint32_t ) );
+            numKept++;
+        }
+        tris.resize( numKept * 3 );
+    }
+
+    constexpr int64_t saveTrisPerBlock = 1 << 14;
+    constexpr int64_t saveBlocksPerWrite = 16;
+
+    // unit normal of the triangle, (0, 0, 0) if it is degenerate
+    static void faceNormalOf( const float* coords, const uint32_t* tri, float* normal ) {
+        const float* const p0 = coords + size_t( tri[0] ) * 3;
+        const float* const p1 = coords + size_t( tri[1] ) * 3;
+        const float* const p2 = coords + size_t( tri[2] ) * 3;
+        const std::array<float, 3> e1{ p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        const std::array<float, 3> e2{ p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        const std::array<float, 3> n{ e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        const float length = sqrtf( dot<float, uint32_t{3u}>( n, n ) );
+        const float invLength = ( length > 0.0f ) ? 1.0f / length : 0.0f;
+        for (uint32_t i = 0; i < 3; i++) { normal[i] = n[i] * invLength; }
+    }
+
+    static void encodeBinaryRecords( const float* coords, const uint32_t* tris, const size_t firstTri, const size_t endTri, uint8_t* pRecords ) {
+        for (size_t tri = firstTri; tri < endTri; tri++) {
+            const uint32_t* const pTri = tris + tri * 3;
+            float record[12];
+            faceNormalOf( coords, pTri, record );
+            for (uint32_t corner = 0; corner < 3; corner++) { memcpy( record + 3 + corner * 3, coords + size_t( pTri[corner] ) * 3, 3 * sizeof( float ) ); }
+            uint8_t* const pRecord = pRecords + ( tri - firstTri ) * binaryRecordSize;
+            memcpy( pRecord, record, sizeof( record ) );
+            memset( pRecord + sizeof( record ), 0, binaryRecordSize - sizeof( record ) );
+        }
+    }
+
+    template< size_t size_T >
+    static char* appendLiteral( char* pText, const char ( &literal )[size_T] ) {
+        memcpy( pText, literal, size_T - 1 );
+        return pText + size_T - 1;
+    }
+
+    // shortest representation that reads back to the same float
+    static char* appendFloats( char* pText, const float* values ) {
+        for (uint32_t i = 0; i < 3; i++) {
+            *pText++ = ' ';
+            pText = std::to_chars( pText, pText + 32, values[i] ).ptr;
+        }
+        *pText++ = '\n';
+        return pText;
+    }
+
+    static void formatAsciiFacets( const float* coords, const uint32_t* tris, const size_t firstTri, const size_t endTri, std::string& text ) {
+        constexpr size_t maxFacetSize = 512;
+        text.resize( ( endTri - firstTri ) * maxFacetSize );
+        char* pText = &text[0];
+        for (size_t tri = firstTri; tri < endTri; tri++) {
+            const uint32_t* const pTri = tris + tri * 3;
+            float normal[3];
+            faceNormalOf( coords, pTri, normal );
+            pText = appendLiteral( pText, "  facet normal" );
+            pText = appendFloats( pText, normal );
+            pText = appendLiteral( pText, "    outer loop\n" );
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                pText = appendLiteral( pText, "      vertex" );
+                pText = appendFloats( pText, coords + size_t( pTri[corner] ) * 3 );
+            }
+            pText = appendLiteral( pText, "    endloop\n  endfacet\n" );
+        }
+        text.resize( pText - text.data() );
+    }
+
+    constexpr size_t asciiBytesPerChunk = size_t( 4 ) << 20;
+
+    static bool isSpace( const char c ) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    // Cursor over the ASCII text of one chunk. Tokens are the runs between whitespace, keywords are compared as is 
+    // (lower case) like stl_reader does.
+    struct asciiScanner_t {
+        const char* pCurr;
+        const char* pEnd;
+
+        bool nextToken( const char*& pToken, size_t& length ) {
+            while (pCurr < pEnd && isSpace( *pCurr )) { pCurr++; }
+            pToken = pCurr;
+            while (pCurr < pEnd && !isSpace( *pCurr )) { pCurr++; }
+            length = pCurr - pToken;
+            return length > 0;
+        }
+
+        template< size_t size_T >
+        bool nextKeyword( const char ( &keyword )[size_T] ) {
+            const char* pToken;
+            size_t length;
+            return nextToken( pToken, length ) && isKeyword( pToken, length, keyword );
+        }
+
+        // from_chars takes no leading '+', which some exporters write
+        bool nextFloats( float* values ) {
+            for (uint32_t i = 0; i < 3; i++) {
+                const char* pToken;
+                size_t length;
+                if (!nextToken( pToken, length )) { return false; }
+                if (*pToken == '+') { pToken++; }
+                const std::from_chars_result result = std::from_chars( pToken, pCurr, values[i] );
+                if (result.ec != std::errc() || result.ptr != pCurr) { return false; }
+            }
+            return true;
+        }
+
+        void skipLine() {
+            while (pCurr < pEnd && *pCurr != '\n') { pCurr++; }
+        }
+
+        template< size_t size_T >
+        static bool isKeyword( const char* pToken, const size_t length, const char ( &keyword )[size_T] ) {
+            return length == size_T - 1 && memcmp( pToken, keyword, length ) == 0;
+        }
+    };
+
+    // corners of the facets of one chunk, solids hold the chunk's triangle count at each "solid"
+    struct asciiChunk_t {
+        std::vector< float >    coords;
+        std::vector< uint32_t > solids;
+        bool                    ok = true;
+    };
+
+    static bool parseAsciiChunk( const char* pBegin, const char* pEnd, asciiChunk_t& chunk ) {
+        asciiScanner_t scanner{ pBegin, pEnd };
+        const char* pToken;
+        size_t length;
+        float values[3];
+        while (scanner.nextToken( pToken, length )) {
+            if (asciiScanner_t::isKeyword( pToken, length, "facet" )) {
+                // facet normal nx ny nz, outer loop, 3 x vertex x y z, endloop, endfacet; the normal is not used
+                if (!scanner.nextKeyword( "normal" ) || !scanner.nextFloats( values ) || !scanner.nextKeyword( "outer" ) || !scanner.nextKeyword( "loop" )) { return false; }
+                for (uint32_t corner = 0; corner < 3; corner++) {
+                    if (!scanner.nextKeyword( "vertex" ) || !scanner.nextFloats( values )) { return false; }
+                    chunk.coords.insert( chunk.coords.end(), values, values + 3 );
+                }
+                if (!scanner.nextKeyword( "endloop" ) || !scanner.nextKeyword( "endfacet" )) { return false; }
+            } else if (asciiScanner_t::isKeyword( pToken, length, "solid" )) {
+                chunk.solids.push_back( static_cast<uint32_t>( chunk.coords.size() / 9 ) );
+                scanner.skipLine(); // name
+            } else {
+                scanner.skipLine(); // endsolid and lines stl_reader ignores as well
+            }
+        }
+        return true;
+    }
+
+    // Chunk boundaries are moved forward to the next "facet" that starts a line, so neither "endfacet" nor a solid name
+    // can match. The chunks are parsed in parallel and copied into corners indexed in file order.
+    static bool startsFacetLine( const char* pText, const char* pToken, const char* pEnd ) {
+        if (pEnd - pToken < 5 || memcmp( pToken, "facet", 5 ) != 0) { return false; }
+        const char* pPrev = pToken - 1;
+        while (pPrev >= pText && ( *pPrev == ' ' || *pPrev == '\t' )) { pPrev--; }
+        return pPrev < pText || *pPrev == '\n' || *pPrev == '\r';
+    }
+
+    static bool parseAscii( const ExecutionContext& executionContext, const char* pText, const size_t size, 
+                            std::vector< coordWithIndex_t >& corners, std::vector< uint32_t >& tris, std::vector< uint32_t >& solids ) {
+        std::vector< const char* > chunkBegins{ pText };
+        for (size_t offset = asciiBytesPerChunk; offset < size; offset += asciiBytesPerChunk) {
+            const char* pBoundary = std::max( chunkBegins.back() + 1, pText + offset );
+            while (pBoundary < pText + size && !startsFacetLine( pText, pBoundary, pText + size )) { pBoundary++; }
+            if (pBoundary == pText + size) { break; }
+            chunkBegins.push_back( pBoundary );
+        }
+        chunkBegins.push_back( pText + size );
+
+        const int64_t numChunks = static_cast<int64_t>( chunkBegins.size() ) - 1;
+        std::vector< asciiChunk_t > chunks( numChunks );
+        executionContext.parallelFor( 0, numChunks, 1, [&]( const int64_t chunkIdx ) {
+            asciiChunk_t& chunk = chunks[chunkIdx];
+            chunk.coords.reserve( ( chunkBegins[chunkIdx + 1] - chunkBegins[chunkIdx] ) / 24 ); // ~ 8 bytes per coordinate
+            chunk.ok = parseAsciiChunk( chunkBegins[chunkIdx], chunkBegins[chunkIdx + 1], chunk );
+        } );
+
+        std::vector< size_t > firstCorners( numChunks + 1, 0 );
+        for (int64_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+            if (!chunks[chunkIdx].ok) { return false; }
+            firstCorners[chunkIdx + 1] = firstCorners[chunkIdx] + chunks[chunkIdx].coords.size() / 3;
+            for (const uint32_t solid : chunks[chunkIdx].solids) { solids.push_back( static_cast<uint32_t>( firstCorners[chunkIdx] / 3 ) + solid ); }
+        }
+        if (firstCorners[numChunks] >= busySlot) { return false; }
+        solids.push_back( static_cast<uint32_t>( firstCorners[numChunks] / 3 ) );
+
+        corners.resize( firstCorners[numChunks] );
+        tris.resize( firstCorners[numChunks] );
+        executionContext.parallelFor( 0, numChunks, 1, [&]( const int64_t chunkIdx ) {
+            std::vector< float >& coords = chunks[chunkIdx].coords;
+            for (size_t corner = 0, numChunkCorners = coords.size() / 3; corner < numChunkCorners; corner++) {
+                const uint32_t cornerIdx = static_cast<uint32_t>( firstCorners[chunkIdx] + corner );
+                memcpy( corners[cornerIdx].data, &coords[corner * 3], 3 * sizeof( float ) );
+                corners[cornerIdx].index = cornerIdx;
+                tris[cornerIdx] = cornerIdx;
+            }
+            std::vector< float >().swap( coords );
+        } );
+        return true;
+    }
+
+    // the test of stl_reader::StlFileHasASCIIFormat() on the first 256 bytes of the mapping
+    static bool hasAsciiFormat( const uint8_t* pData, const size_t size ) {
+        std::string start( reinterpret_cast< const char* >( pData ), std::min< size_t >( size, 256 ) );
+        std::transform( start.begin(), start.end(), start.begin(), ::tolower );
+        return start.find( "solid" ) != std::string::npos && start.find( '\n' ) != std::string::npos && 
+               start.find( "facet" ) != std::string::npos && start.find( "normal" ) != std::string::npos;
+    }
 }
 
 void StlModel::clear() {
@@ -35,44 +410,53 @@ void StlModel::clear() {
 
 eRetVal StlModel::load(const std::string& url)
 {
-    std::vector<float> faceNormals;
-    try {
-        stl_reader::ReadStlFile(url.c_str(), mCoords, faceNormals, mIndices, mSolids);
-    }
-    catch (std::exception& e) {
-        std::cout << e.what() << std::endl;
-    }
+    return load( url, loadOptions_t{} );
+}
 
-    mCenterAndRadius = std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f };
-    mWasRadiusCalculated = false;
-    
-    assert( faceNormals.size() % 3 == 0 && "assume there is always a coord-triple xyz in each face normal" );
+eRetVal StlModel::load(const std::string& url, const loadOptions_t& options)
+{
+    clear();
 
-    // distribute face normals to vertices, assume triangles only
-    mNormals.resize( faceNormals.size() * 3 );
+    MappedFile mapping;
+    if (mapping.open( url, MappedFile::accessMode_t::READ_ONLY ) != eRetVal::OK || mapping.size() < binaryHeaderSize) { return eRetVal::ERROR; }
+    uint32_t numTris = 0;
+    memcpy( &numTris, mapping.data() + 80, sizeof( numTris ) );
+    const uint64_t binarySize = binaryHeaderSize + uint64_t( numTris ) * binaryRecordSize;
 
-    std::fill( mNormals.begin(), mNormals.end(), 0.0f );
-    for (size_t faceIdx = 0, lastIdx = mIndices.size() / 3; faceIdx < lastIdx; faceIdx++) {
-        const uint32_t v0_idx = mIndices[faceIdx * 3 + 0];
-        const uint32_t v1_idx = mIndices[faceIdx * 3 + 1];
-        const uint32_t v2_idx = mIndices[faceIdx * 3 + 2];
+    // Binary headers may start with "solid" as well, a size that matches the triangle count exactly decides for binary.
+    // Trailing bytes behind the records are tolerated if the file does not look like ASCII.
+    std::vector< coordWithIndex_t > corners;
+    if (mapping.size() != binarySize && hasAsciiFormat( mapping.data(), mapping.size() )) {
+        if (!parseAscii( *mpExecutionContext, reinterpret_cast< const char* >( mapping.data() ), mapping.size(), corners, mIndices, mSolids )) {
+            printf( "error while parsing ASCII STL file '%s'\n", url.c_str() );
+            clear();
+            return eRetVal::ERROR;
+        }
+    } else {
+        if (mapping.size() < binarySize || uint64_t( numTris ) * 3 >= busySlot) { return eRetVal::ERROR; }
 
-        const float faceNormal_x = faceNormals[ faceIdx * 3 + 0 ];
-        const float faceNormal_y = faceNormals[ faceIdx * 3 + 1 ];
-        const float faceNormal_z = faceNormals[ faceIdx * 3 + 2 ];
+        corners.resize( size_t( numTris ) * 3 );
+        mIndices.resize( size_t( numTris ) * 3 );
+        const uint8_t* const pRecords = mapping.data() + binaryHeaderSize;
+        const int64_t numTasks = ( int64_t( numTris ) + binaryRecordsPerTask - 1 ) / binaryRecordsPerTask;
+        mpExecutionContext->parallelFor( 0, numTasks, 1, [&]( const int64_t task ) {
+            const size_t firstTri = size_t( task ) * binaryRecordsPerTask;
+            decodeBinaryRecords( pRecords, numTris, firstTri, std::min< size_t >( firstTri + binaryRecordsPerTask, numTris ),
+                                 corners.data(), mIndices.data() );
+        } );
+        mSolids = { 0, numTris };
+    }
+    mapping.close();
 
-        mNormals[v0_idx * 3 + 0] = 0.5f * ( mNormals[v0_idx * 3 + 0] + faceNormal_x );
-        mNormals[v0_idx * 3 + 1] = 0.5f * ( mNormals[v0_idx * 3 + 1] + faceNormal_y );
-        mNormals[v0_idx * 3 + 2] = 0.5f * ( mNormals[v0_idx * 3 + 2] + faceNormal_z );
+    if (!corners.empty() && options.weldMethod == weldMethod_t::SORT) { stl_reader::stl_reader_impl::RemoveDoubles( mCoords, mIndices, corners ); }
+    if (!corners.empty() && options.weldMethod == weldMethod_t::HASH) { weldCornersHashed( *mpExecutionContext, corners, mCoords, mIndices ); }
 
-        mNormals[v1_idx * 3 + 0] = 0.5f * ( mNormals[v1_idx * 3 + 0] + faceNormal_x );
-        mNormals[v1_idx * 3 + 1] = 0.5f * ( mNormals[v1_idx * 3 + 1] + faceNormal_y );
-        mNormals[v1_idx * 3 + 2] = 0.5f * ( mNormals[v1_idx * 3 + 2] + faceNormal_z );
+    mCenterAndRadius = std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f };
+    mWasRadiusCalculated = false;
 
-        mNormals[v2_idx * 3 + 0] = 0.5f * ( mNormals[v2_idx * 3 + 0] + faceNormal_x );
-        mNormals[v2_idx * 3 + 1] = 0.5f * ( mNormals[v2_idx * 3 + 1] + faceNormal_y );
-        mNormals[v2_idx * 3 + 2] = 0.5f * ( mNormals[v2_idx * 3 + 2] + faceNormal_z );
-    }
+    mNormals.resize( mCoords.size() );
+    const meshNormals::triangleMesh_t mesh{ mCoords.data(), 3, mCoords.size() / 3, mIndices.data(), mIndices.size() / 3 };
+    meshNormals::computeVertexNormals( *mpExecutionContext, mesh, options.normalWeighting, mNormals.data(), 3 );
 
     getBoundingSphere(mCenterAndRadius);
     
@@ -81,7 +465,63 @@ eRetVal StlModel::load(const std::string& url)
 
 eRetVal StlModel::save(const std::string& url, const std::string& comment)
 {
-    return eRetVal::ERROR; //("StlModel::save() is not implemented yet");
+    return save( url, comment, fileFormat_t::BINARY );
+}
+
+eRetVal StlModel::save(const std::string& url, const std::string& comment, const fileFormat_t format)
+{
+    if (mIndices.size() / 3 > std::numeric_limits< uint32_t >::max()) { return eRetVal::ERROR; }
+    FILE* pFile = fopen( url.c_str(), "wb" );
+    if (pFile == nullptr) { return eRetVal::ERROR; }
+
+    const uint32_t numTris = static_cast<uint32_t>( mIndices.size() / 3 );
+    const int64_t numBlocks = ( int64_t( numTris ) + saveTrisPerBlock - 1 ) / saveTrisPerBlock;
+    const std::string solidName = comment.substr( 0, comment.find_first_of( "\r\n" ) );
+    bool ok = true;
+    if (format == fileFormat_t::BINARY) {
+        uint8_t header[binaryHeaderSize] = {};
+        memcpy( header, comment.data(), std::min< size_t >( comment.size(), 80 ) );
+        memcpy( header + 80, &numTris, sizeof( numTris ) );
+        ok = ( fwrite( header, sizeof( header ), 1, pFile ) == 1 );
+
+        std::vector< uint8_t > records( size_t( saveBlocksPerWrite ) * saveTrisPerBlock * binaryRecordSize );
+        for (int64_t firstBlock = 0; ok && firstBlock < numBlocks; firstBlock += saveBlocksPerWrite) {
+            const int64_t endBlock = std::min( numBlocks, firstBlock + saveBlocksPerWrite );
+            mpExecutionContext->parallelFor( firstBlock, endBlock, 1, [&]( const int64_t block ) {
+                const size_t firstTri = size_t( block ) * saveTrisPerBlock;
+                encodeBinaryRecords( mCoords.data(), mIndices.data(), firstTri, std::min< size_t >( firstTri + saveTrisPerBlock, numTris ),
+                                     records.data() + size_t( block - firstBlock ) * saveTrisPerBlock * binaryRecordSize );
+            } );
+            const size_t numBytes = ( std::min< size_t >( size_t( endBlock ) * saveTrisPerBlock, numTris ) - size_t( firstBlock ) * saveTrisPerBlock ) * binaryRecordSize;
+            ok = ( fwrite( records.data(), 1, numBytes, pFile ) == numBytes );
+        }
+    } else {
+        const std::string solidLine = "solid " + solidName + "\n";
+        ok = ( fwrite( solidLine.data(), 1, solidLine.size(), pFile ) == solidLine.size() );
+
+        std::vector< std::string > blockTexts( saveBlocksPerWrite );
+        for (int64_t firstBlock = 0; ok && firstBlock < numBlocks; firstBlock += saveBlocksPerWrite) {
+            const int64_t endBlock = std::min( numBlocks, firstBlock + saveBlocksPerWrite );
+            mpExecutionContext->parallelFor( firstBlock, endBlock, 1, [&]( const int64_t block ) {
+                const size_t firstTri = size_t( block ) * saveTrisPerBlock;
+                formatAsciiFacets( mCoords.data(), mIndices.data(), firstTri, std::min< size_t >( firstTri + saveTrisPerBlock, numTris ),
+                                   blockTexts[block - firstBlock] );
+            } );
+            for (int64_t block = firstBlock; ok && block < endBlock; block++) {
+                const std::string& text = blockTexts[block - firstBlock];
+                ok = ( fwrite( text.data(), 1, text.size(), pFile ) == text.size() );
+            }
+        }
+
+        const std::string endSolidLine = "endsolid " + solidName + "\n";
+        ok = ok && ( fwrite( endSolidLine.data(), 1, endSolidLine.size(), pFile ) == endSolidLine.size() );
+    }
+
+    if (fclose( pFile ) != 0 || !ok) {
+        remove( url.c_str() ); // no partial files
+        return eRetVal::ERROR;
+    }
+    return eRetVal::OK;
 }
 
 const void StlModel::getBoundingSphere(std::array<float, 4>& centerAndRadius) const
@@ -2,10 +2,13 @@
 #define _STLMODEL_H_B1919F73_C820_4A53_9062_39A9B97E0CD3
 
 #include "eRetVal_FileLoader.h"
+#include "executionContext.h"
+#include "meshNormals.h"
 
 #include <string>
 #include <vector>
 #include <array>
+#include <memory>
 
 namespace FileLoader {
     struct StlModel {
@@ -13,9 +16,40 @@ namespace FileLoader {
             : mWasRadiusCalculated(false)
         {}
 
+        // how corners with equal coordinates are merged into one vertex, triangles that lose a corner are dropped
+        enum class weldMethod_t {
+            SORT    = 0, // stl_reader's single threaded sort, the vertices are ordered by their coordinates
+            HASH    = 1, // parallel inserts into an open-addressing table, the vertices are in the order of their first corner
+        };
+
+        struct loadOptions_t {
+            weldMethod_t                    weldMethod      = weldMethod_t::HASH;
+            // the vertex normals are the weighted sums of the normals of the adjacent faces, the face normals of the file are not used
+            meshNormals::normalWeighting_t  normalWeighting = meshNormals::normalWeighting_t::AREA;
+        };
+
+        // threads used by all parallel passes, ExecutionContext::getDefault() unless set
+        inline void setExecutionContext( std::shared_ptr< const ExecutionContext > pExecutionContext ) { 
+            mpExecutionContext = ( pExecutionContext ) ? std::move( pExecutionContext ) : ExecutionContext::getDefault(); 
+        }
+        inline const std::shared_ptr< const ExecutionContext >& getExecutionContext() const { return mpExecutionContext; }
+
         void clear();
+        // Binary files are mapped and decoded in one parallel pass over their 50 byte records, all outputs are sized 
+        // from the triangle count of the header. ASCII files are mapped as well and parsed in parallel chunks that start 
+        // at a facet. ERROR if the file is unreadable, truncated, malformed or not an STL file.
         eRetVal load(const std::string& url);
+        eRetVal load(const std::string& url, const loadOptions_t& options);
+        enum class fileFormat_t {
+            BINARY  = 0, // the comment fills the 80 byte header (truncated, zero padded)
+            ASCII   = 1, // the comment is the name of the solid, up to its first line break
+        };
+
+        // Writes the indexed mesh as one solid, the face normals are the unit normals of the triangles. The triangles are
+        // expanded into records in parallel, a few blocks of them per write. BINARY unless given otherwise. ERROR if 
+        // the file cannot be written, no partial file is left behind.
         eRetVal save(const std::string& url, const std::string& comment);
+        eRetVal save(const std::string& url, const std::string& comment, const fileFormat_t format);
 
         const void getBoundingSphere(std::array<float, 4>& centerAndRadius) const;
 
@@ -31,6 +65,8 @@ namespace FileLoader {
 
         mutable std::array<float, 4>                        mCenterAndRadius;
         mutable bool                                        mWasRadiusCalculated;
+
+        std::shared_ptr< const ExecutionContext >           mpExecutionContext = ExecutionContext::getDefault();
     };
 }
 #endif // _STLMODEL_H_B1919F73_C820_4A53_9062_39A9B97E0CD3
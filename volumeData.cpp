@@ -1,10 +1,11 @@
 #include "volumeData.h"
+#include "volumeGradientKernels.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include <limits.h>
-#include <omp.h>
 
 #ifndef _USE_MATH_DEFINES
     #define _USE_MATH_DEFINES
@@ -16,59 +17,358 @@
 #include <limits>
 
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 using namespace FileLoader;
 
 namespace {
-    constexpr float sobel_x[3][9] = {
-        {   -1.0f, -3.0f, -1.0f,
-            -3.0f, -6.0f, -3.0f,
-            -1.0f, -3.0f, -1.0f     },
-        {    0.0f,  0.0f,  0.0f,
-             0.0f,  0.0f,  0.0f,
-             0.0f,  0.0f,  0.0f     },
-        {    1.0f,  3.0f,  1.0f,
-             3.0f,  6.0f,  3.0f,
-             1.0f,  3.0f,  1.0f     },
-    };
-
-    //constexpr float sobel_z[3][9] = {
-    constexpr float sobel_y[3][9] = {
-        {    1.0f,  3.0f,  1.0f,
-             0.0f,  0.0f,  0.0f,
-            -1.0f, -3.0f, -1.0f     },
-        {    3.0f,  6.0f,  3.0f,
-             0.0f,  0.0f,  0.0f,
-            -3.0f, -6.0f, -3.0f     },
-        {    1.0f,  3.0f,  1.0f,
-             0.0f,  0.0f,  0.0f,
-            -1.0f, -3.0f, -1.0f     },
-    };
-
-    //constexpr float sobel_y[3][9] = {
-    constexpr float sobel_z[3][9] = {
-        {   -1.0f,  0.0f,  1.0f,
-            -3.0f,  0.0f,  3.0f,
-            -1.0f,  0.0f,  1.0f     },
-        {   -3.0f,  0.0f,  3.0f,
-            -6.0f,  0.0f,  6.0f,
-            -3.0f,  0.0f,  3.0f     },
-        {   -1.0f,  0.0f,  1.0f,
-            -3.0f,  0.0f,  3.0f,
-            -1.0f,  0.0f,  1.0f     },
-    };
+    // Separable Sobel: the 3x3x3 kernel is the outer product of a [1 2 1] smoothing and a [-1 0 1] derivative 
+    // filter along each axis, so it is evaluated as a yz-pass per row followed by an x-pass over the row.
+    // All intermediate sums are exact integers, hence the result is bit-identical to a direct 27-tap float convolution.
+    constexpr int32_t sobelSlabDepth = 4; // z-planes per task, keeps the 3-plane input window of a slab cache resident
+    constexpr int64_t rangeBlockSize = 1 << 16; // densities per task of computeRange() and calculateHistogramBuckets()
+    constexpr size_t loadChunkSize = size_t( 8 ) << 20; // bytes per read of an overlapped load, rounded to whole planes
 
+    static bool isCancelled( const VolumeData::loadState_t* pState ) { return pState && pState->cancelled.load( std::memory_order_relaxed ); }
+
+    static VolumeData::u16vec3_t halvedDim( const VolumeData::u16vec3_t& dim ) {
+        return VolumeData::u16vec3_t{ static_cast<uint16_t>( ( dim[0] + 1 ) / 2 ), static_cast<uint16_t>( ( dim[1] + 1 ) / 2 ), static_cast<uint16_t>( ( dim[2] + 1 ) / 2 ) };
+    }
+
+    // 2x2x2 reduction of the planes 2z (planeA) and 2z + 1 (planeB, the same as planeA for the last plane of an odd depth) 
+    // of a level into the rows [yBegin, yEnd) of plane z of the next level; odd last rows and columns are reduced with themselves.
+    // The box filter rounds the mean of integer voxels, float voxels keep it as is.
+    template< typename voxel_T >
+    static void downsamplePlaneRows( const voxel_T* pPlaneA, const voxel_T* pPlaneB, const int32_t dimX, const int32_t dimY, 
+                                     const VolumeData::mipFilter_t filter, const int32_t yBegin, const int32_t yEnd, voxel_T* pDstPlane ) {
+        const int32_t dstDimX = ( dimX + 1 ) / 2;
+        for (int32_t y = yBegin; y < yEnd; y++) {
+            const size_t row0 = static_cast<size_t>( 2 * y ) * dimX;
+            const size_t row1 = static_cast<size_t>( std::min( 2 * y + 1, dimY - 1 ) ) * dimX;
+            const voxel_T* const rows[4] = { pPlaneA + row0, pPlaneA + row1, pPlaneB + row0, pPlaneB + row1 };
+            voxel_T* const pDst = pDstPlane + static_cast<size_t>( y ) * dstDimX;
+            for (int32_t x = 0; x < dstDimX; x++) {
+                const int32_t x0 = 2 * x;
+                const int32_t x1 = std::min( 2 * x + 1, dimX - 1 );
+                if (filter == VolumeData::mipFilter_t::MAX) {
+                    voxel_T maxDensity = std::numeric_limits< voxel_T >::lowest();
+                    for (const voxel_T* pRow : rows) { maxDensity = std::max( { maxDensity, pRow[x0], pRow[x1] } ); }
+                    pDst[x] = maxDensity;
+                } else if (std::is_floating_point< voxel_T >::value) {
+                    float sum = 0.0f;
+                    for (const voxel_T* pRow : rows) { sum += static_cast<float>( pRow[x0] ) + static_cast<float>( pRow[x1] ); }
+                    pDst[x] = static_cast<voxel_T>( sum * 0.125f );
+                } else {
+                    uint32_t sum = 0;
+                    for (const voxel_T* pRow : rows) { sum += static_cast<uint32_t>( pRow[x0] ) + static_cast<uint32_t>( pRow[x1] ); }
+                    pDst[x] = static_cast<voxel_T>( ( sum + 4 ) >> 3 );
+                }
+            }
+        }
+    }
+
+    // |g| <= sqrt(3) * maxValue / 2 for both gradient kernels, maxValue is VolumeData::gradientValueSpan()
+    static float maxGradientMagnitude( const float maxValue ) {
+        return std::max( 1.0f, sqrtf( 3.0f ) * 0.5f * maxValue );
+    }
+
+    static float octahedralMagnitudeScale( const float maxValue ) {
+        return 65535.0f / maxGradientMagnitude( maxValue );
+    }
+
+    // fine magnitude bins per joint histogram bucket while the gradients are accumulated
+    constexpr uint32_t jointHistogramFineFactor = 8;
+
+    // The voxel count itself cannot overflow 64 bits (< 2^48), but the normals (12 bytes per voxel) 
+    // must also stay addressable through size_t, which matters for 32-bit builds.
+    static bool calcNumVoxels( const VolumeData::u16vec3_t& dim, size_t& numVoxels ) {
+        const uint64_t numVoxels64 = static_cast<uint64_t>( dim[0] ) * dim[1] * dim[2];
+        if (numVoxels64 > std::numeric_limits< size_t >::max() / sizeof( VolumeData::vec3_t )) { return false; }
+        numVoxels = static_cast<size_t>( numVoxels64 );
+        return true;
+    }
 }
 
 eRetVal VolumeData::load( const std::string& fileUrl, const VolumeData::gradientMode_t mode ) {
-    //-- set number of threads
-    omp_set_num_threads( 8 );
-    #pragma omp parallel
-    #pragma omp master
-    { fprintf( stderr, "using %d threads\n", omp_get_num_threads() ); }
+    return load( fileUrl, mode, loadOptions_t{} );
+}
+
+eRetVal VolumeData::load( const std::string& fileUrl, const VolumeData::gradientMode_t mode, const loadOptions_t& options ) {
+    return loadCached( fileUrl, mode, options, nullptr );
+}
+
+eRetVal VolumeData::load( const std::string& fileUrl, const roi_t& roi, const gradientMode_t mode ) {
+    return load( fileUrl, roi, mode, loadOptions_t{} );
+}
+
+eRetVal VolumeData::load( const std::string& fileUrl, const roi_t& roi, const gradientMode_t mode, const loadOptions_t& options ) {
+    // the box is always read into a LINEAR, IN_MEMORY volume with EAGER normals, it is neither downsampled nor cached
+    if (options.densityLayout != densityLayout_t::LINEAR || options.densityStorage != densityStorage_t::IN_MEMORY ||
+        options.gradientEvaluation != gradientEvaluation_t::EAGER || options.mipLevel > 0 || options.pGradientCache) {
+        return eRetVal::ERROR;
+    }
+    printf( "reading file '%s'\n", fileUrl.c_str() );
+
+    clear();
+    mVoxelType = options.voxelType;
+    const size_t voxelBytes = voxelSize();
+
+    MappedFile mapping;
+    if (mapping.open( fileUrl, MappedFile::accessMode_t::READ_ONLY ) != eRetVal::OK || mapping.size() < mFileHeaderSize) { return eRetVal::ERROR; }
+    u16vec3_t fileDim;
+    memcpy( fileDim.data(), mapping.data(), mFileHeaderSize );
+    size_t numFileVoxels = 0;
+    if (!calcNumVoxels( fileDim, numFileVoxels ) || mapping.size() < mFileHeaderSize + numFileVoxels * voxelBytes) { return eRetVal::ERROR; }
+
+    i32vec3_t boxMin, boxMax, windowMin, windowMax;
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        boxMin[dimIdx] = std::min( std::max( roi.boxMin[dimIdx], 0 ), static_cast<int32_t>( fileDim[dimIdx] ) );
+        boxMax[dimIdx] = std::min( std::max( roi.boxMax[dimIdx], boxMin[dimIdx] ), static_cast<int32_t>( fileDim[dimIdx] ) );
+        if (boxMin[dimIdx] == boxMax[dimIdx]) { return eRetVal::ERROR; }
+        windowMin[dimIdx] = std::max( boxMin[dimIdx] - 1, 0 );
+        windowMax[dimIdx] = std::min( boxMax[dimIdx] + 1, static_cast<int32_t>( fileDim[dimIdx] ) );
+    }
+
+    // Like the slabs of streamGradients() the box is computed in a window VolumeData that has the halo around it,
+    // where the window ends at the file border the clamping of computeGradients() is the real one.
+    VolumeData window;
+    window.setExecutionContext( mpExecutionContext );
+    window.mVoxelType = mVoxelType;
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) { window.mDim[dimIdx] = static_cast<uint16_t>( windowMax[dimIdx] - windowMin[dimIdx] ); }
+    calcNumVoxels( window.mDim, window.mNumVoxels );
+    window.mVoxels.resize( window.mNumVoxels * voxelBytes );
+
+    // one strided copy per row, only the pages of the window rows are faulted in
+    const uint8_t* const pFileVoxels = mapping.data() + mFileHeaderSize;
+    const size_t windowRowBytes = window.mDim[0] * voxelBytes;
+    mpExecutionContext->parallelFor( 0, window.mDim[2], 1, [&]( const int64_t z ) {
+        for (int32_t y = 0; y < window.mDim[1]; y++) {
+            const uint64_t fileAddr = ( static_cast<uint64_t>( windowMin[2] + z ) * fileDim[1] + windowMin[1] + y ) * fileDim[0] + windowMin[0];
+            memcpy( window.mVoxels.data() + window.calcAddr( 0, y, static_cast<int32_t>( z ) ) * voxelBytes, pFileVoxels + fileAddr * voxelBytes, windowRowBytes );
+        }
+    } );
+
+    // the magnitude scale of packed normals has to bound the gradients at the box border, which see the halo
+    window.computeRange();
+    window.prepareNormals( mode, options.normalStorage );
+    const i32vec3_t innerMin = { boxMin[0] - windowMin[0], boxMin[1] - windowMin[1], boxMin[2] - windowMin[2] };
+    const i32vec3_t innerMax = { boxMax[0] - windowMin[0], boxMax[1] - windowMin[1], boxMax[2] - windowMin[2] };
+    const int64_t numSlabs = ( innerMax[2] - innerMin[2] + sobelSlabDepth - 1 ) / sobelSlabDepth;
+    mpExecutionContext->parallelFor( 0, numSlabs, 1, [&]( const int64_t slab ) {
+        const int32_t z0 = innerMin[2] + static_cast<int32_t>( slab ) * sobelSlabDepth;
+        window.computeGradients( i32vec3_t{ innerMin[0], innerMin[1], z0 }, i32vec3_t{ innerMax[0], innerMax[1], std::min( innerMax[2], z0 + sobelSlabDepth ) } );
+    } );
+
+    // The window buffers are taken over and the halo is cropped in place, so the box is never held twice. Every row
+    // moves to an address at or below its source, rows processed in increasing order never overwrite unread ones.
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) { mDim[dimIdx] = static_cast<uint16_t>( boxMax[dimIdx] - boxMin[dimIdx] ); }
+    calcNumVoxels( mDim, mNumVoxels );
+    printf( "dimensions: %u x %u x %u \n", (uint32_t)mDim[0], (uint32_t)mDim[1], (uint32_t)mDim[2] );
+
+    mVoxels = std::move( window.mVoxels );
+    mNormals = std::move( window.mNormals );
+    mPackedNormals = std::move( window.mPackedNormals );
+    const size_t normalSize = ( options.normalStorage == normalStorage_t::OCTAHEDRAL_16 ) ? sizeof( packedNormal_t ) : sizeof( vec3_t );
+    uint8_t* const pNormals = ( options.normalStorage == normalStorage_t::OCTAHEDRAL_16 )
+        ? reinterpret_cast< uint8_t* >( mPackedNormals.data() ) : reinterpret_cast< uint8_t* >( mNormals.data() );
+    for (int32_t z = 0; z < mDim[2]; z++) {
+        for (int32_t y = 0; y < mDim[1]; y++) {
+            const uint64_t addr = calcAddr( 0, y, z );
+            const uint64_t windowAddr = window.calcAddr( innerMin[0], innerMin[1] + y, innerMin[2] + z );
+            memmove( mVoxels.data() + addr * voxelBytes, mVoxels.data() + windowAddr * voxelBytes, mDim[0] * voxelBytes );
+            memmove( pNormals + addr * normalSize, pNormals + windowAddr * normalSize, mDim[0] * normalSize );
+        }
+    }
+    mVoxels.resize( mNumVoxels * voxelBytes );
+
+    // shrinks the normals to the box, the magnitude scale stays the one of the window
+    const size_t numBricks = prepareNormals( mode, options.normalStorage );
+    mNormalMagnitudeScale = window.mNormalMagnitudeScale;
+    mNormalBrickStates.reset( numBricks, brickStates_t::RESIDENT );
+
+    computeRange();
+    computeMinMaxTree();
+    if (options.numHistogramBuckets > 0) { calculateHistogramBuckets( options.numHistogramBuckets ); }
+    if (options.jointHistogram.numDensityBuckets > 0) { calculateJointHistogram( options.jointHistogram ); }
+    return eRetVal::OK;
+}
+
+VolumeData::asyncLoad_t VolumeData::loadAsync( const std::string& fileUrl, const gradientMode_t mode ) {
+    return loadAsync( fileUrl, mode, loadOptions_t{} );
+}
+
+VolumeData::asyncLoad_t VolumeData::loadAsync( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options ) {
+    asyncLoad_t handle;
+    handle.mpState = std::make_shared< loadState_t >();
+    handle.mResult = std::async( std::launch::async, [this, fileUrl, mode, options, pState = handle.mpState]() {
+        return loadCached( fileUrl, mode, options, pState.get() );
+    } ).share();
+    return handle;
+}
+
+void VolumeData::clear() {
+    mVoxels.clear();
+    mVoxels.shrink_to_fit();
+    mpDensityMapping.reset();
+    mDensityLayout = densityLayout_t::LINEAR;
+    mNumDensityBricks = { 0, 0, 0 };
+    mNumVoxels = 0;
+    mMinMaxLevels.clear();
+    mMipLevels.clear();
+    mJointHistogram = jointHistogram_t{};
+
+    mNormals.clear();
+    mNormals.shrink_to_fit();
+    mPackedNormals.clear();
+    mPackedNormals.shrink_to_fit();
+    mpNormalMapping.reset();
+    mNumNormalBricks = { 0, 0, 0 };
+    mNormalBrickStates.reset( 0, brickStates_t::MISSING );
+}
+
+eRetVal VolumeData::loadCached( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState ) {
+    // the cache entries have no voxel type, only UINT16 volumes use them
+    if (!options.pGradientCache || options.mipLevel > 0 || options.voxelType != voxelType_t::UINT16) { return loadImpl( fileUrl, mode, options, pState ); }
+
+    // the lookup only stats the volume, its content is hashed when an entry is stored or verified
+    const GradientCache& cache = *options.pGradientCache;
+    GradientCache::fileStamp_t stamp;
+    if (GradientCache::stampFile( fileUrl, stamp ) != eRetVal::OK) { return eRetVal::ERROR; }
+    bool hasContentHash = false;
+    uint64_t contentHash = 0;
+    if (cache.getOptions().verifyEntries) {
+        if (GradientCache::hashFile( fileUrl, *mpExecutionContext, contentHash ) != eRetVal::OK) { return eRetVal::ERROR; }
+        hasContentHash = true;
+    }
+
+    GradientCache::entryHeader_t header = { { 'V', 'G', 'R', 'C' }, GradientCache::mVersion, contentHash, 0, stamp.size, stamp.time, { 0, 0, 0 }, 
+                                            static_cast<uint8_t>( mode ), static_cast<uint8_t>( options.normalStorage ), 1.0f, { 0, 0 }, { 0, 0 }, 0 };
+    const std::string entryUrl = cache.getEntryUrl( fileUrl, stamp, header.gradientMode, header.normalStorage );
+    const size_t normalSize = ( options.normalStorage == normalStorage_t::OCTAHEDRAL_16 ) ? sizeof( packedNormal_t ) : sizeof( vec3_t );
+
+    // openEntry() checks the size of the entry against the voxel count, so the dimensions are read up front
+    FILE* pFile = fopen( fileUrl.c_str(), "rb" );
+    const bool hasDim = ( pFile != nullptr ) && fread( header.dim, sizeof( uint16_t ), 3, pFile ) == 3;
+    if (pFile != nullptr) { fclose( pFile ); }
+    size_t numVoxels = 0;
+    if (!hasDim || !calcNumVoxels( u16vec3_t{ header.dim[0], header.dim[1], header.dim[2] }, numVoxels )) { return eRetVal::ERROR; }
+
+    auto pEntry = std::make_shared< MappedFile >();
+    if (cache.openEntry( entryUrl, header, numVoxels, normalSize, *mpExecutionContext, *pEntry ) == eRetVal::OK) {
+        // only the densities are loaded, the lazy evaluation does not compute any normal
+        loadOptions_t densityOptions = options;
+        densityOptions.gradientEvaluation = gradientEvaluation_t::LAZY_BRICKS;
+        densityOptions.numHistogramBuckets = 0;
+        densityOptions.jointHistogram = jointHistogramOptions_t{};
+        if (loadImpl( fileUrl, mode, densityOptions, pState ) != eRetVal::OK) { return eRetVal::ERROR; }
+
+        memcpy( &header, pEntry->data(), sizeof( header ) );
+        const uint64_t* const pBuckets = reinterpret_cast< const uint64_t* >( pEntry->data() + sizeof( header ) );
+
+        mMinMaxDensity = { header.minMaxDensity[0], header.minMaxDensity[1] };
+        if (options.numHistogramBuckets > 0) {
+            if (header.numHistogramBuckets == options.numHistogramBuckets) {
+                mHistogramBuckets.assign( pBuckets, pBuckets + header.numHistogramBuckets );
+                mHistogramRange = { header.histogramRange[0], header.histogramRange[1] };
+            } else {
+                calculateHistogramBuckets( options.numHistogramBuckets );
+            }
+        }
+
+        // the normals are used in place, the storage allocated by the lazy load was never touched
+        mNormals.clear();
+        mNormals.shrink_to_fit();
+        mPackedNormals.clear();
+        mPackedNormals.shrink_to_fit();
+        mpNormalMapping = pEntry;
+        mNormalMappingOffset = sizeof( header ) + header.numHistogramBuckets * sizeof( uint64_t );
+        mNormalMagnitudeScale = header.magnitudeScale;
+        mNormalBrickStates.reset( mNormalBrickStates.size(), brickStates_t::RESIDENT );
+        // the entry has no joint histogram, there were no gradients to accumulate it from
+        if (options.jointHistogram.numDensityBuckets > 0) { calculateJointHistogram( options.jointHistogram ); }
+        return eRetVal::OK;
+    }
+
+    if (loadImpl( fileUrl, mode, options, pState ) != eRetVal::OK) { return eRetVal::ERROR; }
+    if (options.gradientEvaluation == gradientEvaluation_t::LAZY_BRICKS) { return eRetVal::OK; } // nothing computed that could be stored
 
+    // the volume is loaded either way, without a content hash the entry is just not stored
+    if (!hasContentHash && GradientCache::hashFile( fileUrl, *mpExecutionContext, header.contentHash ) != eRetVal::OK) { return eRetVal::OK; }
+    header.magnitudeScale = mNormalMagnitudeScale;
+    header.minMaxDensity[0] = mMinMaxDensity[0];
+    header.minMaxDensity[1] = mMinMaxDensity[1];
+    if (options.numHistogramBuckets > 0) {
+        header.histogramRange[0] = mHistogramRange[0];
+        header.histogramRange[1] = mHistogramRange[1];
+        header.numHistogramBuckets = static_cast<uint32_t>( mHistogramBuckets.size() );
+    }
+    const void* const pNormals = ( options.normalStorage == normalStorage_t::OCTAHEDRAL_16 ) 
+        ? static_cast< const void* >( packedNormalData() ) : static_cast< const void* >( normalData() );
+    cache.storeEntry( entryUrl, header, mHistogramBuckets.data(), pNormals, mNumVoxels * normalSize, *mpExecutionContext ); // a full disk only costs the cache
+    return eRetVal::OK;
+}
+
+eRetVal VolumeData::loadImpl( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState ) {
     printf( "reading file '%s'\n", fileUrl.c_str() );
 
+    clear();
+    mVoxelType = options.voxelType;
+
+    if (options.mipLevel > 0) {
+        return loadDownsampled( fileUrl, mode, options, pState );
+    }
+    if (options.densityLayout == densityLayout_t::BRICKED && mVoxelType != voxelType_t::UINT16) { return eRetVal::ERROR; }
+    if (options.densityLayout == densityLayout_t::LINEAR && 
+        ( options.densityStorage == densityStorage_t::IN_MEMORY || mVoxelType == voxelType_t::FLOAT32 )) {
+        return loadOverlapped( fileUrl, mode, options, pState );
+    }
+
+    if (options.densityLayout == densityLayout_t::BRICKED) {
+        if (loadBrickedDensities( fileUrl, options.densityStorage ) != eRetVal::OK) { return eRetVal::ERROR; }
+    } else {
+        // copy-on-write, so that the non-const getDensities() stays usable without ever writing back to the file
+        auto pMapping = std::make_shared< MappedFile >();
+        if (pMapping->open( fileUrl, MappedFile::accessMode_t::COPY_ON_WRITE ) != eRetVal::OK || pMapping->size() < mFileHeaderSize) {
+            return eRetVal::ERROR;
+        }
+        memcpy( mDim.data(), pMapping->data(), mFileHeaderSize );
+
+        size_t numVoxels = 0;
+        if (!calcNumVoxels( mDim, numVoxels ) || pMapping->size() < mFileHeaderSize + numVoxels * voxelSize()) {
+            return eRetVal::ERROR; // truncated file
+        }
+        mpDensityMapping = pMapping;
+        mNumVoxels = numVoxels;
+    }
+
+    printf( "dimensions: %u x %u x %u \n", (uint32_t)mDim[0], (uint32_t)mDim[1], (uint32_t)mDim[2] );
+
+    // the bricked and mapped densities are in place at this point, only the passes below are left
+    if (pState) {
+        pState->numPlanes.store( mDim[2] );
+        pState->numPlanesRead.store( mDim[2] );
+    }
+    if (isCancelled( pState )) {
+        clear();
+        return eRetVal::ERROR;
+    }
+
+    computeRange();
+    computeMinMaxTree();
+    if (options.numHistogramBuckets > 0) { calculateHistogramBuckets( options.numHistogramBuckets ); }
+
+#if 1 // TODO!!!
+    mGradientMode = mode;
+    calculateNormals( mGradientMode, options.normalStorage, options.gradientEvaluation, options.jointHistogram );
+#endif
+
+    if (pState) { pState->numPlanesDone.store( mDim[2] ); }
+    return eRetVal::OK; //Status_t::OK();
+}
+
+eRetVal VolumeData::loadOverlapped( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState ) {
     FILE* pFile = fopen( fileUrl.c_str(), "rb" );
     if (pFile == nullptr) { 
         return eRetVal::ERROR; //Status_t::ERROR( "failed to open VolumeData file" ); 
@@ -76,294 +376,1147 @@ eRetVal VolumeData::load( const std::string& fileUrl, const VolumeData::gradient
 
     size_t elementsRead = 0;
     elementsRead = fread( mDim.data(), sizeof( uint16_t ), 3, pFile );
-    assert( elementsRead == 3 );
+
+    size_t numVoxels = 0;
+    if (elementsRead != 3 || !calcNumVoxels( mDim, numVoxels )) {
+        fclose( pFile );
+        return eRetVal::ERROR;
+    }
+    const size_t voxelBytes = voxelSize();
+    mVoxels.resize( numVoxels * voxelBytes );
+    mNumVoxels = numVoxels;
 
     printf( "dimensions: %u x %u x %u \n", (uint32_t)mDim[0], (uint32_t)mDim[1], (uint32_t)mDim[2] );
 
-    const uint32_t numVoxels = mDim[0] * mDim[1] * mDim[2];
-    mDensities.resize( numVoxels );
-    elementsRead = fread( mDensities.data(), sizeof( uint16_t ), numVoxels, pFile );
-    assert( elementsRead == numVoxels );
+    const int32_t numPlanes = mDim[2];
+    const size_t planeSize = static_cast<size_t>( mDim[0] ) * mDim[1];
+    const int32_t chunkPlanes = static_cast<int32_t>( std::min< size_t >( numPlanes, 
+                                                      std::max< size_t >( 1, loadChunkSize / std::max< size_t >( 1, planeSize * voxelBytes ) ) ) );
+    if (pState) { pState->numPlanes.store( numPlanes ); }
+
+    // The reader thread publishes how many planes are in memory; this thread scans them and computes their gradients 
+    // while the next chunk is read. Both only touch disjoint planes of mVoxels, which is never reallocated.
+    std::mutex readMutex;
+    std::condition_variable readCondition;
+    int32_t numPlanesRead = 0;
+    bool readDone = false;
+
+    std::thread reader( [&]() {
+        for (int32_t z0 = 0; z0 < numPlanes && !isCancelled( pState ); z0 += chunkPlanes) {
+            const int32_t numChunkPlanes = std::min( chunkPlanes, numPlanes - z0 );
+            const size_t numChunkVoxels = numChunkPlanes * planeSize;
+            if (fread( mVoxels.data() + z0 * planeSize * voxelBytes, voxelBytes, numChunkVoxels, pFile ) != numChunkVoxels) { break; } // truncated file
+            {
+                std::lock_guard< std::mutex > lock( readMutex );
+                numPlanesRead = z0 + numChunkPlanes;
+            }
+            readCondition.notify_one();
+            if (pState) { pState->numPlanesRead.store( z0 + numChunkPlanes ); }
+        }
+        {
+            std::lock_guard< std::mutex > lock( readMutex );
+            readDone = true;
+        }
+        readCondition.notify_one();
+    } );
+
+    // FLOAT3 gradients only depend on the densities. The magnitude scale of packed normals depends on the range 
+    // of the whole volume, so those (and lazy bricks) are set up once all planes were scanned. So is the joint
+    // histogram, whose density buckets need the range. Float voxels need the range for their density keys as well, 
+    // their histogram and min/max tree follow the scan.
+    const bool keyedVoxels = ( mVoxelType == voxelType_t::FLOAT32 );
+    const bool overlapGradients = ( options.gradientEvaluation == gradientEvaluation_t::EAGER && options.normalStorage == normalStorage_t::FLOAT3 &&
+                                    options.jointHistogram.numDensityBuckets == 0 );
+    const size_t numNormalBricks = ( overlapGradients ) ? prepareNormals( mode, normalStorage_t::FLOAT3 ) : 0;
+
+    vec2_t range = emptyRange();
+    std::vector< uint64_t > densityCounts;
+    if (options.numHistogramBuckets > 0 && !keyedVoxels) { densityCounts.assign( size_t( 1 ) << 16, 0 ); }
+
+    allocateMinMaxTree();
+    const int32_t numCellLayers = ( mMinMaxLevels.empty() ) ? 0 : mMinMaxLevels[0].numCells[2];
+
+    int32_t numPlanesScanned = 0;
+    int32_t numPlanesWithNormals = 0;
+    int32_t numCellLayersDone = 0;
+    while (numPlanesScanned < numPlanes) {
+        int32_t numPlanesAvailable = 0;
+        {
+            std::unique_lock< std::mutex > lock( readMutex );
+            readCondition.wait( lock, [&]() { return numPlanesRead > numPlanesScanned || readDone; } );
+            numPlanesAvailable = numPlanesRead;
+        }
+        if (numPlanesAvailable == numPlanesScanned || isCancelled( pState )) { break; } // truncated or cancelled
+
+        const uint8_t* const pPlanes = mVoxels.data() + numPlanesScanned * planeSize * voxelBytes;
+        const int64_t numEntries = static_cast<int64_t>( ( numPlanesAvailable - numPlanesScanned ) * planeSize );
+        accumulateRange( pPlanes, numEntries, range );
+        if (!densityCounts.empty()) { accumulateDensityCounts( pPlanes, numEntries, densityCounts ); }
+        numPlanesScanned = numPlanesAvailable;
+
+        // a layer of macro cells includes the first plane of the next layer
+        const int32_t numCellLayersReady = ( keyedVoxels ) ? 0 : ( numPlanesScanned == numPlanes ) ? numCellLayers 
+                                         : ( numPlanesScanned > mMacroCellSize ) ? std::min( numCellLayers, ( numPlanesScanned - 1 - mMacroCellSize ) / mMacroCellSize + 1 ) : 0;
+        computeMacroCellLayers( numCellLayersDone, numCellLayersReady );
+        numCellLayersDone = numCellLayersReady;
+
+        if (overlapGradients) {
+            // every plane needs the next one as halo, only the last plane of the volume clamps
+            const int32_t normalsEnd = ( numPlanesScanned == numPlanes ) ? numPlanes : numPlanesScanned - 1;
+            const int32_t numSlabs = ( normalsEnd - numPlanesWithNormals + sobelSlabDepth - 1 ) / sobelSlabDepth;
+            mpExecutionContext->parallelFor( 0, numSlabs, 1, [&]( const int64_t slab ) {
+                const int32_t z0 = numPlanesWithNormals + static_cast<int32_t>( slab ) * sobelSlabDepth;
+                computeGradients( i32vec3_t{ 0, 0, z0 }, i32vec3_t{ mDim[0], mDim[1], std::min( normalsEnd, z0 + sobelSlabDepth ) } );
+            } );
+            numPlanesWithNormals = normalsEnd;
+            if (pState) { pState->numPlanesDone.store( numPlanesWithNormals ); }
+        }
+    }
+
+    reader.join();
+    fclose( pFile );
+
+    if (numPlanesScanned < numPlanes) {
+        clear();
+        return eRetVal::ERROR;
+    }
+
+    setRange( range );
+    computeMacroCellLayers( numCellLayersDone, numCellLayers );
+    computeMinMaxParents();
+    if (!densityCounts.empty()) { rebinHistogram( densityCounts, options.numHistogramBuckets ); }
+    if (keyedVoxels && options.numHistogramBuckets > 0) { calculateHistogramBuckets( options.numHistogramBuckets ); }
+
+    if (overlapGradients) {
+        mNormalBrickStates.reset( numNormalBricks, brickStates_t::RESIDENT );
+    } else {
+        calculateNormals( mode, options.normalStorage, options.gradientEvaluation, options.jointHistogram );
+    }
+
+    if (pState) { pState->numPlanesDone.store( numPlanes ); }
+    return eRetVal::OK; //Status_t::OK();
+}
+
+eRetVal VolumeData::loadDownsampled( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState ) {
+    FILE* pFile = fopen( fileUrl.c_str(), "rb" );
+    if (pFile == nullptr) { return eRetVal::ERROR; }
+
+    u16vec3_t dim;
+    size_t numVoxels = 0;
+    if (fread( dim.data(), sizeof( uint16_t ), 3, pFile ) != 3 || !calcNumVoxels( dim, numVoxels )) {
+        fclose( pFile );
+        return eRetVal::ERROR;
+    }
+    printf( "dimensions: %u x %u x %u \n", (uint32_t)dim[0], (uint32_t)dim[1], (uint32_t)dim[2] );
+
+    const uint32_t numLevels = options.mipLevel;
+    std::vector< u16vec3_t > levelDims( numLevels + 1, dim );
+    for (uint32_t level = 1; level <= numLevels; level++) { levelDims[level] = halvedDim( levelDims[level - 1] ); }
+    auto planeSize = [&]( const uint32_t level ) { return static_cast<size_t>( levelDims[level][0] ) * levelDims[level][1]; };
+
+    mDim = levelDims[numLevels];
+    calcNumVoxels( mDim, mNumVoxels );
+    mVoxels.resize( mNumVoxels * voxelSize() );
+
+    const int32_t numPlanes = dim[2];
+    if (pState) { pState->numPlanes.store( numPlanes ); }
+    size_t numPlanesOut = 0;
+
+    const bool complete = visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+
+        // Plane 2z of every level waits in pendingPlanes until plane 2z + 1 arrives, the pair is reduced into scratchPlanes and 
+        // passed on to the next level; the planes of the last level go straight into the voxels. Apart from the chunk that 
+        // was read, only one pending and one reduced plane per level are resident.
+        std::vector< std::vector< voxel_T > > pendingPlanes( numLevels );
+        std::vector< std::vector< voxel_T > > scratchPlanes( numLevels );
+        std::vector< bool > hasPendingPlane( numLevels, false );
+        for (uint32_t level = 0; level < numLevels; level++) {
+            pendingPlanes[level].resize( planeSize( level ) );
+            scratchPlanes[level].resize( planeSize( level + 1 ) );
+        }
+
+        auto reducePlanes = [&]( const uint32_t level, const voxel_T* pPlaneA, const voxel_T* pPlaneB ) {
+            const int32_t dstDimY = levelDims[level + 1][1];
+            mpExecutionContext->parallelFor( 0, ( dstDimY + 15 ) / 16, 1, [&]( const int64_t rowBlock ) {
+                const int32_t yBegin = static_cast<int32_t>( rowBlock ) * 16;
+                downsamplePlaneRows( pPlaneA, pPlaneB, levelDims[level][0], levelDims[level][1], options.mipFilter, 
+                                     yBegin, std::min( yBegin + 16, dstDimY ), scratchPlanes[level].data() );
+            } );
+        };
+        auto pushPlane = [&]( uint32_t level, const voxel_T* pPlane ) {
+            for (;;) {
+                if (level == numLevels) {
+                    memcpy( voxelData< voxel_T >() + numPlanesOut * planeSize( level ), pPlane, planeSize( level ) * sizeof( voxel_T ) );
+                    numPlanesOut++;
+                    return;
+                }
+                if (!hasPendingPlane[level]) {
+                    memcpy( pendingPlanes[level].data(), pPlane, planeSize( level ) * sizeof( voxel_T ) );
+                    hasPendingPlane[level] = true;
+                    return;
+                }
+                reducePlanes( level, pendingPlanes[level].data(), pPlane );
+                hasPendingPlane[level] = false;
+                pPlane = scratchPlanes[level].data();
+                level++;
+            }
+        };
+
+        const size_t srcPlaneSize = planeSize( 0 );
+        const int32_t chunkPlanes = static_cast<int32_t>( std::min< size_t >( numPlanes, 
+                                                          std::max< size_t >( 1, loadChunkSize / std::max< size_t >( 1, srcPlaneSize * sizeof( voxel_T ) ) ) ) );
+        std::vector< voxel_T > chunk( chunkPlanes * srcPlaneSize );
+
+        for (int32_t z0 = 0; z0 < numPlanes; z0 += chunkPlanes) {
+            const int32_t numChunkPlanes = std::min( chunkPlanes, numPlanes - z0 );
+            const size_t numChunkVoxels = numChunkPlanes * srcPlaneSize;
+            if (isCancelled( pState ) || fread( chunk.data(), sizeof( voxel_T ), numChunkVoxels, pFile ) != numChunkVoxels) {
+                return false;
+            }
+            if (pState) { pState->numPlanesRead.store( z0 + numChunkPlanes ); }
+            for (int32_t planeIdx = 0; planeIdx < numChunkPlanes; planeIdx++) {
+                pushPlane( 0, chunk.data() + planeIdx * srcPlaneSize );
+            }
+        }
+
+        // the last plane of an odd depth has no partner, the lower levels are flushed first since they may complete a higher one
+        for (uint32_t level = 0; level < numLevels; level++) {
+            if (!hasPendingPlane[level]) { continue; }
+            reducePlanes( level, pendingPlanes[level].data(), pendingPlanes[level].data() );
+            hasPendingPlane[level] = false;
+            pushPlane( level + 1, scratchPlanes[level].data() );
+        }
+        return true;
+    } );
+    fclose( pFile );
+    if (!complete) {
+        clear();
+        return eRetVal::ERROR;
+    }
+    assert( numPlanesOut == mDim[2] );
+
+    computeRange();
+    computeMinMaxTree();
+    if (options.numHistogramBuckets > 0) { calculateHistogramBuckets( options.numHistogramBuckets ); }
+    calculateNormals( mode, options.normalStorage, options.gradientEvaluation, options.jointHistogram );
+
+    if (pState) { pState->numPlanesDone.store( numPlanes ); }
+    return eRetVal::OK;
+}
+
+void VolumeData::buildMipChain( const mipFilter_t filter, const uint32_t numLevels ) {
+    mMipLevels.clear();
+    if (mNumVoxels == 0) { return; }
+
+    std::vector< u16vec3_t > levelDims( 1, mDim );
+    while (( numLevels == 0 || levelDims.size() <= numLevels ) && 
+           ( levelDims.back()[0] > 1 || levelDims.back()[1] > 1 || levelDims.back()[2] > 1 )) {
+        levelDims.push_back( halvedDim( levelDims.back() ) );
+    }
+    mMipLevels.resize( levelDims.size() - 1 );
+
+    for (size_t level = 1; level < levelDims.size(); level++) {
+        const VolumeData& src = getMipLevel( level - 1 );
+        VolumeData& dst = mMipLevels[level - 1];
+        dst.setExecutionContext( mpExecutionContext );
+        dst.mDim = levelDims[level];
+        dst.mVoxelType = mVoxelType;
+        calcNumVoxels( dst.mDim, dst.mNumVoxels );
+        dst.mVoxels.resize( dst.mNumVoxels * voxelSize() );
+
+        // one task per plane of the new level; bricked or not, the source planes are read as linear planes
+        const int32_t srcDimX = src.mDim[0];
+        const int32_t srcDimY = src.mDim[1];
+        const size_t srcPlaneSize = static_cast<size_t>( srcDimX ) * srcDimY;
+        const size_t dstPlaneSize = static_cast<size_t>( dst.mDim[0] ) * dst.mDim[1];
+        visitVoxelType( [&]( auto voxelTag ) {
+            using voxel_T = decltype( voxelTag );
+            mpExecutionContext->parallelFor( 0, dst.mDim[2], 1, [&]( const int64_t z ) {
+                const int32_t srcZ[2] = { static_cast<int32_t>( z ) * 2, std::min( static_cast<int32_t>( z ) * 2 + 1, src.mDim[2] - 1 ) };
+                std::vector< voxel_T > srcPlanes;
+                const voxel_T* pSrcPlanes[2];
+                if (src.mDensityLayout == densityLayout_t::LINEAR) {
+                    for (int32_t i = 0; i < 2; i++) { pSrcPlanes[i] = src.voxelData< voxel_T >() + srcZ[i] * srcPlaneSize; }
+                } else {
+                    srcPlanes.resize( 2 * srcPlaneSize );
+                    for (int32_t i = 0; i < 2; i++) {
+                        for (int32_t y = 0; y < srcDimY; y++) { src.gatherDensityRow( 0, srcDimX, y, srcZ[i], &srcPlanes[ i * srcPlaneSize + y * srcDimX ] ); }
+                        pSrcPlanes[i] = &srcPlanes[ i * srcPlaneSize ];
+                    }
+                }
+                downsamplePlaneRows( pSrcPlanes[0], pSrcPlanes[1], srcDimX, srcDimY, filter, 0, dst.mDim[1], dst.voxelData< voxel_T >() + z * dstPlaneSize );
+            } );
+        } );
+
+        dst.computeRange();
+        dst.computeMinMaxTree();
+        dst.calculateNormals( mGradientMode, mNormalStorage );
+    }
+}
+
+eRetVal VolumeData::loadBrickedDensities( const std::string& fileUrl, const densityStorage_t densityStorage ) {
+    // the file is always linear, it is read (or mapped) one brick-deep slab of planes at a time and scattered into the bricks
+    MappedFile mapping;
+    FILE* pFile = nullptr;
+    if (densityStorage == densityStorage_t::MEMORY_MAPPED) {
+        if (mapping.open( fileUrl, MappedFile::accessMode_t::READ_ONLY ) != eRetVal::OK || mapping.size() < mFileHeaderSize) {
+            return eRetVal::ERROR;
+        }
+        memcpy( mDim.data(), mapping.data(), mFileHeaderSize );
+    } else {
+        pFile = fopen( fileUrl.c_str(), "rb" );
+        if (pFile == nullptr) { return eRetVal::ERROR; }
+        if (fread( mDim.data(), sizeof( uint16_t ), 3, pFile ) != 3) {
+            fclose( pFile );
+            return eRetVal::ERROR;
+        }
+    }
+
+    size_t numVoxels = 0;
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        mNumDensityBricks[dimIdx] = ( mDim[dimIdx] + mDensityBrickSize - 1 ) >> mDensityBrickSizeLog2;
+    }
+    const uint64_t numPaddedVoxels64 = ( static_cast<uint64_t>( mNumDensityBricks[0] ) * mNumDensityBricks[1] * mNumDensityBricks[2] ) << ( 3 * mDensityBrickSizeLog2 );
+    if (!calcNumVoxels( mDim, numVoxels ) || numPaddedVoxels64 > std::numeric_limits< size_t >::max() / sizeof( uint16_t ) ||
+        ( pFile == nullptr && mapping.size() < mFileHeaderSize + numVoxels * sizeof( uint16_t ) )) {
+        if (pFile != nullptr) { fclose( pFile ); }
+        return eRetVal::ERROR;
+    }
+    mVoxels.resize( static_cast<size_t>( numPaddedVoxels64 ) * sizeof( uint16_t ) );
+    mDensityLayout = densityLayout_t::BRICKED;
+    mNumVoxels = numVoxels;
+
+    const size_t planeSize = static_cast<size_t>( mDim[0] ) * mDim[1];
+    std::vector< uint16_t, DefaultInitAllocator< uint16_t > > slab( ( pFile != nullptr ) ? planeSize * mDensityBrickSize : 0 );
+    for (int32_t z0 = 0; z0 < mDim[2]; z0 += mDensityBrickSize) {
+        const int32_t numPlanes = std::min( mDensityBrickSize, mDim[2] - z0 );
+        const uint16_t* pPlanes = nullptr;
+        if (pFile != nullptr) {
+            const size_t slabSize = planeSize * numPlanes;
+            if (fread( slab.data(), sizeof( uint16_t ), slabSize, pFile ) != slabSize) {
+                fclose( pFile );
+                return eRetVal::ERROR;
+            }
+            pPlanes = slab.data();
+        } else {
+            pPlanes = reinterpret_cast< const uint16_t* >( mapping.data() + mFileHeaderSize ) + planeSize * z0;
+        }
+        scatterPlanesToBricks( pPlanes, z0, numPlanes );
+    }
+    if (pFile != nullptr) { fclose( pFile ); }
+
+    return eRetVal::OK;
+}
+
+void VolumeData::scatterPlanesToBricks( const uint16_t* pPlanes, const int32_t z0, const int32_t numPlanes ) {
+    assert( ( z0 & ( mDensityBrickSize - 1 ) ) == 0 );
+    const int64_t numBricksXY = static_cast<int64_t>( mNumDensityBricks[0] ) * mNumDensityBricks[1];
 
+    // every entry of the bricks is written exactly once, the padding with 0
+    mpExecutionContext->parallelFor( 0, numBricksXY, 1, [&]( const int64_t brickXY ) {
+        const int32_t brickX = static_cast<int32_t>( brickXY % mNumDensityBricks[0] );
+        const int32_t brickY = static_cast<int32_t>( brickXY / mNumDensityBricks[0] );
+        const int32_t x0 = brickX << mDensityBrickSizeLog2;
+        const int32_t countX = std::min( mDensityBrickSize, mDim[0] - x0 );
+        uint16_t* pDst = densityData() + calcDensityAddr( x0, brickY << mDensityBrickSizeLog2, z0 );
+
+        for (int32_t localZ = 0; localZ < mDensityBrickSize; localZ++) {
+            for (int32_t localY = 0; localY < mDensityBrickSize; localY++, pDst += mDensityBrickSize) {
+                const int32_t y = ( brickY << mDensityBrickSizeLog2 ) + localY;
+                int32_t numCopied = 0;
+                if (localZ < numPlanes && y < mDim[1]) {
+                    memcpy( pDst, &pPlanes[ ( static_cast<size_t>( localZ ) * mDim[1] + y ) * mDim[0] + x0 ], countX * sizeof( uint16_t ) );
+                    numCopied = countX;
+                }
+                std::fill( pDst + numCopied, pDst + mDensityBrickSize, static_cast<uint16_t>( 0 ) );
+            }
+        }
+    } );
+}
+
+void VolumeData::gatherDensityRow( const int32_t x0, const int32_t count, const int32_t y, const int32_t z, void* pRow ) const {
+    // copied as bytes, so one version serves all voxel types
+    const size_t voxelBytes = voxelSize();
+    const uint8_t* const pVoxels = voxelData< uint8_t >();
+    uint8_t* const pDst = static_cast< uint8_t* >( pRow );
+    if (mDensityLayout == densityLayout_t::LINEAR) {
+        memcpy( pDst, pVoxels + calcAddr( x0, y, z ) * voxelBytes, count * voxelBytes );
+        return;
+    }
+    // the row continues in the next brick in x, which is one brick size further in storage
+    constexpr size_t brickVolume = static_cast<size_t>( 1 ) << ( 3 * mDensityBrickSizeLog2 );
+    const int32_t firstOffset = x0 & ( mDensityBrickSize - 1 );
+    const uint8_t* pSrc = pVoxels + ( calcDensityAddr( x0, y, z ) - firstOffset ) * voxelBytes;
+    int32_t numCopied = std::min( count, mDensityBrickSize - firstOffset );
+    memcpy( pDst, pSrc + firstOffset * voxelBytes, numCopied * voxelBytes );
+    for (pSrc += brickVolume * voxelBytes; numCopied + mDensityBrickSize <= count; numCopied += mDensityBrickSize, pSrc += brickVolume * voxelBytes) {
+        memcpy( pDst + numCopied * voxelBytes, pSrc, mDensityBrickSize * voxelBytes );
+    }
+    memcpy( pDst + numCopied * voxelBytes, pSrc, ( count - numCopied ) * voxelBytes );
+}
+
+size_t VolumeData::getNumDensityRuns() const {
+    if (mVoxelType != voxelType_t::UINT16) { return 0; }
+    if (mDensityLayout == densityLayout_t::LINEAR) { return static_cast<size_t>( mDim[1] ) * mDim[2]; }
+    return ( static_cast<size_t>( mNumDensityBricks[0] ) * mNumDensityBricks[1] * mNumDensityBricks[2] ) << ( 2 * mDensityBrickSizeLog2 );
+}
+
+VolumeData::densityRun_t VolumeData::getDensityRun( const size_t runIdx ) const {
+    if (mDensityLayout == densityLayout_t::LINEAR) {
+        return densityRun_t{ densityData() + runIdx * mDim[0], mDim[0], 0, static_cast<int32_t>( runIdx % mDim[1] ), static_cast<int32_t>( runIdx / mDim[1] ) };
+    }
+    constexpr int32_t mask = mDensityBrickSize - 1;
+    const size_t brickIdx = runIdx >> ( 2 * mDensityBrickSizeLog2 );
+    const size_t brickXY = brickIdx % ( static_cast<size_t>( mNumDensityBricks[0] ) * mNumDensityBricks[1] );
+    const int32_t x = static_cast<int32_t>( brickXY % mNumDensityBricks[0] ) << mDensityBrickSizeLog2;
+    const int32_t y = ( static_cast<int32_t>( brickXY / mNumDensityBricks[0] ) << mDensityBrickSizeLog2 ) + static_cast<int32_t>( runIdx & mask );
+    const int32_t z = ( static_cast<int32_t>( brickIdx / ( static_cast<size_t>( mNumDensityBricks[0] ) * mNumDensityBricks[1] ) ) << mDensityBrickSizeLog2 ) 
+                    + static_cast<int32_t>( ( runIdx >> mDensityBrickSizeLog2 ) & mask );
+    const int32_t count = ( y < mDim[1] && z < mDim[2] ) ? std::min( mDensityBrickSize, mDim[0] - x ) : 0;
+    return densityRun_t{ densityData() + ( runIdx << mDensityBrickSizeLog2 ), count, x, y, z };
+}
+
+void VolumeData::computeRange() {
     // from https://www.cg.tuwien.ac.at/research/vis/datasets/
     // The data range is [0,4095].
-    mMinMaxDensity[0] = std::numeric_limits<uint16_t>::max();
-    mMinMaxDensity[1] = std::numeric_limits<uint16_t>::min();
-
-    const int32_t numDensityEntries = static_cast<int32_t>( mDensities.size() );
-    #pragma omp parallel for schedule(dynamic, 1)		// OpenMP 
-    //for (const auto& density : mDensities) { // on VS this doesn't work with OpenMP
-    for ( int32_t densityIdx = 0; densityIdx < numDensityEntries; densityIdx++ ) {
-        const auto& density = mDensities[densityIdx];
-        if (density > 0) { // skip density 0 as minimum
-            mMinMaxDensity[0] = std::min( mMinMaxDensity[0], density ); 
+    vec2_t range = emptyRange();
+
+    // The storage is scanned as is, the brick padding is 0 and changes neither the non-zero minimum nor the maximum.
+    accumulateRange( voxelData< uint8_t >(), static_cast<int64_t>( numDensityEntries() ), range );
+    setRange( range );
+}
+
+void VolumeData::accumulateRange( const void* pVoxels, const int64_t numEntries, vec2_t& range ) const {
+    const int64_t numBlocks = ( numEntries + rangeBlockSize - 1 ) / rangeBlockSize;
+    const gradientKernels::rowKernels_t& rowKernels = gradientKernels::getRowKernels();
+
+    visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+        const voxel_T* const pTypedVoxels = static_cast< const voxel_T* >( pVoxels );
+        const gradientKernels::voxelKernels_t< voxel_T >& voxelKernels = rowKernels.voxels< voxel_T >();
+
+        // Every slot reduces into its own pair, the pairs are merged at the end.
+        std::vector< std::array< voxel_T, 2 > > slotMinMax( mpExecutionContext->getNumThreads(), 
+                                                            std::array< voxel_T, 2 >{ std::numeric_limits< voxel_T >::max(), std::numeric_limits< voxel_T >::lowest() } );
+        mpExecutionContext->parallelForSlots( 0, numBlocks, 1, [&]( const int64_t blockIdx, const uint32_t slot ) {
+            const int64_t blockBegin = blockIdx * rangeBlockSize;
+            const int32_t blockCount = static_cast<int32_t>( std::min( rangeBlockSize, numEntries - blockBegin ) );
+            voxelKernels.densityRange( pTypedVoxels + blockBegin, blockCount, slotMinMax[slot][0], slotMinMax[slot][1] );
+        } );
+        for (const auto& minMax : slotMinMax) {
+            range[0] = std::min( range[0], static_cast<float>( minMax[0] ) );
+            range[1] = std::max( range[1], static_cast<float>( minMax[1] ) );
         }
-        mMinMaxDensity[1] = std::max( mMinMaxDensity[1], density );
+    } );
+}
+
+void VolumeData::setRange( const vec2_t& range ) {
+    if (mVoxelType == voxelType_t::FLOAT32) {
+        // the keys span the values, a volume without values (or with a single one) maps everything to key 0
+        mValueRange = ( range[0] <= range[1] ) ? range : vec2_t{ 0.0f, 0.0f };
+        mDensityKeyScale = ( mValueRange[1] > mValueRange[0] ) ? 65535.0 / ( static_cast<double>( mValueRange[1] ) - mValueRange[0] ) : 0.0;
+        mMinMaxDensity = { 0, std::numeric_limits<uint16_t>::max() };
+        return;
     }
+
+    mMinMaxDensity[0] = static_cast<uint16_t>( std::min( range[0], 65535.0f ) ); // skip density 0 as minimum
+    mMinMaxDensity[1] = static_cast<uint16_t>( std::max( range[1], 0.0f ) );
     if (mMinMaxDensity[0] == mMinMaxDensity[1]) { mMinMaxDensity[0] = 0; }
     assert( mMinMaxDensity[1] <= std::numeric_limits<uint16_t>::max() );
     if (mMinMaxDensity[0] >= mMinMaxDensity[1]) { mMinMaxDensity[1] += 1; }
+    mValueRange = { static_cast<float>( mMinMaxDensity[0] ), static_cast<float>( mMinMaxDensity[1] ) };
     
     //mMinMaxDensity[0] = 0;
     //mMinMaxDensity[1] = 4095;
+}
 
-#if 1 // TODO!!!
-    mNormals.resize( numVoxels );
-    mGradientMode = mode;
-    calculateNormals( mGradientMode );
-#endif
-
-    return eRetVal::OK; //Status_t::OK();
+void VolumeData::computeMinMaxTree() {
+    allocateMinMaxTree();
+    if (mMinMaxLevels.empty()) { return; }
+    computeMacroCellLayers( 0, mMinMaxLevels[0].numCells[2] );
+    computeMinMaxParents();
 }
 
+void VolumeData::allocateMinMaxTree() {
+    mMinMaxLevels.clear();
+    if (mNumVoxels == 0) { return; }
 
-void VolumeData::sobelGradients() {
-#if 1
-    // https://github.com/snapfinger/sobel-operator/blob/master/v3dedge.c
-    float sobelX[3][3][3], sobelY[3][3][3], sobelZ[3][3][3];
-    constexpr float hx[3] = { 1.0f, 2.0f, 1.0f };
-    constexpr float hy[3] = { 1.0f, 2.0f, 1.0f };
-    constexpr float hz[3] = { 1.0f, 2.0f, 1.0f };
-    //float hpx[3]={ 1.0f, 0.0f, -1.0f }, hpy[3]={ 1.0f, 0.0f, -1.0f },hpz[3]={ 1.0f, 0.0f, -1.0f };
-    constexpr float hpx[3] = { -1.0f, 0.0f, 1.0f };
-    constexpr float hpy[3] = { -1.0f, 0.0f, 1.0f };
-    constexpr float hpz[3] = { -1.0f, 0.0f, 1.0f };
-
-    //VXparse(&argc, &argv, par); /* parse the command line */
-    //V3fread( &im, IVAL);        /* read 3D image */
-    //if ( im.type != VX_PBYTE || im.chan != 1) { /* check  format  */
-    //    fprintf (stderr, "image not byte type or single channel\kernelY");
-    //    exit (1);
-    //}   
-
-    //V3fembed(&tm, &im, 1,1,1,1,1,1); /* temp image copy with border */
-    //if(VFLAG){
-    //    fprintf(stderr,"bbx is %f %f %f %f %f %f\kernelY", im.bbx[0],
-    //        im.bbx[1],im.bbx[2],im.bbx[3],im.bbx[4],im.bbx[5]);
-    //}
-
-    for (int kernelX = 0; kernelX <= 2; kernelX++) {//build the kernel
-        for (int kernelY = 0; kernelY <= 2; kernelY++) {
-            for (int kernelZ = 0; kernelZ <= 2; kernelZ++) {
-                sobelX[kernelX][kernelY][kernelZ] = hpx[kernelX] * hy[kernelY] * hz[kernelZ];
-                sobelY[kernelX][kernelY][kernelZ] = hx[kernelX] * hpy[kernelY] * hz[kernelZ];
-                sobelZ[kernelX][kernelY][kernelZ] = hx[kernelX] * hy[kernelY] * hpz[kernelZ];
-            }
+    i32vec3_t numCells;
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        numCells[dimIdx] = ( mDim[dimIdx] + mMacroCellSize - 1 ) >> mMacroCellSizeLog2;
+    }
+    for (;;) {
+        const size_t numLevelCells = static_cast<size_t>( numCells[0] ) * numCells[1] * numCells[2];
+        mMinMaxLevels.push_back( minMaxLevel_t{ numCells, std::vector< u16vec2_t >( numLevelCells ) } );
+        if (numLevelCells == 1) { break; }
+        for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+            numCells[dimIdx] = ( numCells[dimIdx] + 1 ) / 2;
         }
     }
+}
 
-#pragma omp parallel for /*collapse(3)*/ schedule(dynamic, 1) // OpenMP 
-    for (int32_t z = 0; z < mDim[2]; z++) { //convolve 
-        for (int32_t y = 0; y < mDim[1]; y++) {
-            for (int32_t x = 0; x < mDim[0]; x++) {
-                float sumx = 0.0f;
-                float sumy = 0.0f;
-                float sumz = 0.0f;
-                for( int kernelX = -1; kernelX <= 1; kernelX++ ) {
-                    for( int kernelY = -1; kernelY <= 1; kernelY++ ) {
-                        for( int kernelZ = -1; kernelZ <= 1; kernelZ++ ) {
-                            const auto addr = calcAddrClamped( x + kernelX, y + kernelY, z + kernelZ );
-                            const auto density = mDensities[addr];
-                            //sumx+=sobelX[kernelX+1][kernelY+1][kernelZ+1]*tm.u[z-kernelX][y-kernelY][x-kernelZ];
-                            //sumy+=sobelY[kernelX+1][kernelY+1][kernelZ+1]*tm.u[z-kernelX][y-kernelY][x-kernelZ];
-                            //sumz+=sobelZ[kernelX+1][kernelY+1][kernelZ+1]*tm.u[z-kernelX][y-kernelY][x-kernelZ
-                            sumx += sobelX[kernelX + 1][kernelY + 1][kernelZ + 1] * density;
-                            sumy += sobelY[kernelX + 1][kernelY + 1][kernelZ + 1] * density;
-                            sumz += sobelZ[kernelX + 1][kernelY + 1][kernelZ + 1] * density;
-                        } 
-                    }
-                }		
-                //sumx/=16.0f; 
-                //sumy/=16.0f;
-                //sumz/=16.0f;
-                sumx/=32.0f; 
-                sumy/=32.0f;
-                sumz/=32.0f;
-
-                //temp=abs(sumx)+abs(sumy)+abs(sumz);//approximation of the gradient magnitude
-                //temp=sqrt(sumx*sumx+sumy*sumy+sumz*sumz); //or use this more presise computation instead of line above
-                //im.u[z][y][x]=temp>50?255:0; //threshold at 50
-
-                //const uint32_t addr_center = (z * mDim[1] + y) * mDim[0] + x;
-                const uint32_t addr_center = calcAddr( x, y, z );
-                mNormals[addr_center][0] = sumx;
-                mNormals[addr_center][1] = sumy;
-                mNormals[addr_center][2] = sumz;
+void VolumeData::computeMacroCellLayers( const int32_t cellZBegin, const int32_t cellZEnd ) {
+    if (cellZBegin >= cellZEnd) { return; }
+    minMaxLevel_t& cells = mMinMaxLevels[0];
+    const int32_t numCellsX = cells.numCells[0];
+    const int32_t numCellsY = cells.numCells[1];
+    const int32_t dimX = mDim[0];
+    const gradientKernels::rowKernels_t& rowKernels = gradientKernels::getRowKernels();
 
-            }
-        }
-    }   
-#else
-    for (int32_t z = 0; z < mDim[2]; z++) { // error C3016: 'z': index variable in OpenMP 'for' statement must have signed integral type
-        for (int32_t y = 0; y < mDim[1]; y++) {
-            for (int32_t x = 0; x < mDim[0]; x++) {
-
-                // convolve
-                float sum_x = 0.0f;
-                float kernel_sum_x = 0.0f;
-                for (int32_t off_x = -1; off_x <= +1; off_x++) {
-                    const int32_t conv_x = xClamp( x + off_x );
-                    const int32_t conv_y = y;
-                    const int32_t conv_z = z;
-                    uint32_t kernelIdx = 0;
-                    int32_t cx = 0;
-                    
-                    for (int32_t cy = -1; cy <= 1; cy++) {
-                        //for (int32_t cz = -1; cz <= 1; cz++) {
-                        for (int32_t cz = +1; cz >= -1; cz--) {
-                            const uint32_t conv_addr = calcAddrClamped( conv_x + cx, conv_y + cy, conv_z + cz );
-                            sum_x += mDensities[conv_addr] * sobel_x[off_x + 1][kernelIdx];
-                            kernel_sum_x += fabsf( sobel_x[off_x + 1][kernelIdx] );
-                            //kernel_sum_x += sobel_x[off_x + 1][kernelIdx];
-                            kernelIdx++;
+    // One task per layer of cells. The rows of a cell (including the overlap row and plane) are reduced per x first, 
+    // which is a plain element-wise min/max over whole rows, then the columns are reduced per cell and turned into keys.
+    visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+        const gradientKernels::voxelKernels_t< voxel_T >& voxelKernels = rowKernels.voxels< voxel_T >();
+
+        mpExecutionContext->parallelFor( cellZBegin, cellZEnd, 1, [&]( const int64_t cellZ ) {
+            std::vector< voxel_T > columnMin( dimX );
+            std::vector< voxel_T > columnMax( dimX );
+            std::vector< voxel_T > rowBuffer( ( mDensityLayout == densityLayout_t::BRICKED ) ? dimX : 0 );
+
+            const int32_t z0 = static_cast<int32_t>( cellZ ) << mMacroCellSizeLog2;
+            const int32_t z1 = std::min( z0 + mMacroCellSize, mDim[2] - 1 );
+            for (int32_t cellY = 0; cellY < numCellsY; cellY++) {
+                const int32_t y0 = cellY << mMacroCellSizeLog2;
+                const int32_t y1 = std::min( y0 + mMacroCellSize, mDim[1] - 1 );
+                std::fill( columnMin.begin(), columnMin.end(), std::numeric_limits< voxel_T >::max() );
+                std::fill( columnMax.begin(), columnMax.end(), std::numeric_limits< voxel_T >::lowest() );
+
+                for (int32_t z = z0; z <= z1; z++) {
+                    for (int32_t y = y0; y <= y1; y++) {
+                        const voxel_T* pRow = rowBuffer.data();
+                        if (mDensityLayout == densityLayout_t::LINEAR) {
+                            pRow = voxelData< voxel_T >() + calcAddr( 0, y, z );
+                        } else {
+                            gatherDensityRow( 0, dimX, y, z, rowBuffer.data() );
                         }
+                        voxelKernels.columnMinMax( pRow, dimX, columnMin.data(), columnMax.data() );
                     }
                 }
-                if (kernel_sum_x != 0.0) { sum_x /= kernel_sum_x; }
-                
-
-                float sum_y = 0.0f;
-                float kernel_sum_y = 0.0f;
-                for (int32_t off_y = -1; off_y <= +1; off_y++) {
-                    const int32_t conv_x = x;
-                    const int32_t conv_y = yClamp( y + off_y );
-                    const int32_t conv_z = z;
-                    uint32_t kernelIdx = 0;
-                    int32_t cy = 0;                    
-                    for (int32_t cz = +1; cz >= -1; cz--) {
-                        for (int32_t cx = -1; cx <= 1; cx++) {
-                            const uint32_t conv_addr = calcAddrClamped( conv_x + cx, conv_y + cy, conv_z + cz );
-                            sum_y += mDensities[conv_addr] * sobel_y[off_y + 1][kernelIdx];
-                            kernel_sum_y += fabsf( sobel_y[off_y + 1][kernelIdx] );
-                            //kernel_sum_y += sobel_y[off_y + 1][kernelIdx];
-                            kernelIdx++;
-                        }
+
+                u16vec2_t* const pCells = &cells.minMax[ ( static_cast<size_t>( cellZ ) * numCellsY + cellY ) * numCellsX ];
+                for (int32_t cellX = 0; cellX < numCellsX; cellX++) {
+                    const int32_t x0 = cellX << mMacroCellSizeLog2;
+                    const int32_t x1 = std::min( x0 + mMacroCellSize, dimX - 1 );
+                    voxel_T minValue = columnMin[x0];
+                    voxel_T maxValue = columnMax[x0];
+                    for (int32_t x = x0 + 1; x <= x1; x++) {
+                        minValue = std::min( minValue, columnMin[x] );
+                        maxValue = std::max( maxValue, columnMax[x] );
                     }
+                    pCells[cellX] = densityKeyRange( minValue, maxValue );
                 }
-                if (kernel_sum_y != 0.0) { sum_y /= kernel_sum_y; }
-
-                float sum_z = 0.0f;
-                float kernel_sum_z = 0.0f;                
-                for (int32_t off_z = -1; off_z <= +1; off_z++) {
-                    const int32_t conv_x = x;
-                    const int32_t conv_y = y;
-                    const int32_t conv_z = zClamp( z + off_z );
-                    uint32_t kernelIdx = 0;
-                    int32_t cz = 0;
-                    //for (int32_t cy = -1; cy <= 1; cy++) {
-                    //    for (int32_t cx = -1; cx <= 1; cx++) {
-                    for (int32_t cx = -1; cx <= 1; cx++) {
-                        for (int32_t cy = +1; cy >= 1; cy--) {
-                            const uint32_t conv_addr = calcAddrClamped( conv_x + cx, conv_y + cy, conv_z + cz );
-                            sum_z += mDensities[conv_addr] * sobel_z[off_z + 1][kernelIdx];
-                            kernel_sum_z += fabsf( sobel_z[off_z + 1][kernelIdx] );
-                            //kernel_sum_z += sobel_z[off_z + 1][kernelIdx];
-                            kernelIdx++;
+            }
+        } );
+    } );
+}
+
+void VolumeData::computeMinMaxParents() {
+    for (size_t level = 1; level < mMinMaxLevels.size(); level++) {
+        const minMaxLevel_t& children = mMinMaxLevels[level - 1];
+        minMaxLevel_t& parents = mMinMaxLevels[level];
+
+        mpExecutionContext->parallelFor( 0, parents.numCells[2], 1, [&]( const int64_t parentZ ) {
+            for (int32_t parentY = 0; parentY < parents.numCells[1]; parentY++) {
+                for (int32_t parentX = 0; parentX < parents.numCells[0]; parentX++) {
+                    u16vec2_t minMax = { std::numeric_limits<uint16_t>::max(), std::numeric_limits<uint16_t>::min() };
+                    for (int32_t childZ = static_cast<int32_t>( parentZ ) * 2; childZ < std::min( static_cast<int32_t>( parentZ ) * 2 + 2, children.numCells[2] ); childZ++) {
+                        for (int32_t childY = parentY * 2; childY < std::min( parentY * 2 + 2, children.numCells[1] ); childY++) {
+                            for (int32_t childX = parentX * 2; childX < std::min( parentX * 2 + 2, children.numCells[0] ); childX++) {
+                                const u16vec2_t& childMinMax = children.minMax[ ( static_cast<size_t>( childZ ) * children.numCells[1] + childY ) * children.numCells[0] + childX ];
+                                minMax[0] = std::min( minMax[0], childMinMax[0] );
+                                minMax[1] = std::max( minMax[1], childMinMax[1] );
+                            }
                         }
                     }
+                    parents.minMax[ ( static_cast<size_t>( parentZ ) * parents.numCells[1] + parentY ) * parents.numCells[0] + parentX ] = minMax;
                 }
-                if (kernel_sum_z != 0.0) { sum_z /= kernel_sum_z; }
-
-                //const float recipLen = 1.0f / sqrtf( sum_x * sum_x + sum_y * sum_y + sum_z * sum_z );
-                //const float recipLen = 1.0f / ( fabsf( sum_x ) + fabsf( sum_y ) + fabsf( sum_z ) );
-                const float recipLen = 1.0f;
-
-                const uint32_t addr_center = calcAddr( x, y, z );
-                //mNormals[addr_center][0] =  sum_x * recipLen;
-                //mNormals[addr_center][1] = -sum_z * recipLen;
-                //mNormals[addr_center][2] =  sum_y * recipLen;
-
-                //  1  1  1
-                //  1  1 -1
-                //  1 -1  1
-                //  1 -1 -1
-                // -1  1  1
-                // -1  1 -1
-                // -1 -1  1
-                // -1 -1 -1
-                mNormals[addr_center][0] = sum_x * recipLen;
-                mNormals[addr_center][1] = sum_y * recipLen;
-                mNormals[addr_center][2] = sum_z * recipLen;
+            }
+        } );
+    }
+}
+
+bool VolumeData::mayContainDensities( const i32vec3_t& boxMin, const i32vec3_t& boxMax, const uint16_t densityMin, const uint16_t densityMax ) const {
+    if (mMinMaxLevels.empty()) { return false; }
+    i32vec3_t clampedMin;
+    i32vec3_t clampedMax;
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        clampedMin[dimIdx] = std::max( boxMin[dimIdx], 0 );
+        clampedMax[dimIdx] = std::min( boxMax[dimIdx], static_cast<int32_t>( mDim[dimIdx] ) );
+        if (clampedMin[dimIdx] >= clampedMax[dimIdx]) { return false; }
+    }
+    return mayContainDensities( mMinMaxLevels.size() - 1, 0, 0, 0, clampedMin, clampedMax, densityMin, densityMax );
+}
+
+bool VolumeData::mayContainDensities( const size_t level, const int32_t cellX, const int32_t cellY, const int32_t cellZ, 
+                                      const i32vec3_t& boxMin, const i32vec3_t& boxMax, const uint16_t densityMin, const uint16_t densityMax ) const {
+    const u16vec2_t& minMax = getMacroCellMinMax( level, cellX, cellY, cellZ );
+    if (minMax[1] < densityMin || minMax[0] > densityMax) { return false; }
+    if (level == 0) { return true; }
+
+    // the children that overlap the box, child c covers the voxels [c << childSizeLog2, ( c + 1 ) << childSizeLog2)
+    const minMaxLevel_t& children = mMinMaxLevels[level - 1];
+    const int32_t childSizeLog2 = mMacroCellSizeLog2 + static_cast<int32_t>( level ) - 1;
+    i32vec3_t childMin;
+    i32vec3_t childEnd;
+    const i32vec3_t cell = { cellX, cellY, cellZ };
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        childMin[dimIdx] = std::max( cell[dimIdx] * 2, boxMin[dimIdx] >> childSizeLog2 );
+        childEnd[dimIdx] = std::min( { cell[dimIdx] * 2 + 2, children.numCells[dimIdx], ( ( boxMax[dimIdx] - 1 ) >> childSizeLog2 ) + 1 } );
+    }
+    for (int32_t childZ = childMin[2]; childZ < childEnd[2]; childZ++) {
+        for (int32_t childY = childMin[1]; childY < childEnd[1]; childY++) {
+            for (int32_t childX = childMin[0]; childX < childEnd[0]; childX++) {
+                if (mayContainDensities( level - 1, childX, childY, childZ, boxMin, boxMax, densityMin, densityMax )) { return true; }
             }
         }
     }
-#endif
+    return false;
 }
 
-void VolumeData::centralDifferencesGradients() {
-#pragma omp parallel for /*collapse(3)*/ schedule(dynamic, 1) // OpenMP
-    for (int32_t z = 0; z < mDim[2]; z++) { // error C3016: 'z': index variable in OpenMP 'for' statement must have signed integral type
-        for (int32_t y = 0; y < mDim[1]; y++) {
-            for (int32_t x = 0; x < mDim[0]; x++) {
+void VolumeData::sampleTrilinear( const float* px, const float* py, const float* pz, const size_t count, float* pDensities,
+                                  float* pGradientX, float* pGradientY, float* pGradientZ ) const {
+    if (mNumVoxels == 0) {
+        std::fill( pDensities, pDensities + count, 0.0f );
+        if (pGradientX) {
+            std::fill( pGradientX, pGradientX + count, 0.0f );
+            std::fill( pGradientY, pGradientY + count, 0.0f );
+            std::fill( pGradientZ, pGradientZ + count, 0.0f );
+        }
+        return;
+    }
+
+    const gradientKernels::rowKernels_t& rowKernels = gradientKernels::getRowKernels();
+    visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+        gradientKernels::trilinearGrid_t< voxel_T > grid;
+        grid.pVoxels = voxelData< voxel_T >();
+        grid.dim[0] = mDim[0];
+        grid.dim[1] = mDim[1];
+        grid.dim[2] = mDim[2];
+        grid.numBricks[0] = ( mDensityLayout == densityLayout_t::BRICKED ) ? mNumDensityBricks[0] : 0;
+        grid.numBricks[1] = mNumDensityBricks[1];
+        grid.brickSizeLog2 = mDensityBrickSizeLog2;
 
-                //const int32_t mx = std::max( 0, x - 1 );
-                //const int32_t px = std::min( mDim[0] - 1, x + 1 );
+        // the kernels take int32_t counts
+        constexpr size_t maxBatch = size_t( 1 ) << 30;
+        const gradientKernels::voxelKernels_t< voxel_T >& voxelKernels = rowKernels.voxels< voxel_T >();
+        for (size_t first = 0; first < count; first += maxBatch) {
+            const int32_t batch = static_cast<int32_t>( std::min( count - first, maxBatch ) );
+            if (pGradientX) {
+                voxelKernels.sampleTrilinear( grid, px + first, py + first, pz + first, batch, pDensities + first, pGradientX + first, pGradientY + first, pGradientZ + first );
+            } else {
+                voxelKernels.sampleTrilinear( grid, px + first, py + first, pz + first, batch, pDensities + first, nullptr, nullptr, nullptr );
+            }
+        }
+    } );
+}
+
+void VolumeData::sobelGradients( jointHistogramAccumulator_t* pJointHistogram ) {
+    const int32_t numSlabs = ( mDim[2] + sobelSlabDepth - 1 ) / sobelSlabDepth;
+
+    mpExecutionContext->parallelForSlots( 0, numSlabs, 1, [&]( const int64_t slab, const uint32_t slot ) {
+        const int32_t z0 = static_cast<int32_t>( slab ) * sobelSlabDepth;
+        computeGradients( i32vec3_t{ 0, 0, z0 }, i32vec3_t{ mDim[0], mDim[1], std::min( static_cast<int32_t>( mDim[2] ), z0 + sobelSlabDepth ) }, 
+                          pJointHistogram, slot );
+    } );
+}
+
+void VolumeData::centralDifferencesGradients( jointHistogramAccumulator_t* pJointHistogram ) {
+    mpExecutionContext->parallelForSlots( 0, mDim[2], 1, [&]( const int64_t z, const uint32_t slot ) {
+        computeGradients( i32vec3_t{ 0, 0, static_cast<int32_t>( z ) }, i32vec3_t{ mDim[0], mDim[1], static_cast<int32_t>( z ) + 1 }, pJointHistogram, slot );
+    } );
+}
 
-                //const int32_t my = std::max( 0, y - 1 );
-                //const int32_t py = std::min( mDim[1] - 1, y + 1 );
 
-                //const int32_t mz = std::max( 0, z - 1 );
-                //const int32_t pz = std::min( mDim[2] - 1, z + 1 );
+void VolumeData::computeGradients( const i32vec3_t& boxMin, const i32vec3_t& boxMax, jointHistogramAccumulator_t* pJointHistogram, const uint32_t slot ) {
+    const int32_t storeCount = boxMax[0] - boxMin[0];
+    if (storeCount <= 0 || boxMin[1] >= boxMax[1] || boxMin[2] >= boxMax[2]) { return; }
 
-                //const uint32_t addr_mx = (z * mDim[1] + y) * mDim[0] + mx;
-                //const uint32_t addr_px = (z * mDim[1] + y) * mDim[0] + px;
+    const gradientKernels::rowKernels_t& rowKernels = gradientKernels::getRowKernels();
 
-                //const uint32_t addr_my = (z * mDim[1] + my) * mDim[0] + x;
-                //const uint32_t addr_py = (z * mDim[1] + py) * mDim[0] + x;
+    // The row kernels clamp at both ends of the row they are given. The row segment therefore gets one voxel 
+    // of halo on each side which is computed but not stored; at the volume borders the clamping is the real one.
+    const int32_t segmentBegin = std::max( 0, boxMin[0] - 1 );
+    const int32_t segmentEnd = std::min( static_cast<int32_t>( mDim[0] ), boxMax[0] + 1 );
+    const int32_t segmentLength = segmentEnd - segmentBegin;
+    const int32_t storeOffset = boxMin[0] - segmentBegin;
 
-                //const uint32_t addr_mz = (mz * mDim[1] + y) * mDim[0] + x;
-                //const uint32_t addr_pz = (pz * mDim[1] + y) * mDim[0] + x;
+    visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+        using sum_t = typename gradientKernels::voxelKernels_t< voxel_T >::sum_t;
+        const gradientKernels::voxelKernels_t< voxel_T >& voxelKernels = rowKernels.voxels< voxel_T >();
+        const voxel_T* const pVoxels = voxelData< voxel_T >();
 
-                //const uint32_t addr_center = (z * mDim[1] + y) * mDim[0] + x;
+        // Bricked densities have no linear rows to point at. The rows of the box plus the y halo are gathered into 
+        // a window of three linear planes instead, each plane of the box is gathered once.
+        const bool gatherRows = ( mDensityLayout != densityLayout_t::LINEAR );
+        const int32_t windowY0 = boxMin[1] - 1;
+        const int32_t windowRows = boxMax[1] - boxMin[1] + 2;
+        std::vector< voxel_T, DefaultInitAllocator< voxel_T > > planeWindow( gatherRows ? 3 * static_cast<size_t>( windowRows ) * segmentLength : 0 );
+        const auto windowPlane = [&]( const int32_t z ) { return planeWindow.data() + static_cast<size_t>( ( z + 3 ) % 3 ) * windowRows * segmentLength; };
+        const auto gatherPlane = [&]( const int32_t z ) {
+            voxel_T* const pPlane = windowPlane( z );
+            for (int32_t row = 0; row < windowRows; row++) {
+                gatherDensityRow( segmentBegin, segmentLength, yClamp( windowY0 + row ), zClamp( z ), pPlane + static_cast<size_t>( row ) * segmentLength );
+            }
+        };
+        const auto rowPtr = [&]( const int32_t y, const int32_t z ) -> const voxel_T* {
+            return ( gatherRows ) ? windowPlane( z ) + static_cast<size_t>( y - windowY0 ) * segmentLength : &pVoxels[ calcAddrClamped( segmentBegin, y, z ) ];
+        };
+        if (gatherRows) {
+            gatherPlane( boxMin[2] - 1 );
+            gatherPlane( boxMin[2] );
+        }
 
-                // central differences
-                //mNormals[addr_center][0] = (mDensities[addr_px] - mDensities[addr_mx]) * 0.5f;
-                //mNormals[addr_center][1] = (mDensities[addr_py] - mDensities[addr_my]) * 0.5f;
-                //mNormals[addr_center][2] = (mDensities[addr_pz] - mDensities[addr_mz]) * 0.5f;
+        std::vector< sum_t > rowScratch( 3 * static_cast<size_t>( segmentLength ) );
+        sum_t* const syA = rowScratch.data();
+        sum_t* const dyA = syA + segmentLength;
+        sum_t* const syB = dyA + segmentLength;
+        std::vector< float > gradientRow( 3 * static_cast<size_t>( segmentLength ) );
+        float* const gx = gradientRow.data();
+        float* const gy = gx + segmentLength;
+        float* const gz = gy + segmentLength;
 
-                const uint32_t addr_center = calcAddr( x, y, z );
-                mNormals[addr_center][0] = (mDensities[ calcAddrClamped( x + 1, y    , z     ) ] - mDensities[ calcAddrClamped( x - 1, y    , z     ) ]) * 0.5f;
-                mNormals[addr_center][1] = (mDensities[ calcAddrClamped( x    , y + 1, z     ) ] - mDensities[ calcAddrClamped( x    , y - 1, z     ) ]) * 0.5f;
-                mNormals[addr_center][2] = (mDensities[ calcAddrClamped( x    , y    , z + 1 ) ] - mDensities[ calcAddrClamped( x    , y    , z - 1 ) ]) * 0.5f;
+        for (int32_t z = boxMin[2]; z < boxMax[2]; z++) {
+            if (gatherRows) { gatherPlane( z + 1 ); } // replaces plane z - 2
+            for (int32_t y = boxMin[1]; y < boxMax[1]; y++) {
+                if (mGradientMode == gradientMode_t::SOBEL_3D) {
+                    const voxel_T* rows[3][3];
+                    for (int32_t dz = 0; dz < 3; dz++) {
+                        for (int32_t dy = 0; dy < 3; dy++) {
+                            rows[dz][dy] = rowPtr( y + dy - 1, z + dz - 1 );
+                        }
+                    }
+                    voxelKernels.sobelRowYZ( rows, segmentLength, syA, dyA, syB );
+                    voxelKernels.sobelRowX( syA, dyA, syB, segmentLength, gx, gy, gz );
+                } else {
+                    const voxel_T* const rows[5] = {
+                        rowPtr( y - 1, z     ),
+                        rowPtr( y + 1, z     ),
+                        rowPtr( y    , z - 1 ),
+                        rowPtr( y    , z + 1 ),
+                        rowPtr( y    , z     ),
+                    };
+                    voxelKernels.centralDifferencesRow( rows, segmentLength, gx, gy, gz );
+                }
+                storeNormalRow( gx + storeOffset, gy + storeOffset, gz + storeOffset, storeCount, calcAddr( boxMin[0], y, z ) );
+                if (pJointHistogram) {
+                    accumulateJointHistogramRow( *pJointHistogram, slot, rowPtr( y, z ) + storeOffset, gx + storeOffset, gy + storeOffset, gz + storeOffset, storeCount );
+                }
             }
         }
+    } );
+}
+
+size_t VolumeData::prepareNormals( const gradientMode_t mode, const normalStorage_t normalStorage ) {
+    mpNormalMapping.reset();
+    mNormalStorage = normalStorage;
+    if (mNormalStorage == normalStorage_t::OCTAHEDRAL_16) {
+        mNormals.clear();
+        mNormals.shrink_to_fit();
+        mPackedNormals.resize( mNumVoxels );
+        mNormalMagnitudeScale = octahedralMagnitudeScale( gradientValueSpan() );
+    } else {
+        mPackedNormals.clear();
+        mPackedNormals.shrink_to_fit();
+        mNormals.resize( mNumVoxels );
+        mNormalMagnitudeScale = 1.0f;
+    }
+
+    // computeGradients() picks the kernel from mGradientMode, so it has to be set before any brick is computed
+    mGradientMode = mode;
+
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        mNumNormalBricks[dimIdx] = ( mDim[dimIdx] + mNormalBrickSize - 1 ) / mNormalBrickSize;
     }
+    return static_cast<size_t>( mNumNormalBricks[0] ) * mNumNormalBricks[1] * mNumNormalBricks[2];
 }
 
+void VolumeData::calculateNormals( const gradientMode_t mode, const normalStorage_t normalStorage, const gradientEvaluation_t gradientEvaluation ) {
+    calculateNormals( mode, normalStorage, gradientEvaluation, jointHistogramOptions_t{} );
+}
+
+void VolumeData::calculateNormals( const gradientMode_t mode, const normalStorage_t normalStorage, const gradientEvaluation_t gradientEvaluation,
+                                   const jointHistogramOptions_t& jointHistogram ) {
+    const size_t numBricks = prepareNormals( mode, normalStorage );
 
-void VolumeData::calculateNormals( const gradientMode_t mode ) {
+    const bool accumulateJointHistogram = ( jointHistogram.numDensityBuckets > 0 );
+    if (gradientEvaluation == gradientEvaluation_t::LAZY_BRICKS && !accumulateJointHistogram) {
+        mNormalBrickStates.reset( numBricks, brickStates_t::MISSING );
+        return;
+    }
+    jointHistogramAccumulator_t jointHistogramAccumulator;
+    if (accumulateJointHistogram) { prepareJointHistogram( jointHistogram, jointHistogramAccumulator ); }
+    jointHistogramAccumulator_t* const pJointHistogram = ( accumulateJointHistogram ) ? &jointHistogramAccumulator : nullptr;
 
-    if (mode == gradientMode_t::SOBEL_3D) {
-        sobelGradients();
+    if (mDensityLayout == densityLayout_t::BRICKED) {
+        // Whole-plane slabs would gather a window of three full planes, so the slabs are split in y as well. The tiles 
+        // keep full rows: computing per normal brick scatters the stores of short rows over many pages and is much slower.
+        const int32_t numTilesY = ( mDim[1] + mDensityBrickSize - 1 ) / mDensityBrickSize;
+        const int32_t numTilesZ = ( mDim[2] + sobelSlabDepth - 1 ) / sobelSlabDepth;
+        const int64_t numTiles = static_cast<int64_t>( numTilesY ) * numTilesZ;
+
+        mpExecutionContext->parallelForSlots( 0, numTiles, 1, [&]( const int64_t tileIdx, const uint32_t slot ) {
+            const int32_t y0 = static_cast<int32_t>( tileIdx % numTilesY ) * mDensityBrickSize;
+            const int32_t z0 = static_cast<int32_t>( tileIdx / numTilesY ) * sobelSlabDepth;
+            computeGradients( i32vec3_t{ 0, y0, z0 }, i32vec3_t{ mDim[0], std::min( y0 + mDensityBrickSize, static_cast<int32_t>( mDim[1] ) ), 
+                                                                 std::min( z0 + sobelSlabDepth, static_cast<int32_t>( mDim[2] ) ) }, 
+                              pJointHistogram, slot );
+        } );
+    } else if (mode == gradientMode_t::SOBEL_3D) {
+        sobelGradients( pJointHistogram );
     } else if (mode == gradientMode_t::CENTRAL_DIFFERENCES) {
-        centralDifferencesGradients();
+        centralDifferencesGradients( pJointHistogram );
+    }
+    mNormalBrickStates.reset( numBricks, brickStates_t::RESIDENT );
+    if (accumulateJointHistogram) { finishJointHistogram( jointHistogramAccumulator ); }
+}
+
+eRetVal VolumeData::streamGradients( const std::string& fileUrl, const gradientMode_t mode, const streamOptions_t& options, 
+                                     const gradientSlabCallback_t& slabCallback, 
+                                     std::shared_ptr< const ExecutionContext > pExecutionContext ) {
+    FILE* pFile = fopen( fileUrl.c_str(), "rb" );
+    if (pFile == nullptr) { return eRetVal::ERROR; }
+
+    u16vec3_t dim;
+    if (fread( dim.data(), sizeof( uint16_t ), 3, pFile ) != 3) {
+        fclose( pFile );
+        return eRetVal::ERROR;
     }
 
-    mGradientMode = mode;
+    // The window is a VolumeData of its own that holds the planes of one slab plus a halo plane on either side.
+    // Where the window ends at the volume border the clamping of computeGradients() is the real one, 
+    // at the inner window ends the halo plane is there and the slab planes never clamp.
+    const int32_t slabDepth = std::max( 1, options.slabDepth );
+    const int32_t maxWindowPlanes = std::min( static_cast<int32_t>( dim[2] ), slabDepth + 2 );
+    VolumeData window;
+    window.setExecutionContext( std::move( pExecutionContext ) );
+    window.mDim = { dim[0], dim[1], static_cast<uint16_t>( maxWindowPlanes ) };
+    size_t maxWindowVoxels = 0;
+    if (!calcNumVoxels( window.mDim, maxWindowVoxels )) {
+        fclose( pFile );
+        return eRetVal::ERROR;
+    }
+    const size_t planeSize = static_cast<size_t>( dim[0] ) * dim[1];
+    window.mVoxels.resize( maxWindowVoxels * sizeof( uint16_t ) );
+    window.mGradientMode = mode;
+    window.mNormalStorage = options.normalStorage;
+
+    gradientFileHeader_t header = { { 'V', 'G', 'R', 'D' }, { dim[0], dim[1], dim[2] }, 
+                                    static_cast<uint8_t>( mode ), static_cast<uint8_t>( options.normalStorage ), 1.0f };
+    size_t normalSize = sizeof( vec3_t );
+    if (options.normalStorage == normalStorage_t::OCTAHEDRAL_16) {
+        header.magnitudeScale = octahedralMagnitudeScale( ( options.maxDensity > 0 ) ? options.maxDensity : std::numeric_limits<uint16_t>::max() );
+        window.mNormalMagnitudeScale = header.magnitudeScale;
+        window.mPackedNormals.resize( maxWindowVoxels );
+        normalSize = sizeof( packedNormal_t );
+    } else {
+        window.mNormals.resize( maxWindowVoxels );
+    }
+
+    int32_t windowZ0 = 0;
+    int32_t numWindowPlanes = 0;
+    for (int32_t z0 = 0; z0 < dim[2]; z0 += slabDepth) {
+        const int32_t z1 = std::min( static_cast<int32_t>( dim[2] ), z0 + slabDepth );
+        const int32_t newWindowZ0 = std::max( 0, z0 - 1 );
+        const int32_t newWindowZ1 = std::min( static_cast<int32_t>( dim[2] ), z1 + 1 );
+
+        // the last two planes of the previous window are the first two of this one
+        const int32_t numKept = std::max( 0, windowZ0 + numWindowPlanes - newWindowZ0 );
+        if (numKept > 0 && newWindowZ0 != windowZ0) {
+            memmove( window.densityData(), window.densityData() + ( newWindowZ0 - windowZ0 ) * planeSize, numKept * planeSize * sizeof( uint16_t ) );
+        }
+        const size_t numNewVoxels = ( newWindowZ1 - newWindowZ0 - numKept ) * planeSize;
+        if (fread( window.densityData() + numKept * planeSize, sizeof( uint16_t ), numNewVoxels, pFile ) != numNewVoxels) {
+            fclose( pFile );
+            return eRetVal::ERROR; // truncated file
+        }
+        windowZ0 = newWindowZ0;
+        numWindowPlanes = newWindowZ1 - newWindowZ0;
+        window.mDim[2] = static_cast<uint16_t>( numWindowPlanes );
+        window.mNumVoxels = numWindowPlanes * planeSize;
+
+        const int32_t boxZ0 = z0 - windowZ0;
+        const int32_t boxZ1 = z1 - windowZ0;
+        const int64_t numTasks = ( boxZ1 - boxZ0 + sobelSlabDepth - 1 ) / sobelSlabDepth;
+        window.mpExecutionContext->parallelFor( 0, numTasks, 1, [&]( const int64_t task ) {
+            const int32_t taskZ0 = boxZ0 + static_cast<int32_t>( task ) * sobelSlabDepth;
+            window.computeGradients( i32vec3_t{ 0, 0, taskZ0 }, i32vec3_t{ dim[0], dim[1], std::min( boxZ1, taskZ0 + sobelSlabDepth ) } );
+        } );
+
+        const uint8_t* pNormals = ( options.normalStorage == normalStorage_t::OCTAHEDRAL_16 ) 
+            ? reinterpret_cast< const uint8_t* >( window.mPackedNormals.data() ) 
+            : reinterpret_cast< const uint8_t* >( window.mNormals.data() );
+        if (!slabCallback( header, z0, z1 - z0, pNormals + boxZ0 * planeSize * normalSize, ( z1 - z0 ) * planeSize * normalSize )) {
+            fclose( pFile );
+            return eRetVal::ERROR;
+        }
+    }
+    fclose( pFile );
+
+    // a volume without planes still delivers its header, as one slab of no planes
+    if (dim[2] == 0 && !slabCallback( header, 0, 0, nullptr, 0 )) { return eRetVal::ERROR; }
+    return eRetVal::OK;
+}
+
+eRetVal VolumeData::streamGradientsToFile( const std::string& fileUrl, const gradientMode_t mode, const streamOptions_t& options, 
+                                           const std::string& gradientFileUrl, 
+                                           std::shared_ptr< const ExecutionContext > pExecutionContext ) {
+    FILE* pGradientFile = fopen( gradientFileUrl.c_str(), "wb" );
+    if (pGradientFile == nullptr) { return eRetVal::ERROR; }
+
+    const eRetVal retVal = streamGradients( fileUrl, mode, options, 
+        [pGradientFile]( const gradientFileHeader_t& header, const int32_t z0, const int32_t, const void* pNormals, const size_t numBytes ) {
+            if (z0 == 0 && fwrite( &header, sizeof( header ), 1, pGradientFile ) != 1) { return false; }
+            return numBytes == 0 || fwrite( pNormals, 1, numBytes, pGradientFile ) == numBytes;
+        }, std::move( pExecutionContext ) );
+
+    if (fclose( pGradientFile ) != 0 || retVal != eRetVal::OK) {
+        remove( gradientFileUrl.c_str() ); // no partial gradient files
+        return eRetVal::ERROR;
+    }
+    return eRetVal::OK;
+}
+
+void VolumeData::ensureNormalBrick( const int32_t brickX, const int32_t brickY, const int32_t brickZ ) {
+    std::atomic< uint8_t >& state = mNormalBrickStates[ brickIndex( brickX, brickY, brickZ ) ];
+    if (state.load( std::memory_order_acquire ) == brickStates_t::RESIDENT) { return; }
+
+    uint8_t expected = brickStates_t::MISSING;
+    if (state.compare_exchange_strong( expected, brickStates_t::COMPUTING, std::memory_order_acquire )) {
+        const i32vec3_t brickMin = { brickX * mNormalBrickSize, brickY * mNormalBrickSize, brickZ * mNormalBrickSize };
+        const i32vec3_t brickMax = {    std::min( brickMin[0] + mNormalBrickSize, static_cast<int32_t>( mDim[0] ) ),
+                                        std::min( brickMin[1] + mNormalBrickSize, static_cast<int32_t>( mDim[1] ) ),
+                                        std::min( brickMin[2] + mNormalBrickSize, static_cast<int32_t>( mDim[2] ) ) };
+        computeGradients( brickMin, brickMax );
+        state.store( brickStates_t::RESIDENT, std::memory_order_release );
+        return;
+    }
+
+    // another thread is computing the brick, a brick takes well below a millisecond
+    while (state.load( std::memory_order_acquire ) != brickStates_t::RESIDENT) {
+        std::this_thread::yield();
+    }
+}
+
+void VolumeData::ensureNormals( const i32vec3_t& boxMin, const i32vec3_t& boxMax ) {
+    i32vec3_t brickMin, brickMax;
+    for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+        brickMin[dimIdx] = std::max( 0, boxMin[dimIdx] ) / mNormalBrickSize;
+        brickMax[dimIdx] = ( std::min( boxMax[dimIdx], static_cast<int32_t>( mDim[dimIdx] ) ) + mNormalBrickSize - 1 ) / mNormalBrickSize;
+        if (brickMin[dimIdx] >= brickMax[dimIdx]) { return; }
+    }
+
+    const int64_t numBricksX = brickMax[0] - brickMin[0];
+    const int64_t numBricksXY = numBricksX * ( brickMax[1] - brickMin[1] );
+    const int64_t numBricks = numBricksXY * ( brickMax[2] - brickMin[2] );
+
+    mpExecutionContext->parallelFor( 0, numBricks, 1, [&]( const int64_t brickIdx ) {
+        ensureNormalBrick(  brickMin[0] + static_cast<int32_t>( brickIdx % numBricksX ), 
+                            brickMin[1] + static_cast<int32_t>( ( brickIdx % numBricksXY ) / numBricksX ), 
+                            brickMin[2] + static_cast<int32_t>( brickIdx / numBricksXY ) );
+    } );
+}
+
+bool VolumeData::isNormalBrickResident( const int32_t brickX, const int32_t brickY, const int32_t brickZ ) const {
+    return mNormalBrickStates[ brickIndex( brickX, brickY, brickZ ) ].load( std::memory_order_acquire ) == brickStates_t::RESIDENT;
 }
 
-void FileLoader::VolumeData::calculateHistogramBuckets() {
-    const uint32_t numVoxels = mDim[0] * mDim[1] * mDim[2];
-    std::array< std::atomic<uint32_t>, mNumHistogramBuckets > mHistogramBucketsAtomic;
+VolumeData::vec3_t VolumeData::fetchNormal( const int32_t x, const int32_t y, const int32_t z ) {
+    ensureNormalBrick( x / mNormalBrickSize, y / mNormalBrickSize, z / mNormalBrickSize );
+    return getNormal( calcAddr( x, y, z ) );
+}
+
+void VolumeData::storeNormalRow( const float* gx, const float* gy, const float* gz, const int32_t count, const uint64_t rowAddr ) {
+    const gradientKernels::rowKernels_t& rowKernels = gradientKernels::getRowKernels();
+    if (mNormalStorage == normalStorage_t::OCTAHEDRAL_16) {
+        rowKernels.storeRowOctahedral( gx, gy, gz, count, mNormalMagnitudeScale, packedNormalData() + rowAddr );
+    } else {
+        rowKernels.storeRowFloat3( gx, gy, gz, count, normalData() + rowAddr );
+    }
+}
+
+VolumeData::vec3_t VolumeData::decodeNormal( const packedNormal_t& packedNormal ) const {
+    float px = packedNormal[0] * ( 2.0f / 65535.0f ) - 1.0f;
+    float py = packedNormal[1] * ( 2.0f / 65535.0f ) - 1.0f;
+    const float pz = 1.0f - fabsf( px ) - fabsf( py );
+    if (pz < 0.0f) { // unfold the lower hemisphere
+        const float unfoldedX = ( 1.0f - fabsf( py ) ) * ( ( px >= 0.0f ) ? 1.0f : -1.0f );
+        const float unfoldedY = ( 1.0f - fabsf( px ) ) * ( ( py >= 0.0f ) ? 1.0f : -1.0f );
+        px = unfoldedX;
+        py = unfoldedY;
+    }
+    const float len = sqrtf( px * px + py * py + pz * pz );
+    const float magnitude = packedNormal[2] / mNormalMagnitudeScale;
+    const float scale = ( len > 0.0f ) ? magnitude / len : 0.0f;
+    return vec3_t{ px * scale, py * scale, pz * scale };
+}
+
+VolumeData::vec3_t VolumeData::getNormal( const uint64_t addr ) const {
+    return ( mNormalStorage == normalStorage_t::OCTAHEDRAL_16 ) ? decodeNormal( packedNormalData()[ addr ] ) : normalData()[ addr ];
+}
+
+void FileLoader::VolumeData::calculateHistogramBuckets( const uint32_t numBuckets ) {
+    const int64_t numEntries = static_cast<int64_t>( numDensityEntries() );
+
+    std::vector< uint64_t > densityCounts( size_t( 1 ) << 16, 0 );
+    accumulateDensityCounts( voxelData< uint8_t >(), numEntries, densityCounts );
+
+    // like in computeRange() the storage was scanned as is, the brick padding was counted as density 0
+    densityCounts[0] -= static_cast<uint64_t>( numEntries ) - mNumVoxels;
+
+    rebinHistogram( densityCounts, numBuckets );
+}
+
+void VolumeData::accumulateDensityCounts( const void* pVoxels, const int64_t numEntries, std::vector< uint64_t >& densityCounts ) const {
+    const int64_t numBlocks = ( numEntries + rangeBlockSize - 1 ) / rangeBlockSize;
+
+    // Every slot counts at full density resolution into its own histogram, so there is neither contention 
+    // nor a division per voxel; the merged counts are rebinned into the requested buckets afterwards.
+    // The slot histograms are allocated by the first block of the slot, slots that never run cost nothing.
+    std::vector< std::vector< uint64_t > > slotDensityCounts( mpExecutionContext->getNumThreads() );
+    visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+        const voxel_T* const pTypedVoxels = static_cast< const voxel_T* >( pVoxels );
+        mpExecutionContext->parallelForSlots( 0, numBlocks, 1, [&]( const int64_t blockIdx, const uint32_t slot ) {
+            std::vector< uint64_t >& counts = slotDensityCounts[slot];
+            if (counts.empty()) { counts.assign( densityCounts.size(), 0 ); }
+            const int64_t blockEnd = std::min( ( blockIdx + 1 ) * rangeBlockSize, numEntries );
+            for (int64_t i = blockIdx * rangeBlockSize; i < blockEnd; i++) {
+                counts[ densityKey( pTypedVoxels[ i ] ) ]++;
+            }
+        } );
+    } );
+
+    for (const auto& counts : slotDensityCounts) {
+        for (size_t density = 0; density < counts.size(); density++) {
+            densityCounts[ density ] += counts[ density ];
+        }
+    }
+}
+
+void VolumeData::rebinHistogram( const std::vector< uint64_t >& densityCounts, const uint32_t numBuckets ) {
+    mHistogramRange = mMinMaxDensity;
+    mHistogramBuckets.assign( std::max( numBuckets, 1u ), 0 );
+    const uint64_t rangeMin = mHistogramRange[0];
+    const uint64_t rangeWidth = static_cast<uint64_t>( mHistogramRange[1] ) - rangeMin + 1;
+    const uint64_t lastBucketIdx = mHistogramBuckets.size() - 1;
+    for (size_t density = 0; density < densityCounts.size(); density++) {
+        if (densityCounts[ density ] == 0) { continue; }
+        const uint64_t offset = ( density > rangeMin ) ? density - rangeMin : 0;
+        const uint64_t bucketIdx = std::min( offset * mHistogramBuckets.size() / rangeWidth, lastBucketIdx );
+        mHistogramBuckets[ bucketIdx ] += densityCounts[ density ];
+    }
+}
+
+void VolumeData::prepareJointHistogram( const jointHistogramOptions_t& options, jointHistogramAccumulator_t& accumulator ) const {
+    accumulator.options = options;
+    accumulator.options.numMagnitudeBuckets = std::max( options.numMagnitudeBuckets, 1u );
+
+    // the density buckets of rebinHistogram(), looked up per voxel instead of divided
+    const uint64_t rangeMin = mMinMaxDensity[0];
+    const uint64_t rangeWidth = static_cast<uint64_t>( mMinMaxDensity[1] ) - rangeMin + 1;
+    accumulator.densityBuckets.resize( size_t( 1 ) << 16 );
+    for (size_t density = 0; density < accumulator.densityBuckets.size(); density++) {
+        const uint64_t offset = ( density > rangeMin ) ? density - rangeMin : 0;
+        accumulator.densityBuckets[density] = static_cast<uint32_t>( std::min< uint64_t >( offset * options.numDensityBuckets / rangeWidth, options.numDensityBuckets - 1 ) );
+    }
+
+    // The largest magnitude is only known once all gradients are there. The fine bins span the largest magnitude
+    // the kernels can produce at jointHistogramFineFactor times the requested resolution, finishJointHistogram()
+    // merges them in equal groups up to the observed maximum.
+    const float maxMagnitude = maxGradientMagnitude( gradientValueSpan() );
+    accumulator.numFineMagnitudeBins = accumulator.options.numMagnitudeBuckets * jointHistogramFineFactor;
+    accumulator.fineBinsPerMagnitude = accumulator.numFineMagnitudeBins / ( ( options.logMagnitude ) ? log1pf( maxMagnitude ) : maxMagnitude );
+    accumulator.slotCounts.assign( mpExecutionContext->getNumThreads(), std::vector< uint64_t >() );
+}
+
+void VolumeData::accumulateJointHistogramRow( jointHistogramAccumulator_t& accumulator, const uint32_t slot, const void* pVoxels,
+                                              const float* gx, const float* gy, const float* gz, const int32_t count ) const {
+    // allocated by the first row of the slot, like the slot histograms of accumulateDensityCounts()
+    std::vector< uint64_t >& counts = accumulator.slotCounts[slot];
+    const size_t numDensityBuckets = accumulator.options.numDensityBuckets;
+    if (counts.empty()) { counts.assign( accumulator.numFineMagnitudeBins * numDensityBuckets, 0 ); }
 
-#pragma omp parallel for schedule(dynamic, 1)		// OpenMP 
-    for ( int64_t i = 0; i < mNumHistogramBuckets; i++ ) {
-        mHistogramBucketsAtomic[ i ].store(0u);
+    const uint32_t lastFineBin = accumulator.numFineMagnitudeBins - 1;
+    visitVoxelType( [&]( auto voxelTag ) {
+        const auto* const pTypedVoxels = static_cast< const decltype( voxelTag )* >( pVoxels );
+        for (int32_t x = 0; x < count; x++) {
+            const float magnitude = sqrtf( gx[x] * gx[x] + gy[x] * gy[x] + gz[x] * gz[x] );
+            const float scaledMagnitude = ( ( accumulator.options.logMagnitude ) ? log1pf( magnitude ) : magnitude ) * accumulator.fineBinsPerMagnitude;
+            const uint32_t fineBin = std::min( static_cast<uint32_t>( scaledMagnitude ), lastFineBin );
+            counts[ fineBin * numDensityBuckets + accumulator.densityBuckets[ densityKey( pTypedVoxels[x] ) ] ]++;
+        }
+    } );
+}
+
+void VolumeData::finishJointHistogram( const jointHistogramAccumulator_t& accumulator ) {
+    const uint32_t numDensityBuckets = accumulator.options.numDensityBuckets;
+    const uint32_t numFineBins = accumulator.numFineMagnitudeBins;
+    std::vector< uint64_t > fineCounts( static_cast<size_t>( numFineBins ) * numDensityBuckets, 0 );
+    for (const auto& counts : accumulator.slotCounts) {
+        for (size_t i = 0; i < counts.size(); i++) { fineCounts[i] += counts[i]; }
     }
 
-#pragma omp parallel for schedule(dynamic, 1)		// OpenMP 
-    for ( int64_t i = 0; i < numVoxels; i++ ) {
-        const auto density = mDensities[ i ];
-        const auto bucketIdx = density / mHistogramDensitiesPerBucket;
-        mHistogramBucketsAtomic[ bucketIdx ]++;
+    uint32_t numUsedFineBins = 1;
+    for (uint32_t fineBin = numFineBins; fineBin > 0; fineBin--) {
+        const uint64_t* const pFineRow = fineCounts.data() + static_cast<size_t>( fineBin - 1 ) * numDensityBuckets;
+        if (std::any_of( pFineRow, pFineRow + numDensityBuckets, []( const uint64_t count ) { return count > 0; } )) {
+            numUsedFineBins = fineBin;
+            break;
+        }
     }
+    // every bucket merges the same number of fine bins, uneven groups would show up as stripes
+    const uint32_t numMagnitudeBuckets = accumulator.options.numMagnitudeBuckets;
+    const uint32_t fineBinsPerBucket = ( numUsedFineBins + numMagnitudeBuckets - 1 ) / numMagnitudeBuckets;
+    const float maxScaledMagnitude = static_cast<float>( fineBinsPerBucket * numMagnitudeBuckets ) / accumulator.fineBinsPerMagnitude;
 
-#pragma omp parallel for schedule(dynamic, 1)		// OpenMP 
-    for ( int64_t i = 0; i < mNumHistogramBuckets; i++ ) {
-        mHistogramBuckets[ i ] = mHistogramBucketsAtomic[ i ];
+    mJointHistogram.numDensityBuckets = numDensityBuckets;
+    mJointHistogram.numMagnitudeBuckets = numMagnitudeBuckets;
+    mJointHistogram.logMagnitude = accumulator.options.logMagnitude;
+    mJointHistogram.densityRange = mMinMaxDensity;
+    mJointHistogram.maxMagnitude = ( accumulator.options.logMagnitude ) ? expm1f( maxScaledMagnitude ) : maxScaledMagnitude;
+    mJointHistogram.counts.assign( static_cast<size_t>( numMagnitudeBuckets ) * numDensityBuckets, 0 );
+    for (uint32_t fineBin = 0; fineBin < numUsedFineBins; fineBin++) {
+        uint64_t* const pBucketRow = mJointHistogram.counts.data() + static_cast<size_t>( fineBin / fineBinsPerBucket ) * numDensityBuckets;
+        const uint64_t* const pFineRow = fineCounts.data() + static_cast<size_t>( fineBin ) * numDensityBuckets;
+        for (uint32_t densityBucket = 0; densityBucket < numDensityBuckets; densityBucket++) { pBucketRow[densityBucket] += pFineRow[densityBucket]; }
     }
 }
 
+void VolumeData::calculateJointHistogram( const jointHistogramOptions_t& options ) {
+    mJointHistogram = jointHistogram_t{};
+    if (options.numDensityBuckets == 0 || mNumVoxels == 0) { return; }
+    ensureAllNormals();
+
+    jointHistogramAccumulator_t accumulator;
+    prepareJointHistogram( options, accumulator );
+
+    const int32_t dimX = mDim[0];
+    const int32_t dimY = mDim[1];
+    mpExecutionContext->parallelForSlots( 0, static_cast<int64_t>( mDim[2] ), 1, [&]( const int64_t z, const uint32_t slot ) {
+        std::vector< uint8_t > voxelRow( dimX * voxelSize() );
+        std::vector< float > gradientRow( 3 * static_cast<size_t>( dimX ) );
+        float* const gx = gradientRow.data();
+        float* const gy = gx + dimX;
+        float* const gz = gy + dimX;
+        for (int32_t y = 0; y < dimY; y++) {
+            gatherDensityRow( 0, dimX, y, static_cast<int32_t>( z ), voxelRow.data() );
+            const uint64_t rowAddr = calcAddr( 0, y, static_cast<int32_t>( z ) );
+            for (int32_t x = 0; x < dimX; x++) {
+                const vec3_t gradient = getNormal( rowAddr + x );
+                gx[x] = gradient[0];
+                gy[x] = gradient[1];
+                gz[x] = gradient[2];
+            }
+            accumulateJointHistogramRow( accumulator, slot, voxelRow.data(), gx, gy, gz, dimX );
+        }
+    } );
+    finishJointHistogram( accumulator );
+}
+
 void VolumeData::getBoundingSphere( vec4_t& boundingSphere ) {
     const float hx = mDim[0] * 0.5f;
     const float hy = mDim[1] * 0.5f;
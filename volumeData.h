@@ -2,13 +2,26 @@
 #define _VOLUMEDATA_H_EA89F308_240F_4AE0_97B5_AFE55000B453
 
 #include "eRetVal_FileLoader.h"
+#include "arrayView.h"
+#include "mappedFile.h"
+#include "defaultInitAllocator.h"
+#include "executionContext.h"
+#include "volumeGradientCache.h"
 
 // https://stackoverflow.com/questions/7597025/difference-between-stdint-h-and-inttypes-h
 #include <stdint.h>
+#include <math.h>
 
 #include <string>
 #include <vector>
 #include <array>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <chrono>
 
 namespace FileLoader{
     struct VolumeData {
@@ -17,6 +30,8 @@ namespace FileLoader{
         using u16vec3_t = std::array<uint16_t, 3>;
         using u32vec2_t = std::array<uint32_t, 2>;
         using u32vec3_t = std::array<uint32_t, 3>;
+        using i32vec3_t = std::array<int32_t, 3>;
+        using vec2_t = std::array<float, 2>;
         using vec3_t = std::array<float, 3>;
         using vec4_t = std::array<float, 4>;
 
@@ -25,47 +40,570 @@ namespace FileLoader{
             SOBEL_3D            = 1,
         };
 
+        // type of the voxels that follow the 3 x uint16_t dimensions in a .dat file; the voxels are kept at this width
+        enum class voxelType_t {
+            UINT16          = 0,
+            UINT8           = 1,
+            FLOAT32         = 2, // the range, histograms and min/max tree work on 16 bit density keys, see getValueRange()
+        };
+
+        enum class densityStorage_t {
+            IN_MEMORY       = 0, // voxels are read into a std::vector
+            MEMORY_MAPPED   = 1, // voxels are a copy-on-write view of the mapped file, pages are faulted in by the passes that need them
+        };
+
+        enum class densityLayout_t {
+            LINEAR          = 0, // x-fastest over the whole volume, the addresses are calcAddr()
+            BRICKED         = 1, // bricks of mDensityBrickSize^3 voxels in x-fastest brick order, x-fastest inside a brick; 
+                                 // the volume is padded to whole bricks, the addresses are calcDensityAddr()
+        };
+
+        enum class normalStorage_t {
+            FLOAT3          = 0, // 3 floats, 12 bytes per voxel
+            OCTAHEDRAL_16   = 1, // 2x16 bit octahedral direction + 16 bit magnitude, 6 bytes per voxel
+        };
+
+        // octahedral u, octahedral v, quantized magnitude; decode with decodeNormal()
+        using packedNormal_t = std::array<uint16_t, 3>;
+
+        enum class gradientEvaluation_t {
+            EAGER           = 0, // all normals are computed up front
+            LAZY_BRICKS     = 1, // normals are computed per brick of mNormalBrickSize^3 voxels when fetchNormal() / ensureNormals() first touch it
+        };
+
+        enum class mipFilter_t {
+            BOX             = 0, // rounded mean of the 2x2x2 voxels
+            MAX             = 1, // maximum of the 2x2x2 voxels, keeps thin bright structures visible in previews
+        };
+
+        struct jointHistogramOptions_t {
+            uint32_t                numDensityBuckets   = 0; // 0: no joint histogram
+            uint32_t                numMagnitudeBuckets = 256;
+            bool                    logMagnitude        = false; // buckets equally wide in log( 1 + |gradient| ) instead of |gradient|
+        };
+
+        struct loadOptions_t {
+            densityStorage_t        densityStorage      = densityStorage_t::IN_MEMORY;
+            normalStorage_t         normalStorage       = normalStorage_t::FLOAT3;
+            gradientEvaluation_t    gradientEvaluation  = gradientEvaluation_t::EAGER;
+            densityLayout_t         densityLayout       = densityLayout_t::LINEAR; // BRICKED is converted on load, so it is always IN_MEMORY
+            uint32_t                numHistogramBuckets = 0; // > 0: the load calculates the histogram as well, see calculateHistogramBuckets()
+            // Normals, range and histogram are taken from this cache if it has them for the file and mode, otherwise eager loads 
+            // store them there. nullptr: no cache
+            std::shared_ptr< const GradientCache > pGradientCache;
+            // > 0: the densities are downsampled mipLevel times while they are read, the full resolution is never resident;
+            // the result equals getMipLevel( mipLevel ) of buildMipChain( mipFilter ). Always LINEAR and IN_MEMORY, not cached.
+            uint32_t                mipLevel            = 0;
+            mipFilter_t             mipFilter           = mipFilter_t::BOX;
+            // the load calculates the joint histogram of density and gradient magnitude as well, see getJointHistogram()
+            jointHistogramOptions_t jointHistogram;
+            // BRICKED takes UINT16 only (ERROR otherwise), the other types bypass pGradientCache; 
+            // FLOAT32 is always read IN_MEMORY, behind the 6 byte header its voxels are not aligned in a mapping
+            voxelType_t             voxelType           = voxelType_t::UINT16;
+        };
+
+        // threads used by all parallel passes, ExecutionContext::getDefault() unless set
+        inline void setExecutionContext( std::shared_ptr< const ExecutionContext > pExecutionContext ) { 
+            mpExecutionContext = ( pExecutionContext ) ? std::move( pExecutionContext ) : ExecutionContext::getDefault(); 
+        }
+        inline const std::shared_ptr< const ExecutionContext >& getExecutionContext() const { return mpExecutionContext; }
+
         eRetVal load( const std::string& fileUrl, const gradientMode_t mode );
+        eRetVal load( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options );
+
+        // voxel box [boxMin, boxMax) of a file, clamped to its dimensions
+        struct roi_t {
+            i32vec3_t   boxMin;
+            i32vec3_t   boxMax;
+        };
+        // Loads only the voxels of the box, the result is a volume of the box size. The rows of the box plus a halo of 
+        // one voxel are copied out of a mapping of the file, so only their pages are read; range, histogram and min/max 
+        // tree cover the box, its border gradients read the halo and equal those of a full load (the magnitude scale 
+        // of packed normals covers the halo as well). Of the options only voxelType, normalStorage, numHistogramBuckets 
+        // and jointHistogram apply; ERROR unless densityLayout is LINEAR, densityStorage IN_MEMORY, gradientEvaluation 
+        // EAGER, mipLevel 0 and pGradientCache nullptr. ERROR as well if the file is unreadable or truncated, or the 
+        // clamped box is empty.
+        eRetVal load( const std::string& fileUrl, const roi_t& roi, const gradientMode_t mode );
+        eRetVal load( const std::string& fileUrl, const roi_t& roi, const gradientMode_t mode, const loadOptions_t& options );
+
+        // progress and cancellation of a load, shared between the loading thread and its asyncLoad_t handles
+        struct loadState_t {
+            std::atomic< bool >     cancelled{ false };
+            std::atomic< int32_t >  numPlanes{ 0 };     // 0 until the header was read
+            std::atomic< int32_t >  numPlanesRead{ 0 };
+            std::atomic< int32_t >  numPlanesDone{ 0 }; // planes with range, histogram and normals
+        };
+
+        // handle of a load started by loadAsync(), copies refer to the same load
+        class asyncLoad_t {
+        public:
+            inline bool valid() const { return mResult.valid(); }
+            // blocks until the load has finished; ERROR if it failed or was cancelled
+            inline eRetVal wait() const { return mResult.get(); }
+            inline bool isReady() const { return mResult.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready; }
+            // the load stops before its next chunk and leaves the VolumeData empty
+            inline void cancel() { if (mpState) { mpState->cancelled.store( true ); } }
+            // fraction of the planes that were read and processed, in [0, 1]
+            inline float getProgress() const {
+                const int32_t numPlanes = ( mpState ) ? mpState->numPlanes.load() : 0;
+                if (numPlanes == 0) { return 0.0f; }
+                return static_cast<float>( mpState->numPlanesRead.load() + mpState->numPlanesDone.load() ) / ( 2.0f * numPlanes );
+            }
+
+        private:
+            friend struct VolumeData;
+            std::shared_ptr< loadState_t >  mpState;
+            std::shared_future< eRetVal >   mResult; // destroyed first: the last handle waits for the load
+        };
+
+        // load() on a thread of its own. The VolumeData must neither be accessed nor destroyed before wait() returned
+        // (or isReady() is true); dropping the last handle waits for the load to finish.
+        asyncLoad_t loadAsync( const std::string& fileUrl, const gradientMode_t mode );
+        asyncLoad_t loadAsync( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options );
         
-        void calculateNormals( const gradientMode_t mode );
+        void calculateNormals( const gradientMode_t mode, 
+                               const normalStorage_t normalStorage = normalStorage_t::FLOAT3, 
+                               const gradientEvaluation_t gradientEvaluation = gradientEvaluation_t::EAGER );
+        // also accumulates the joint histogram in the gradient pass if jointHistogram.numDensityBuckets > 0; 
+        // with LAZY_BRICKS all bricks are computed then, the histogram needs every gradient anyway
+        void calculateNormals( const gradientMode_t mode, const normalStorage_t normalStorage, const gradientEvaluation_t gradientEvaluation,
+                               const jointHistogramOptions_t& jointHistogram );
         gradientMode_t getGradientMode() const { return mGradientMode; }
+        normalStorage_t getNormalStorage() const { return mNormalStorage; }
+
+        static constexpr int32_t    mNormalBrickSize = 32;
+
+        // Computes all normal bricks overlapping the voxel box [boxMin, boxMax) that are not resident yet.
+        // Safe to call concurrently; a brick that another thread is computing is waited for.
+        void ensureNormals( const i32vec3_t& boxMin, const i32vec3_t& boxMax );
+        void ensureAllNormals() { ensureNormals( i32vec3_t{ 0, 0, 0 }, i32vec3_t{ mDim[0], mDim[1], mDim[2] } ); }
+        bool isNormalBrickResident( const int32_t brickX, const int32_t brickY, const int32_t brickZ ) const;
+        // like getNormal( calcAddr( x, y, z ) ), but computes the enclosing brick first if it is not resident yet
+        vec3_t fetchNormal( const int32_t x, const int32_t y, const int32_t z );
         
-        void calculateHistogramBuckets();
+        // Histogram over the density range getMinMaxDensity() at the time of the call, split into numBuckets equally wide 
+        // buckets; density d falls into bucket ( d - min ) * numBuckets / ( max - min + 1 ), densities below the range 
+        // (i.e. 0, which the range skips) are counted in the first bucket.
+        void calculateHistogramBuckets( const uint32_t numBuckets = mDefaultNumHistogramBuckets );
+
+        // Joint histogram of density and gradient magnitude for 2D transfer function editors. The density axis is bucketed 
+        // like calculateHistogramBuckets(), the magnitude axis covers [0, maxMagnitude), which is the observed maximum 
+        // rounded up to an eighth of the largest magnitude the gradient kernels can produce.
+        struct jointHistogram_t {
+            uint32_t                numDensityBuckets   = 0;
+            uint32_t                numMagnitudeBuckets = 0;
+            bool                    logMagnitude        = false;
+            u16vec2_t               densityRange        = { 0, 0 };
+            float                   maxMagnitude        = 0.0f;
+            std::vector< uint64_t > counts; // numDensityBuckets per magnitude bucket, i.e. [ magnitudeBucket * numDensityBuckets + densityBucket ]
+        };
+        // Computes the joint histogram from the current normals, computing missing lazy bricks first. Loads and calculateNormals() 
+        // given jointHistogramOptions_t accumulate it while they compute the gradients, without a second pass over the normals.
+        void calculateJointHistogram( const jointHistogramOptions_t& options );
+        inline const jointHistogram_t& getJointHistogram() const { return mJointHistogram; }
+
+        //-- out-of-core gradients: the .dat file is read in z-slabs (plus one halo plane on each side), only one slab 
+        //   of densities and normals is resident at any time
+
+        // header of the gradient files written by streamGradientsToFile(), followed by the normals of all voxels in calcAddr() order
+        struct gradientFileHeader_t {
+            char        magic[4];       // "VGRD"
+            uint16_t    dim[3];
+            uint8_t     gradientMode;   // gradientMode_t
+            uint8_t     normalStorage;  // normalStorage_t
+            float       magnitudeScale; // OCTAHEDRAL_16 only, see getNormalMagnitudeScale()
+        };
+        static_assert( sizeof( gradientFileHeader_t ) == 16, "the gradient file header is written as is" );
+
+        struct streamOptions_t {
+            normalStorage_t normalStorage   = normalStorage_t::FLOAT3;
+            int32_t         slabDepth       = 64;   // z-planes per slab, peak memory is ~ ( slabDepth + 2 ) * dimX * dimY * ( 2 + bytes per normal )
+            uint16_t        maxDensity      = 0;    // OCTAHEDRAL_16: bound of the densities for the magnitude scale, 0: 65535 (the range is not known up front)
+        };
+
+        // pNormals holds numPlanes * dimX * dimY normals (vec3_t or packedNormal_t, see header.normalStorage) of the planes 
+        // [z0, z0 + numPlanes); the slabs arrive in z order, returning false cancels the stream. A volume of dimZ 0
+        // has a single slab with numPlanes 0 and pNormals nullptr, so the callback always sees the header
+        using gradientSlabCallback_t = std::function< bool( const gradientFileHeader_t& header, const int32_t z0, const int32_t numPlanes, 
+                                                            const void* pNormals, const size_t numBytes ) >;
+
+        // ERROR for unreadable or truncated files and if the callback cancelled
+        static eRetVal streamGradients( const std::string& fileUrl, const gradientMode_t mode, const streamOptions_t& options, 
+                                        const gradientSlabCallback_t& slabCallback, 
+                                        std::shared_ptr< const ExecutionContext > pExecutionContext = nullptr );
+        static eRetVal streamGradientsToFile( const std::string& fileUrl, const gradientMode_t mode, const streamOptions_t& options, 
+                                              const std::string& gradientFileUrl, 
+                                              std::shared_ptr< const ExecutionContext > pExecutionContext = nullptr );
         
         void getBoundingSphere( vec4_t& boundingSphere );
         inline u16vec3_t getDim() const { return mDim; }
 
-        inline std::vector< uint16_t >& getDensities() { return mDensities; }
-        inline const std::vector< uint16_t >& getDensities() const { return mDensities; }
+        inline voxelType_t getVoxelType() const { return mVoxelType; }
+        static inline size_t getVoxelSize( const voxelType_t voxelType ) { 
+            return ( voxelType == voxelType_t::UINT8 ) ? sizeof( uint8_t ) : ( voxelType == voxelType_t::FLOAT32 ) ? sizeof( float ) : sizeof( uint16_t ); 
+        }
+
+        // the raw density storage in storage order (including the brick padding for densityLayout_t::BRICKED), 
+        // copies of a memory-mapped VolumeData share the mapping; empty unless voxelType_t::UINT16
+        inline ArrayView< uint16_t > getDensities() { return getVoxels< uint16_t >(); }
+        inline ArrayView< const uint16_t > getDensities() const { return getVoxels< uint16_t >(); }
+        // getDensities() for any voxel type, empty if voxel_T is not the type of the volume
+        template< typename voxel_T >
+        inline ArrayView< voxel_T > getVoxels() { 
+            return ArrayView< voxel_T >( voxelData< voxel_T >(), ( voxelTypeOf( static_cast< const voxel_T* >( nullptr ) ) == mVoxelType ) ? numDensityEntries() : 0 ); 
+        }
+        template< typename voxel_T >
+        inline ArrayView< const voxel_T > getVoxels() const { 
+            const ArrayView< voxel_T > voxels = const_cast< VolumeData* >( this )->getVoxels< voxel_T >();
+            return ArrayView< const voxel_T >( voxels.data(), voxels.size() );
+        }
+        inline densityStorage_t getDensityStorage() const { return ( mpDensityMapping ) ? densityStorage_t::MEMORY_MAPPED : densityStorage_t::IN_MEMORY; }
+        inline densityLayout_t getDensityLayout() const { return mDensityLayout; }
 
-        inline std::vector< vec3_t >& getNormals() { return mNormals; }
-        inline const std::vector< vec3_t >& getNormals() const { return mNormals; }
+        static constexpr int32_t    mDensityBrickSizeLog2 = 4;
+        static constexpr int32_t    mDensityBrickSize = 1 << mDensityBrickSizeLog2;
 
+        // storage address of a voxel in getDensities(), calcAddr() for densityLayout_t::LINEAR
+        inline uint64_t calcDensityAddr( const int32_t x, const int32_t y, const int32_t z ) const {
+            if (mDensityLayout == densityLayout_t::LINEAR) { return calcAddr( x, y, z ); }
+            constexpr int32_t mask = mDensityBrickSize - 1;
+            const uint64_t brickIdx = ( static_cast<uint64_t>( z >> mDensityBrickSizeLog2 ) * mNumDensityBricks[1] + ( y >> mDensityBrickSizeLog2 ) ) * mNumDensityBricks[0] + ( x >> mDensityBrickSizeLog2 );
+            return ( brickIdx << ( 3 * mDensityBrickSizeLog2 ) ) + ( ( ( ( z & mask ) << mDensityBrickSizeLog2 ) + ( y & mask ) ) << mDensityBrickSizeLog2 ) + ( x & mask );
+        }
+        // voxelType_t::UINT16 only
+        inline uint16_t getDensity( const int32_t x, const int32_t y, const int32_t z ) const { return densityData()[ calcDensityAddr( x, y, z ) ]; }
+        inline uint16_t getDensityClamped( const int32_t x, const int32_t y, const int32_t z ) const { return getDensity( xClamp( x ), yClamp( y ), zClamp( z ) ); }
+        // the voxel of any type
+        inline float getVoxelValue( const int32_t x, const int32_t y, const int32_t z ) const {
+            const uint64_t addr = calcDensityAddr( x, y, z );
+            if (mVoxelType == voxelType_t::UINT8) { return voxelData< uint8_t >()[addr]; }
+            if (mVoxelType == voxelType_t::FLOAT32) { return voxelData< float >()[addr]; }
+            return densityData()[addr];
+        }
+
+        // The densities as a sequence of runs of consecutive x voxels in storage order: the rows of the volume for 
+        // densityLayout_t::LINEAR, the brick rows for densityLayout_t::BRICKED. Runs that lie completely in the 
+        // brick padding are empty, so every pass that touches all voxels can just split the run index range.
+        // voxelType_t::UINT16 only, the other types have no runs.
+        struct densityRun_t {
+            const uint16_t* pDensities;
+            int32_t         count;
+            int32_t         x, y, z; // first voxel of the run
+        };
+        size_t getNumDensityRuns() const;
+        densityRun_t getDensityRun( const size_t runIdx ) const;
+
+        class densityRunIterator_t {
+        public:
+            densityRunIterator_t( const VolumeData* pVolume, const size_t runIdx ) : mpVolume( pVolume ), mRunIdx( runIdx ) {}
+            inline densityRun_t operator*() const { return mpVolume->getDensityRun( mRunIdx ); }
+            inline densityRunIterator_t& operator++() { mRunIdx++; return *this; }
+            inline bool operator==( const densityRunIterator_t& other ) const { return mRunIdx == other.mRunIdx; }
+            inline bool operator!=( const densityRunIterator_t& other ) const { return mRunIdx != other.mRunIdx; }
+        private:
+            const VolumeData*   mpVolume;
+            size_t              mRunIdx;
+        };
+        struct densityRuns_t {
+            const VolumeData* pVolume;
+            inline densityRunIterator_t begin() const { return densityRunIterator_t( pVolume, 0 ); }
+            inline densityRunIterator_t end() const { return densityRunIterator_t( pVolume, pVolume->getNumDensityRuns() ); }
+        };
+        // for (const auto& run : volume.getDensityRuns()) { ... }
+        inline densityRuns_t getDensityRuns() const { return densityRuns_t{ this }; }
+
+        // the normal storages are not zeroed on allocation, with gradientEvaluation_t::LAZY_BRICKS only resident bricks are valid
+        using normalVector_t = std::vector< vec3_t, DefaultInitAllocator< vec3_t > >;
+        using packedNormalVector_t = std::vector< packedNormal_t, DefaultInitAllocator< packedNormal_t > >;
+
+        // Only filled for normalStorage_t::FLOAT3. The normals of a gradient cache hit are a copy-on-write view of the 
+        // mapped cache entry, copies of such a VolumeData share the mapping.
+        inline ArrayView< vec3_t > getNormals() { return ArrayView< vec3_t >( normalData(), numNormals( normalStorage_t::FLOAT3 ) ); }
+        inline ArrayView< const vec3_t > getNormals() const { return ArrayView< const vec3_t >( normalData(), numNormals( normalStorage_t::FLOAT3 ) ); }
+
+        // only filled for normalStorage_t::OCTAHEDRAL_16
+        inline ArrayView< const packedNormal_t > getPackedNormals() const { 
+            return ArrayView< const packedNormal_t >( packedNormalData(), numNormals( normalStorage_t::OCTAHEDRAL_16 ) ); 
+        }
+        // packed magnitude = round( |gradient| * scale ), the scale is derived from the density range so that no gradient can saturate
+        inline float getNormalMagnitudeScale() const { return mNormalMagnitudeScale; }
+
+        vec3_t decodeNormal( const packedNormal_t& packedNormal ) const;
+        // unpacked gradient at the given voxel address, independent of the normal storage
+        vec3_t getNormal( const uint64_t addr ) const;
+
+        // [0, 65535] for voxelType_t::FLOAT32, the range of the density keys
         inline const u16vec2_t& getMinMaxDensity() const { return mMinMaxDensity; }
+        // Range of the voxel values, getMinMaxDensity() for the integer types. For FLOAT32 the smallest and the largest 
+        // value (NaN skipped), which the 16 bit density keys span: key = round( ( value - min ) * 65535 / ( max - min ) ).
+        inline const vec2_t& getValueRange() const { return mValueRange; }
+        // recomputes getMinMaxDensity() and getValueRange() from the current voxels, e.g. after they were modified through 
+        // getVoxels(); the minimum of the integer types skips density 0. The normals (and the magnitude scale of packed 
+        // normals) are left as they are.
+        void computeRange();
+
+        //-- mip chain: level l + 1 halves every dimension of level l (rounded up), odd last planes, rows and columns 
+        //   are reduced with themselves; every level has its own range, min/max tree and eager normals 
+
+        // builds the levels 1 to numLevels, numLevels == 0: down to a single voxel; normals as getGradientMode() and getNormalStorage()
+        void buildMipChain( const mipFilter_t filter, const uint32_t numLevels = 0 );
+        inline size_t getNumMipLevels() const { return mMipLevels.size() + 1; }
+        // level 0 is the volume itself
+        inline const VolumeData& getMipLevel( const size_t level ) const { return ( level == 0 ) ? *this : mMipLevels[level - 1]; }
+        inline VolumeData& getMipLevel( const size_t level ) { return ( level == 0 ) ? *this : mMipLevels[level - 1]; }
+
+        //-- min/max tree for empty-space skipping, built by every load
+        
+        static constexpr int32_t    mMacroCellSizeLog2 = 3;
+        static constexpr int32_t    mMacroCellSize = 1 << mMacroCellSizeLog2;
+
+        // Level 0 has one macro cell per mMacroCellSize^3 voxels, every further level merges 2x2x2 cells of the level below
+        // up to a single cell. A cell of level l with the size s = mMacroCellSize << l holds the density range of the voxels 
+        // [c * s, c * s + s] per axis, one voxel more than it covers, so that the range bounds every trilinear sample and 
+        // every marching cubes cell inside it. Unlike getMinMaxDensity() the minimum includes density 0.
+        // For voxelType_t::FLOAT32 the cells hold density keys, [ceil( key ) - 1, ceil( key )] per value bounds both 
+        // the rounded and the exact keys.
+        struct minMaxLevel_t {
+            i32vec3_t                   numCells;
+            std::vector< u16vec2_t >    minMax; // x-fastest
+        };
+        // rebuilds the tree from the current densities, e.g. after they were modified through getDensities()
+        void computeMinMaxTree();
+        inline size_t getNumMinMaxLevels() const { return mMinMaxLevels.size(); }
+        inline const minMaxLevel_t& getMinMaxLevel( const size_t level ) const { return mMinMaxLevels[level]; }
+        inline const u16vec2_t& getMacroCellMinMax( const size_t level, const int32_t cellX, const int32_t cellY, const int32_t cellZ ) const {
+            const minMaxLevel_t& minMaxLevel = mMinMaxLevels[level];
+            return minMaxLevel.minMax[ ( static_cast<size_t>( cellZ ) * minMaxLevel.numCells[1] + cellY ) * minMaxLevel.numCells[0] + cellX ];
+        }
+        // false if no density in [densityMin, densityMax] occurs in the voxel box [boxMin, boxMax) or in between its voxels,
+        // true if it may; the tree is descended from the top, only cells that overlap the box and the interval are visited
+        bool mayContainDensities( const i32vec3_t& boxMin, const i32vec3_t& boxMax, const uint16_t densityMin, const uint16_t densityMax ) const;
+
+        //-- batched trilinear sampling
+
+        // Trilinearly interpolated densities (voxel values for FLOAT32) at count positions given as structure of arrays (px[i], py[i], pz[i]) in voxel
+        // coordinates, i.e. voxel (x, y, z) is at integer coordinates; positions are clamped to [0, dim - 1] per axis, NaN to 0.
+        // If pGradientX is given, pGradientX/Y/Z receive the gradient of the interpolant at the clamped position (density
+        // units per voxel, like getNormal(), but from the densities directly and not continuous across voxel faces).
+        // The corners are fetched with SIMD gathers (AVX2) for the LINEAR layout; the result is the same on all SIMD levels.
+        // Only reads the densities, so any number of threads may sample concurrently.
+        void sampleTrilinear( const float* px, const float* py, const float* pz, const size_t count, float* pDensities,
+                              float* pGradientX = nullptr, float* pGradientY = nullptr, float* pGradientZ = nullptr ) const;
+
+        //-- isosurface extraction (volumeIsosurface.cpp)
+
+        // indexed triangle mesh in the layout of StlModel
+        struct isosurface_t {
+            std::vector< float >    coords;     // xyz per vertex, in voxel coordinates
+            std::vector< float >    normals;    // xyz per vertex, the negated normalized gradient, i.e. pointing towards lower densities
+            std::vector< uint32_t > indices;    // three per triangle, counterclockwise seen from the side the normals point to
+        };
+        // Marching cubes surface between the densities >= isoValue and those below it (NaN voxels are below). Vertices on cell edges are shared
+        // by all triangles that use them, the mesh is closed except where it leaves the volume. The volume is processed
+        // in z-slabs in parallel, macro cells whose density range does not straddle isoValue are skipped. Lazily evaluated
+        // normal bricks the surface passes through are computed. ERROR if there are more than 2^32 - 1 vertices.
+        eRetVal extractIsosurface( const float isoValue, isosurface_t& isosurface );
+
+        inline int32_t xClamp( const int32_t x ) const { return std::min( std::max( x, 0 ), mDim[0] - 1 ); }
+        inline int32_t yClamp( const int32_t y ) const { return std::min( std::max( y, 0 ), mDim[1] - 1 ); }
+        inline int32_t zClamp( const int32_t z ) const { return std::min( std::max( z, 0 ), mDim[2] - 1 ); }
+        inline int32_t dimClamp( const int32_t coord, const int32_t dimIdx ) const { return std::min( std::max( coord, 0 ), mDim[dimIdx] - 1 ); }
 
-        inline int32_t xClamp( const int32_t x ) { return std::min( std::max( x, 0 ), mDim[0] - 1 ); }
-        inline int32_t yClamp( const int32_t y ) { return std::min( std::max( y, 0 ), mDim[1] - 1 ); }
-        inline int32_t zClamp( const int32_t z ) { return std::min( std::max( z, 0 ), mDim[2] - 1 ); }
-        inline int32_t dimClamp( const int32_t coord, const int32_t dimIdx ) { return std::min( std::max( coord, 0 ), mDim[dimIdx] - 1 ); }
+        // voxel addresses are 64 bit, anything beyond ~1625^3 voxels does not fit into 32 bits
+        inline uint64_t calcAddr( const int32_t x, const int32_t y, const int32_t z ) const { return ( static_cast<uint64_t>( z ) * mDim[1] + y ) * mDim[0] + x; }
+        inline uint64_t calcAddrClamped( const int32_t x, const int32_t y, const int32_t z ) const { return calcAddr( xClamp( x ), yClamp( y ), zClamp( z ) ); }
 
-        inline uint32_t calcAddr( const int32_t x, const int32_t y, const int32_t z ) { return (z * mDim[1] + y)* mDim[0] + x; }
-        inline uint32_t calcAddrClamped( const int32_t x, const int32_t y, const int32_t z ) { return (zClamp(z) * mDim[1] + yClamp(y))* mDim[0] + xClamp(x); }
+        // 32-bit fast path for per-sample addressing, only valid if is32BitAddressable()
+        inline bool is32BitAddressable() const { return mNumVoxels <= std::numeric_limits< uint32_t >::max(); }
+        inline uint32_t calcAddr32( const int32_t x, const int32_t y, const int32_t z ) const { return ( static_cast<uint32_t>( z ) * mDim[1] + y ) * mDim[0] + x; }
+        inline uint32_t calcAddrClamped32( const int32_t x, const int32_t y, const int32_t z ) const { return calcAddr32( xClamp( x ), yClamp( y ), zClamp( z ) ); }
 
-        static constexpr uint32_t   mNumHistogramBuckets = 1024;
-        static constexpr uint32_t   mHistogramDensitiesPerBucket = 4096 / mNumHistogramBuckets;
-        const std::array< uint32_t, mNumHistogramBuckets >& getHistoBuckets() const { return mHistogramBuckets; }
+        inline size_t getNumVoxels() const { return mNumVoxels; }
+
+        static constexpr uint32_t   mDefaultNumHistogramBuckets = 1024;
+        const std::vector< uint64_t >& getHistoBuckets() const { return mHistogramBuckets; }
+        // density range the buckets were computed for, see calculateHistogramBuckets()
+        inline const u16vec2_t& getHistogramRange() const { return mHistogramRange; }
 
     private:
-        void sobelGradients();
-        void centralDifferencesGradients();
+        static constexpr size_t     mFileHeaderSize = 3 * sizeof( uint16_t );
+
+        static constexpr voxelType_t voxelTypeOf( const uint8_t* ) { return voxelType_t::UINT8; }
+        static constexpr voxelType_t voxelTypeOf( const uint16_t* ) { return voxelType_t::UINT16; }
+        static constexpr voxelType_t voxelTypeOf( const float* ) { return voxelType_t::FLOAT32; }
+        inline size_t voxelSize() const { return getVoxelSize( mVoxelType ); }
+
+        // calls func( voxel_T() ) for the voxel type of the volume, the typed passes are generic lambdas
+        template< typename func_T >
+        inline auto visitVoxelType( func_T&& func ) const -> decltype( func( uint16_t() ) ) {
+            if (mVoxelType == voxelType_t::UINT8) { return func( uint8_t() ); }
+            if (mVoxelType == voxelType_t::FLOAT32) { return func( float() ); }
+            return func( uint16_t() );
+        }
+
+        template< typename voxel_T >
+        inline voxel_T* voxelData() { return reinterpret_cast< voxel_T* >( ( mpDensityMapping ) ? mpDensityMapping->data() + mFileHeaderSize : mVoxels.data() ); }
+        template< typename voxel_T >
+        inline const voxel_T* voxelData() const { return const_cast< VolumeData* >( this )->voxelData< voxel_T >(); }
+        inline uint16_t* densityData() { return voxelData< uint16_t >(); }
+        inline const uint16_t* densityData() const { return voxelData< uint16_t >(); }
+        inline size_t numDensityEntries() const { return ( mDensityLayout == densityLayout_t::LINEAR ) ? mNumVoxels : mVoxels.size() / voxelSize(); }
+
+        // FLOAT32: the density key of a value before rounding, in [0, 65535], NaN: 0
+        inline double densityKeyOf( const float value ) const {
+            const double key = ( static_cast<double>( value ) - mValueRange[0] ) * mDensityKeyScale;
+            return ( key > 0.0 ) ? std::min( key, 65535.0 ) : 0.0;
+        }
+        inline uint16_t densityKey( const uint8_t density ) const { return density; }
+        inline uint16_t densityKey( const uint16_t density ) const { return density; }
+        inline uint16_t densityKey( const float value ) const { return static_cast<uint16_t>( densityKeyOf( value ) + 0.5 ); }
+        // range of the keys of a macro cell whose voxels span [minValue, maxValue], see minMaxLevel_t
+        inline u16vec2_t densityKeyRange( const uint8_t minDensity, const uint8_t maxDensity ) const { return u16vec2_t{ minDensity, maxDensity }; }
+        inline u16vec2_t densityKeyRange( const uint16_t minDensity, const uint16_t maxDensity ) const { return u16vec2_t{ minDensity, maxDensity }; }
+        inline u16vec2_t densityKeyRange( const float minValue, const float maxValue ) const {
+            const double minKey = ceil( densityKeyOf( minValue ) );
+            return u16vec2_t{ static_cast<uint16_t>( ( minKey > 0.0 ) ? minKey - 1.0 : 0.0 ), static_cast<uint16_t>( ceil( densityKeyOf( maxValue ) ) ) };
+        }
+        // bound of the voxel values for the gradient magnitudes: the largest density of the integer types, the width 
+        // of the value range for FLOAT32
+        inline float gradientValueSpan() const {
+            return ( mVoxelType == voxelType_t::FLOAT32 ) ? mValueRange[1] - mValueRange[0] : static_cast<float>( mMinMaxDensity[1] );
+        }
+
+        // the normal vectors, or the mapped gradient cache entry
+        inline vec3_t* normalData() { return ( mpNormalMapping ) ? reinterpret_cast< vec3_t* >( mpNormalMapping->data() + mNormalMappingOffset ) : mNormals.data(); }
+        inline const vec3_t* normalData() const { return const_cast< VolumeData* >( this )->normalData(); }
+        inline packedNormal_t* packedNormalData() { 
+            return ( mpNormalMapping ) ? reinterpret_cast< packedNormal_t* >( mpNormalMapping->data() + mNormalMappingOffset ) : mPackedNormals.data(); 
+        }
+        inline const packedNormal_t* packedNormalData() const { return const_cast< VolumeData* >( this )->packedNormalData(); }
+        inline size_t numNormals( const normalStorage_t normalStorage ) const {
+            if (normalStorage != mNormalStorage) { return 0; }
+            if (mpNormalMapping) { return mNumVoxels; }
+            return ( normalStorage == normalStorage_t::OCTAHEDRAL_16 ) ? mPackedNormals.size() : mNormals.size();
+        }
+
+        // pState == nullptr for the synchronous load()
+        eRetVal loadCached( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState );
+        eRetVal loadImpl( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState );
+        // LINEAR + IN_MEMORY: the planes are read in chunks on a reader thread, while range, histogram and gradients 
+        // are computed for the chunks that already arrived
+        eRetVal loadOverlapped( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState );
+        // loadOptions_t::mipLevel > 0: the planes are read in chunks and reduced level by level as soon as two of a level are there
+        eRetVal loadDownsampled( const std::string& fileUrl, const gradientMode_t mode, const loadOptions_t& options, loadState_t* pState );
+        // releases densities, normals and mip levels
+        void clear();
+
+        eRetVal loadBrickedDensities( const std::string& fileUrl, const densityStorage_t densityStorage );
+        // scatters the linear planes [z0, z0 + numPlanes) into the density bricks, z0 has to be brick aligned
+        void scatterPlanesToBricks( const uint16_t* pPlanes, const int32_t z0, const int32_t numPlanes );
+        // linear copy of the row segment [x0, x0 + count) of row (y, z), works for both layouts; count voxels of any type
+        void gatherDensityRow( const int32_t x0, const int32_t count, const int32_t y, const int32_t z, void* pRow ) const;
+
+        // residency states of the normal bricks; a copyable array of atomics
+        struct brickStates_t {
+            enum : uint8_t { MISSING = 0, COMPUTING = 1, RESIDENT = 2, };
+
+            brickStates_t() = default;
+            brickStates_t( const brickStates_t& other ) { *this = other; }
+            brickStates_t& operator=( const brickStates_t& other ) {
+                if (this != &other) {
+                    reset( other.mCount, MISSING );
+                    for (size_t i = 0; i < mCount; i++) { mpStates[i].store( other.mpStates[i].load() ); }
+                }
+                return *this;
+            }
+            brickStates_t( brickStates_t&& ) = default;
+            brickStates_t& operator=( brickStates_t&& ) = default;
+
+            void reset( const size_t count, const uint8_t state ) {
+                if (count != mCount) {
+                    mpStates.reset( ( count > 0 ) ? new std::atomic< uint8_t >[count] : nullptr );
+                    mCount = count;
+                }
+                for (size_t i = 0; i < mCount; i++) { mpStates[i].store( state, std::memory_order_relaxed ); }
+            }
+            inline std::atomic< uint8_t >& operator[]( const size_t idx ) const { return mpStates[idx]; }
+            inline size_t size() const { return mCount; }
+
+        private:
+            std::unique_ptr< std::atomic< uint8_t >[] > mpStates;
+            size_t                                      mCount = 0;
+        };
+
+        // per-slot counts of the joint histogram at a finer magnitude resolution, rebinned by finishJointHistogram()
+        struct jointHistogramAccumulator_t {
+            jointHistogramOptions_t                 options;
+            uint32_t                                numFineMagnitudeBins = 0;
+            float                                   fineBinsPerMagnitude = 0.0f; // per unit of |gradient| or of log( 1 + |gradient| )
+            std::vector< uint32_t >                 densityBuckets; // per 16 bit density (key)
+            std::vector< std::vector< uint64_t > >  slotCounts;     // [ fineMagnitudeBin * numDensityBuckets + densityBucket ]
+        };
+        void prepareJointHistogram( const jointHistogramOptions_t& options, jointHistogramAccumulator_t& accumulator ) const;
+        // pVoxels: count voxels of the volume's type
+        void accumulateJointHistogramRow( jointHistogramAccumulator_t& accumulator, const uint32_t slot, const void* pVoxels, 
+                                          const float* gx, const float* gy, const float* gz, const int32_t count ) const;
+        void finishJointHistogram( const jointHistogramAccumulator_t& accumulator );
+
+        // Gradients for all voxels in the box [boxMin, boxMax); neighbours outside the box are read, but not written.
+        // With pJointHistogram they are counted into its slot as well.
+        void computeGradients( const i32vec3_t& boxMin, const i32vec3_t& boxMax, 
+                               jointHistogramAccumulator_t* pJointHistogram = nullptr, const uint32_t slot = 0 );
+        void storeNormalRow( const float* gx, const float* gy, const float* gz, const int32_t count, const uint64_t rowAddr );
+        void ensureNormalBrick( const int32_t brickX, const int32_t brickY, const int32_t brickZ );
+        inline size_t brickIndex( const int32_t brickX, const int32_t brickY, const int32_t brickZ ) const {
+            return ( static_cast< size_t >( brickZ ) * mNumNormalBricks[1] + brickY ) * mNumNormalBricks[0] + brickX;
+        }
+
+        // allocates the normal storage and sets up the normal bricks, returns the number of bricks
+        size_t prepareNormals( const gradientMode_t mode, const normalStorage_t normalStorage );
+        void sobelGradients( jointHistogramAccumulator_t* pJointHistogram );
+        void centralDifferencesGradients( jointHistogramAccumulator_t* pJointHistogram );
+
+        // Partial passes of computeRange() and calculateHistogramBuckets() over numEntries raw voxels of the volume's type.
+        // The range starts out as emptyRange() and becomes { smallest non-zero density, largest density } for the integer 
+        // types, { smallest, largest value } for FLOAT32, whose density counts need the final range for the keys.
+        static inline vec2_t emptyRange() { return vec2_t{ std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() }; }
+        void accumulateRange( const void* pVoxels, const int64_t numEntries, vec2_t& range ) const;
+        void setRange( const vec2_t& range );
+        // densityCounts has one counter per 16 bit density (key)
+        void accumulateDensityCounts( const void* pVoxels, const int64_t numEntries, std::vector< uint64_t >& densityCounts ) const;
+        void rebinHistogram( const std::vector< uint64_t >& densityCounts, const uint32_t numBuckets );
+
+        // computeMinMaxTree() in steps: the levels are allocated, the layers [cellZBegin, cellZEnd) of level 0 
+        // are computed once their planes are there, the upper levels at the end
+        void allocateMinMaxTree();
+        void computeMacroCellLayers( const int32_t cellZBegin, const int32_t cellZEnd );
+        void computeMinMaxParents();
+        bool mayContainDensities( const size_t level, const int32_t cellX, const int32_t cellY, const int32_t cellZ, 
+                                  const i32vec3_t& boxMin, const i32vec3_t& boxMax, const uint16_t densityMin, const uint16_t densityMax ) const;
 
+        std::shared_ptr< const ExecutionContext > mpExecutionContext = ExecutionContext::getDefault();
         u16vec3_t                   mDim;
-        std::vector< uint16_t >     mDensities;
-        std::vector< vec3_t >       mNormals;
+        voxelType_t                 mVoxelType = voxelType_t::UINT16;
+        std::vector< uint8_t, DefaultInitAllocator< uint8_t > > mVoxels; // numDensityEntries() voxels of mVoxelType
+        std::shared_ptr< MappedFile > mpDensityMapping;
+        densityLayout_t             mDensityLayout = densityLayout_t::LINEAR;
+        i32vec3_t                   mNumDensityBricks = { 0, 0, 0 };
+        size_t                      mNumVoxels = 0;
+        normalVector_t              mNormals;
+        packedNormalVector_t        mPackedNormals;
+        std::shared_ptr< MappedFile > mpNormalMapping;
+        size_t                      mNormalMappingOffset = 0;
+        i32vec3_t                   mNumNormalBricks = { 0, 0, 0 };
+        brickStates_t               mNormalBrickStates;
+        normalStorage_t             mNormalStorage = normalStorage_t::FLOAT3;
+        float                       mNormalMagnitudeScale = 1.0f;
         std::array< uint16_t, 2 >   mMinMaxDensity;
+        vec2_t                      mValueRange = { 0.0f, 0.0f };
+        double                      mDensityKeyScale = 0.0; // FLOAT32: density keys per unit of value
+        std::vector< minMaxLevel_t > mMinMaxLevels;
+        std::vector< VolumeData >   mMipLevels; // levels 1, 2, ...
         gradientMode_t              mGradientMode = gradientMode_t::SOBEL_3D;
         
-        std::array< uint32_t, mNumHistogramBuckets > mHistogramBuckets;
+        std::vector< uint64_t >     mHistogramBuckets;
+        u16vec2_t                   mHistogramRange = { 0, 0 };
+        jointHistogram_t            mJointHistogram;
     };
 }
 #endif // _VOLUMEDATA_H_EA89F308_240F_4AE0_97B5_AFE55000B453
@@ -0,0 +1,206 @@
+#include "volumeGradientCache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace FileLoader;
+
+namespace {
+    namespace fs = std::filesystem;
+
+    constexpr int64_t hashBlockSize = int64_t( 1 ) << 20; // bytes per task of the hashes
+
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+
+    static inline uint64_t rotl( const uint64_t x, const int32_t r ) { return ( x << r ) | ( x >> ( 64 - r ) ); }
+    static inline uint64_t hashRound( const uint64_t acc, const uint64_t word ) { return rotl( acc + word * prime2, 31 ) * prime1; }
+    static inline uint64_t mergeRound( const uint64_t acc, const uint64_t value ) { return rotl( acc ^ hashRound( 0, value ), 27 ) * prime1 + prime4; }
+    static inline uint64_t avalanche( uint64_t h ) {
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // multiply-rotate rounds of 4 independent lanes, so that the multiplies of consecutive words overlap
+    static uint64_t hashBlock( const uint8_t* pBytes, const size_t numBytes, const uint64_t seed ) {
+        uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+        size_t i = 0;
+        for (; i + 32 <= numBytes; i += 32) {
+            for (int32_t lane = 0; lane < 4; lane++) {
+                uint64_t word;
+                memcpy( &word, pBytes + i + lane * 8, 8 );
+                lanes[lane] = hashRound( lanes[lane], word );
+            }
+        }
+        uint64_t h = rotl( lanes[0], 1 ) + rotl( lanes[1], 7 ) + rotl( lanes[2], 12 ) + rotl( lanes[3], 18 );
+        for (; i + 8 <= numBytes; i += 8) {
+            uint64_t word;
+            memcpy( &word, pBytes + i, 8 );
+            h = mergeRound( h, word );
+        }
+        for (; i < numBytes; i++) {
+            h = rotl( h ^ ( pBytes[i] * prime3 ), 11 ) * prime1;
+        }
+        return avalanche( h ^ numBytes );
+    }
+
+    // the blocks are hashed in parallel and merged in order
+    static uint64_t hashBytes( const void* pData, const size_t numBytes, const ExecutionContext& executionContext ) {
+        const uint8_t* const pBytes = static_cast< const uint8_t* >( pData );
+        const int64_t numBlocks = ( static_cast<int64_t>( numBytes ) + hashBlockSize - 1 ) / hashBlockSize;
+
+        std::vector< uint64_t > blockHashes( numBlocks );
+        executionContext.parallelFor( 0, numBlocks, 1, [&]( const int64_t blockIdx ) {
+            const int64_t blockBegin = blockIdx * hashBlockSize;
+            const size_t blockSize = static_cast<size_t>( std::min( hashBlockSize, static_cast<int64_t>( numBytes ) - blockBegin ) );
+            blockHashes[blockIdx] = hashBlock( pBytes + blockBegin, blockSize, static_cast<uint64_t>( blockIdx ) );
+        } );
+
+        uint64_t h = prime4 ^ numBytes;
+        for (const uint64_t blockHash : blockHashes) { h = mergeRound( h, blockHash ); }
+        return avalanche( h );
+    }
+}
+
+eRetVal GradientCache::hashFile( const std::string& fileUrl, const ExecutionContext& executionContext, uint64_t& hash ) {
+    MappedFile file;
+    if (file.open( fileUrl, MappedFile::accessMode_t::READ_ONLY ) != eRetVal::OK) { return eRetVal::ERROR; }
+    hash = hashBytes( file.data(), file.size(), executionContext );
+    return eRetVal::OK;
+}
+
+eRetVal GradientCache::stampFile( const std::string& fileUrl, fileStamp_t& stamp ) {
+    std::error_code errorCode;
+    stamp.size = fs::file_size( fileUrl, errorCode );
+    if (errorCode) { return eRetVal::ERROR; }
+    stamp.time = static_cast<int64_t>( fs::last_write_time( fileUrl, errorCode ).time_since_epoch().count() );
+    return ( errorCode ) ? eRetVal::ERROR : eRetVal::OK;
+}
+
+uint64_t GradientCache::payloadChecksum( const uint64_t* pBuckets, const size_t numBuckets, const void* pNormals, const size_t numNormalBytes,
+                                         const ExecutionContext& executionContext ) {
+    const uint64_t bucketsHash = hashBytes( pBuckets, numBuckets * sizeof( uint64_t ), executionContext );
+    const uint64_t normalsHash = hashBytes( pNormals, numNormalBytes, executionContext );
+    return avalanche( mergeRound( mergeRound( prime1, bucketsHash ), normalsHash ) );
+}
+
+std::string GradientCache::getEntryUrl( const std::string& volumeUrl, const fileStamp_t& stamp, const uint8_t gradientMode, const uint8_t normalStorage ) const {
+    char suffix[32];
+    snprintf( suffix, sizeof( suffix ), ".%u.%u.vgc", static_cast<uint32_t>( gradientMode ), static_cast<uint32_t>( normalStorage ) );
+    if (mOptions.directory.empty()) { return volumeUrl + suffix; }
+
+    // the directory is shared by all volumes, so the name hashes the absolute path along with the stamp
+    std::error_code errorCode;
+    fs::path absolutePath = fs::absolute( volumeUrl, errorCode );
+    if (errorCode) { absolutePath = volumeUrl; }
+    const std::string pathName = absolutePath.lexically_normal().string();
+    const uint64_t key = avalanche( mergeRound( mergeRound( hashBlock( reinterpret_cast< const uint8_t* >( pathName.data() ), pathName.size(), prime3 ),
+                                                            stamp.size ), static_cast<uint64_t>( stamp.time ) ) );
+    char hashName[32];
+    snprintf( hashName, sizeof( hashName ), "%016llx", static_cast<unsigned long long>( key ) );
+    return ( fs::path( mOptions.directory ) / ( std::string( hashName ) + suffix ) ).string();
+}
+
+eRetVal GradientCache::openEntry( const std::string& entryUrl, const entryHeader_t& key, const size_t numVoxels, const size_t normalSize,
+                                  const ExecutionContext& executionContext, MappedFile& entry ) const {
+    if (entry.open( entryUrl, MappedFile::accessMode_t::COPY_ON_WRITE ) != eRetVal::OK) { return eRetVal::ERROR; } // not cached
+
+    entryHeader_t header;
+    bool valid = ( entry.size() >= sizeof( header ) );
+    if (valid) {
+        memcpy( &header, entry.data(), sizeof( header ) );
+        valid = memcmp( header.magic, "VGRC", 4 ) == 0 && header.version == mVersion && 
+                header.fileSize == key.fileSize && header.fileTime == key.fileTime && header.gradientMode == key.gradientMode && header.normalStorage == key.normalStorage &&
+                memcmp( header.dim, key.dim, sizeof( header.dim ) ) == 0 &&
+                entry.size() == sizeof( header ) + header.numHistogramBuckets * sizeof( uint64_t ) + numVoxels * normalSize;
+    }
+    if (valid && mOptions.verifyEntries) {
+        const uint64_t* const pBuckets = reinterpret_cast< const uint64_t* >( entry.data() + sizeof( header ) );
+        valid = header.contentHash == key.contentHash &&
+                payloadChecksum( pBuckets, header.numHistogramBuckets, pBuckets + header.numHistogramBuckets, numVoxels * normalSize,
+                                 executionContext ) == header.payloadChecksum;
+    }
+
+    std::error_code errorCode;
+    if (!valid) {
+        entry.close();
+        fs::remove( entryUrl, errorCode );
+        return eRetVal::ERROR;
+    }
+    fs::last_write_time( entryUrl, fs::file_time_type::clock::now(), errorCode ); // most recently used for evict()
+    return eRetVal::OK;
+}
+
+eRetVal GradientCache::storeEntry( const std::string& entryUrl, const entryHeader_t& header, const uint64_t* pBuckets,
+                                   const void* pNormals, const size_t numNormalBytes, const ExecutionContext& executionContext ) const {
+    const uint64_t entrySize = sizeof( header ) + header.numHistogramBuckets * sizeof( uint64_t ) + numNormalBytes;
+    std::error_code errorCode;
+    if (!mOptions.directory.empty()) {
+        if (entrySize > mOptions.maxBytes) { return eRetVal::ERROR; }
+        fs::create_directories( mOptions.directory, errorCode );
+    }
+
+    entryHeader_t entryHeader = header;
+    entryHeader.payloadChecksum = payloadChecksum( pBuckets, header.numHistogramBuckets, pNormals, numNormalBytes, executionContext );
+
+    const std::string tempUrl = entryUrl + ".tmp" + std::to_string( std::hash< std::thread::id >()( std::this_thread::get_id() ) );
+    FILE* pFile = fopen( tempUrl.c_str(), "wb" );
+    if (pFile == nullptr) { return eRetVal::ERROR; }
+
+    bool written = fwrite( &entryHeader, sizeof( entryHeader ), 1, pFile ) == 1;
+    written = written && fwrite( pBuckets, sizeof( uint64_t ), header.numHistogramBuckets, pFile ) == header.numHistogramBuckets;
+    written = written && fwrite( pNormals, 1, numNormalBytes, pFile ) == numNormalBytes;
+    written = ( fclose( pFile ) == 0 ) && written;
+
+    if (written) { fs::rename( tempUrl, entryUrl, errorCode ); }
+    if (!written || errorCode) {
+        fs::remove( tempUrl, errorCode );
+        return eRetVal::ERROR;
+    }
+
+    evict( entryUrl );
+    return eRetVal::OK;
+}
+
+void GradientCache::evict( const std::string& keepUrl ) const {
+    if (mOptions.directory.empty()) { return; }
+
+    struct entryFile_t {
+        fs::path            path;
+        uint64_t            size;
+        fs::file_time_type  lastUse;
+    };
+    std::vector< entryFile_t > entryFiles;
+    uint64_t totalSize = 0;
+
+    std::error_code errorCode;
+    for (fs::directory_iterator it( mOptions.directory, errorCode ), end; !errorCode && it != end; it.increment( errorCode )) {
+        if (!it->is_regular_file( errorCode ) || it->path().extension() != ".vgc") { continue; }
+        const entryFile_t entryFile = { it->path(), it->file_size( errorCode ), it->last_write_time( errorCode ) };
+        if (errorCode) {
+            errorCode.clear();
+            continue;
+        }
+        totalSize += entryFile.size;
+        entryFiles.push_back( entryFile );
+    }
+
+    std::sort( entryFiles.begin(), entryFiles.end(), []( const entryFile_t& a, const entryFile_t& b ) { return a.lastUse < b.lastUse; } );
+    for (const auto& entryFile : entryFiles) {
+        if (totalSize <= mOptions.maxBytes) { break; }
+        if (fs::equivalent( entryFile.path, keepUrl, errorCode )) { continue; }
+        if (fs::remove( entryFile.path, errorCode )) { totalSize -= entryFile.size; }
+    }
+}
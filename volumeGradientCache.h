@@ -0,0 +1,86 @@
+#ifndef _VOLUMEGRADIENTCACHE_H_7DBEE6AB_C0CF_461B_9538_DC4FB3A8B97C
+#define _VOLUMEGRADIENTCACHE_H_7DBEE6AB_C0CF_461B_9538_DC4FB3A8B97C
+
+#include "eRetVal_FileLoader.h"
+#include "mappedFile.h"
+#include "executionContext.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+namespace FileLoader {
+
+    // Persistent normals, density range and histogram of volume files, so that loading an unchanged volume does not
+    // recompute its gradients (see VolumeData::loadOptions_t::pGradientCache). Entries are named by path, size and
+    // modification time of the volume plus gradient mode and normal storage, a stamp that only takes a stat to check.
+    // By default a hit is verified against the content hash of the volume and the payload checksum of the entry as
+    // well, which reads both files once; volumes rewritten with the same size and time and damaged entries are caught.
+    // Without verifyEntries a hit only reads the entry header and the normals are faulted in as they are used, but
+    // such an entry is used as is. Entries that fail are deleted.
+    struct GradientCache {
+        struct options_t {
+            std::string directory;                          // empty: sidecar files next to the volumes, without a size cap
+            uint64_t    maxBytes = uint64_t( 4 ) << 30;     // directory only, the least recently used entries are evicted above this
+            bool        verifyEntries = true;               // false: hits check the stamp and the entry header only
+        };
+
+        // An entry is this header, numHistogramBuckets uint64_t buckets and the normals of all voxels in
+        // VolumeData::calcAddr() order (vec3_t or packedNormal_t, see normalStorage).
+        struct entryHeader_t {
+            char        magic[4];               // "VGRC"
+            uint32_t    version;
+            uint64_t    contentHash;            // hashFile() of the volume
+            uint64_t    payloadChecksum;        // payloadChecksum() of buckets and normals
+            uint64_t    fileSize;               // fileStamp_t of the volume
+            int64_t     fileTime;
+            uint16_t    dim[3];
+            uint8_t     gradientMode;           // VolumeData::gradientMode_t
+            uint8_t     normalStorage;          // VolumeData::normalStorage_t
+            float       magnitudeScale;         // see VolumeData::getNormalMagnitudeScale()
+            uint16_t    minMaxDensity[2];
+            uint16_t    histogramRange[2];
+            uint32_t    numHistogramBuckets;    // 0 if the load that wrote the entry did not calculate a histogram
+        };
+        static_assert( sizeof( entryHeader_t ) == 64, "the entry header is written as is" );
+
+        static constexpr uint32_t   mVersion = 2;
+
+        // size and modification time (ticks of std::filesystem::file_time_type) of a volume, the cheap part of the key
+        struct fileStamp_t {
+            uint64_t    size;
+            int64_t     time;
+        };
+
+        GradientCache() : GradientCache( options_t{} ) {}
+        explicit GradientCache( const options_t& options ) : mOptions( options ) {}
+
+        inline const options_t& getOptions() const { return mOptions; }
+
+        // 64 bit hash of the whole file; the file is hashed in blocks in parallel, the result does not depend on the thread count
+        static eRetVal hashFile( const std::string& fileUrl, const ExecutionContext& executionContext, uint64_t& hash );
+        static eRetVal stampFile( const std::string& fileUrl, fileStamp_t& stamp );
+        static uint64_t payloadChecksum( const uint64_t* pBuckets, const size_t numBuckets, const void* pNormals, const size_t numNormalBytes,
+                                         const ExecutionContext& executionContext );
+
+        std::string getEntryUrl( const std::string& volumeUrl, const fileStamp_t& stamp, const uint8_t gradientMode, const uint8_t normalStorage ) const;
+
+        // Maps the entry if it matches fileSize, fileTime, gradientMode, normalStorage and dim of key and has numVoxels 
+        // normals of normalSize bytes; with verifyEntries also contentHash and the payload checksum. The mapping is 
+        // copy-on-write, writes never reach the entry. Damaged entries are deleted, the used ones become the most recently used.
+        eRetVal openEntry( const std::string& entryUrl, const entryHeader_t& key, const size_t numVoxels, const size_t normalSize,
+                           const ExecutionContext& executionContext, MappedFile& entry ) const;
+        // header.payloadChecksum is filled in; the entry is written under a temporary name and renamed,
+        // so concurrent loads never see half an entry
+        eRetVal storeEntry( const std::string& entryUrl, const entryHeader_t& header, const uint64_t* pBuckets,
+                            const void* pNormals, const size_t numNormalBytes, const ExecutionContext& executionContext ) const;
+
+    private:
+        // removes the least recently used entries of the cache directory until it fits into maxBytes, never keepUrl
+        void evict( const std::string& keepUrl ) const;
+
+        options_t   mOptions;
+    };
+}
+#endif // _VOLUMEGRADIENTCACHE_H_7DBEE6AB_C0CF_461B_9538_DC4FB3A8B97C
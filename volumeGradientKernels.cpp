@@ -0,0 +1,1088 @@
+#include "volumeGradientKernels.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+
+#if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __i386__ ) || defined( _M_IX86 )
+    #define GRADIENT_KERNELS_X86    1
+    #include <immintrin.h>
+    #if defined( _MSC_VER ) && !defined( __clang__ )
+        #include <intrin.h>
+        #define TARGET_SSE2
+        #define TARGET_AVX2
+    #else
+        #define TARGET_SSE2 __attribute__((target("sse2")))
+        #define TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#else
+    #define GRADIENT_KERNELS_X86    0
+#endif
+
+using namespace FileLoader;
+using namespace FileLoader::gradientKernels;
+
+namespace {
+    using vec3_t = std::array<float, 3>;
+    static_assert( sizeof( vec3_t ) == 3 * sizeof( float ), "normals are written as a packed float triple stream" );
+
+    //-- scalar kernels, also used for the borders and remainders of the SIMD kernels
+
+    template< typename voxel_T >
+    using sum_t = typename voxelKernels_t< voxel_T >::sum_t;
+
+    // divisions by powers of two are exact, so '* 1/32' gives the same bits as '/ 32'
+    constexpr float sobelNorm = 1.0f / 32.0f;
+
+    // the float SIMD kernels evaluate ( a + 2 * b ) + c in this order as well
+    template< typename voxel_T >
+    static inline void sobelVoxelYZ( const voxel_T* const rows[3][3], const int32_t x, sum_t< voxel_T >* syA, sum_t< voxel_T >* dyA, sum_t< voxel_T >* syB ) {
+        using s_t = sum_t< voxel_T >;
+        const s_t a0 = rows[0][0][x] + 2 * rows[1][0][x] + rows[2][0][x]; // smoothed along z
+        const s_t a1 = rows[0][1][x] + 2 * rows[1][1][x] + rows[2][1][x];
+        const s_t a2 = rows[0][2][x] + 2 * rows[1][2][x] + rows[2][2][x];
+        const s_t b0 = rows[2][0][x] - rows[0][0][x]; // differentiated along z
+        const s_t b1 = rows[2][1][x] - rows[0][1][x];
+        const s_t b2 = rows[2][2][x] - rows[0][2][x];
+        syA[x] = a0 + 2 * a1 + a2;
+        dyA[x] = a2 - a0;
+        syB[x] = b0 + 2 * b1 + b2;
+    }
+
+    template< typename sum_T >
+    static inline void sobelVoxelX( const sum_T* syA, const sum_T* dyA, const sum_T* syB,
+                                    const int32_t xm, const int32_t x, const int32_t xp, float* gx, float* gy, float* gz ) {
+        gx[x] = static_cast<float>( syA[xp] - syA[xm] ) * sobelNorm;
+        gy[x] = static_cast<float>( dyA[xm] + 2 * dyA[x] + dyA[xp] ) * sobelNorm;
+        gz[x] = static_cast<float>( syB[xm] + 2 * syB[x] + syB[xp] ) * sobelNorm;
+    }
+
+    template< typename voxel_T >
+    static inline void centralDifferencesVoxel( const voxel_T* const rows[5], const int32_t xm, const int32_t x, const int32_t xp, float* gx, float* gy, float* gz ) {
+        gx[x] = ( rows[4][xp] - rows[4][xm] ) * 0.5f;
+        gy[x] = ( rows[1][x]  - rows[0][x]  ) * 0.5f;
+        gz[x] = ( rows[3][x]  - rows[2][x]  ) * 0.5f;
+    }
+
+    static inline float signNotZero( const float v ) { return ( v >= 0.0f ) ? 1.0f : -1.0f; }
+
+    // lrintf() rounds to nearest-even like the SIMD conversions, so all kernel levels produce the same bits
+    static inline uint16_t quantizeU16( const float v ) {
+        return static_cast<uint16_t>( lrintf( std::min( std::max( v, 0.0f ), 65535.0f ) ) );
+    }
+
+    static inline void octahedralVoxel( const float gx, const float gy, const float gz, const float magnitudeScale, packedNormal_t& packed ) {
+        const float l1 = fabsf( gx ) + fabsf( gy ) + fabsf( gz );
+        const float recipL1 = ( l1 > 0.0f ) ? 1.0f / l1 : 0.0f;
+        float px = gx * recipL1;
+        float py = gy * recipL1;
+        if (gz < 0.0f) { // fold the lower hemisphere over the diagonals
+            const float foldedX = ( 1.0f - fabsf( py ) ) * signNotZero( px );
+            const float foldedY = ( 1.0f - fabsf( px ) ) * signNotZero( py );
+            px = foldedX;
+            py = foldedY;
+        }
+        packed[0] = quantizeU16( ( px * 0.5f + 0.5f ) * 65535.0f );
+        packed[1] = quantizeU16( ( py * 0.5f + 0.5f ) * 65535.0f );
+        packed[2] = quantizeU16( sqrtf( gx * gx + gy * gy + gz * gz ) * magnitudeScale );
+    }
+
+    // the first and last voxel of a row clamp along x, [1, dimX-1) does not
+    template< typename voxelFunc_T >
+    static inline void rowBorders( const int32_t dimX, voxelFunc_T voxelFunc ) {
+        voxelFunc( 0, 0, std::min( 1, dimX - 1 ) );
+        if (dimX > 1) { voxelFunc( dimX - 2, dimX - 1, dimX - 1 ); }
+    }
+
+    template< typename voxel_T >
+    static void sobelRowYZ_scalar( const voxel_T* const rows[3][3], const int32_t dimX, sum_t< voxel_T >* syA, sum_t< voxel_T >* dyA, sum_t< voxel_T >* syB ) {
+        for (int32_t x = 0; x < dimX; x++) {
+            sobelVoxelYZ( rows, x, syA, dyA, syB );
+        }
+    }
+
+    template< typename sum_T >
+    static void sobelRowX_scalar( const sum_T* syA, const sum_T* dyA, const sum_T* syB, const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { sobelVoxelX( syA, dyA, syB, xm, x, xp, gx, gy, gz ); } );
+        for (int32_t x = 1; x < dimX - 1; x++) {
+            sobelVoxelX( syA, dyA, syB, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    template< typename voxel_T >
+    static void centralDifferencesRow_scalar( const voxel_T* const rows[5], const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { centralDifferencesVoxel( rows, xm, x, xp, gx, gy, gz ); } );
+        for (int32_t x = 1; x < dimX - 1; x++) {
+            centralDifferencesVoxel( rows, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    static void storeRowFloat3_scalar( const float* gx, const float* gy, const float* gz, const int32_t dimX, vec3_t* normals ) {
+        for (int32_t x = 0; x < dimX; x++) {
+            normals[x] = vec3_t{ gx[x], gy[x], gz[x] };
+        }
+    }
+
+    static void storeRowOctahedral_scalar( const float* gx, const float* gy, const float* gz, const int32_t dimX, const float magnitudeScale, packedNormal_t* normals ) {
+        for (int32_t x = 0; x < dimX; x++) {
+            octahedralVoxel( gx[x], gy[x], gz[x], magnitudeScale, normals[x] );
+        }
+    }
+
+    // std::min( a, v ) and std::max( a, v ) are ( v < a ) ? v : a and ( a < v ) ? v : a, the comparisons of 
+    // _mm_min_ps( v, a ) and _mm_max_ps( v, a ), so NaN voxels are skipped on all levels
+    template< typename voxel_T >
+    static void densityRange_scalar( const voxel_T* voxels, const int32_t count, voxel_T& minValue, voxel_T& maxValue ) {
+        voxel_T lowest = minValue;
+        voxel_T highest = maxValue;
+        for (int32_t i = 0; i < count; i++) {
+            const voxel_T value = voxels[i];
+            if (std::is_floating_point< voxel_T >::value || value > 0) { lowest = std::min( lowest, value ); }
+            highest = std::max( highest, value );
+        }
+        minValue = lowest;
+        maxValue = highest;
+    }
+
+    template< typename voxel_T >
+    static void columnMinMax_scalar( const voxel_T* voxels, const int32_t count, voxel_T* columnMin, voxel_T* columnMax ) {
+        for (int32_t i = 0; i < count; i++) {
+            columnMin[i] = std::min( columnMin[i], voxels[i] );
+            columnMax[i] = std::max( columnMax[i], voxels[i] );
+        }
+    }
+
+    // the comparisons of _mm_max_ps( v, 0 ) and _mm_min_ps( v, maxCoord ), so NaN positions end up at 0 on all levels
+    static inline float clampSampleCoord( const float v, const float maxCoord ) {
+        const float lower = ( v > 0.0f ) ? v : 0.0f;
+        return ( lower < maxCoord ) ? lower : maxCoord;
+    }
+
+    // first corner c0 <= max( dim - 2, 0 ), so that c0 + 1 is a voxel of the row, and the fraction f in [0, 1] above it
+    static inline void trilinearAxis( const float p, const float maxCoord, const float maxCorner, float& c0, float& f ) {
+        const float c = clampSampleCoord( p, maxCoord );
+        c0 = std::min( static_cast<float>( static_cast<int32_t>( c ) ), maxCorner );
+        f = c - c0;
+    }
+
+    template< typename voxel_T >
+    static inline uint64_t trilinearAddr( const trilinearGrid_t< voxel_T >& grid, const int32_t x, const int32_t y, const int32_t z ) {
+        if (grid.numBricks[0] == 0) { return ( static_cast<uint64_t>( z ) * grid.dim[1] + y ) * grid.dim[0] + x; }
+        const int32_t sizeLog2 = grid.brickSizeLog2;
+        const int32_t mask = ( 1 << sizeLog2 ) - 1;
+        const uint64_t brickIdx = ( static_cast<uint64_t>( z >> sizeLog2 ) * grid.numBricks[1] + ( y >> sizeLog2 ) ) * grid.numBricks[0] + ( x >> sizeLog2 );
+        return ( brickIdx << ( 3 * sizeLog2 ) ) + ( ( ( ( z & mask ) << sizeLog2 ) + ( y & mask ) ) << sizeLog2 ) + ( x & mask );
+    }
+
+    // d[dz * 4 + dy * 2 + dx] are the densities of the cell corners
+    static inline void trilinearVoxel( const float d[8], const float fx, const float fy, const float fz, const int32_t i,
+                                       float* densities, float* gx, float* gy, float* gz ) {
+        const float ex00 = d[1] - d[0]; // differences along x of the four corner pairs
+        const float ex10 = d[3] - d[2];
+        const float ex01 = d[5] - d[4];
+        const float ex11 = d[7] - d[6];
+        const float c00 = d[0] + fx * ex00;
+        const float c10 = d[2] + fx * ex10;
+        const float c01 = d[4] + fx * ex01;
+        const float c11 = d[6] + fx * ex11;
+        const float ey0 = c10 - c00;
+        const float ey1 = c11 - c01;
+        const float c0 = c00 + fy * ey0;
+        const float c1 = c01 + fy * ey1;
+        densities[i] = c0 + fz * ( c1 - c0 );
+        if (gx) {
+            const float ex0 = ex00 + fy * ( ex10 - ex00 );
+            const float ex1 = ex01 + fy * ( ex11 - ex01 );
+            gx[i] = ex0 + fz * ( ex1 - ex0 );
+            gy[i] = ey0 + fz * ( ey1 - ey0 );
+            gz[i] = c1 - c0;
+        }
+    }
+
+    template< typename voxel_T >
+    static void sampleTrilinear_scalar( const trilinearGrid_t< voxel_T >& grid, const float* px, const float* py, const float* pz, const int32_t count,
+                                        float* densities, float* gx, float* gy, float* gz ) {
+        float maxCoord[3], maxCorner[3];
+        for (int32_t axis = 0; axis < 3; axis++) {
+            maxCoord[axis] = static_cast<float>( grid.dim[axis] - 1 );
+            maxCorner[axis] = static_cast<float>( std::max( grid.dim[axis] - 2, 0 ) );
+        }
+        for (int32_t i = 0; i < count; i++) {
+            float c0[3], f[3];
+            trilinearAxis( px[i], maxCoord[0], maxCorner[0], c0[0], f[0] );
+            trilinearAxis( py[i], maxCoord[1], maxCorner[1], c0[1], f[1] );
+            trilinearAxis( pz[i], maxCoord[2], maxCorner[2], c0[2], f[2] );
+            int32_t corner0[3], corner1[3];
+            for (int32_t axis = 0; axis < 3; axis++) {
+                corner0[axis] = static_cast<int32_t>( c0[axis] );
+                corner1[axis] = std::min( corner0[axis] + 1, grid.dim[axis] - 1 );
+            }
+            float d[8];
+            if (grid.numBricks[0] == 0) {
+                const voxel_T* const p = grid.pVoxels + trilinearAddr( grid, corner0[0], corner0[1], corner0[2] );
+                const uint64_t stepX = corner1[0] - corner0[0];
+                const uint64_t stepY = static_cast<uint64_t>( corner1[1] - corner0[1] ) * grid.dim[0];
+                const uint64_t stepZ = static_cast<uint64_t>( corner1[2] - corner0[2] ) * grid.dim[0] * grid.dim[1];
+                for (int32_t corner = 0; corner < 8; corner++) {
+                    d[corner] = p[ ( ( corner & 1 ) ? stepX : 0 ) + ( ( corner & 2 ) ? stepY : 0 ) + ( ( corner & 4 ) ? stepZ : 0 ) ];
+                }
+            } else {
+                for (int32_t corner = 0; corner < 8; corner++) {
+                    d[corner] = grid.pVoxels[ trilinearAddr( grid, ( corner & 1 ) ? corner1[0] : corner0[0],
+                                                                      ( corner & 2 ) ? corner1[1] : corner0[1],
+                                                                      ( corner & 4 ) ? corner1[2] : corner0[2] ) ];
+                }
+            }
+            trilinearVoxel( d, f[0], f[1], f[2], i, densities, gx, gy, gz );
+        }
+    }
+
+    // merges the lane results of the integer SIMD range kernels, the lane minima are of (voxel - 1) so that 0 maps to the largest value
+    template< typename voxel_T >
+    static inline void mergeRangeLanes( const voxel_T* lanesMinMinusOne, const voxel_T* lanesMax, const int32_t numLanes, voxel_T& minNonZero, voxel_T& maxValue ) {
+        for (int32_t lane = 0; lane < numLanes; lane++) {
+            if (lanesMinMinusOne[lane] != std::numeric_limits< voxel_T >::max()) { minNonZero = std::min( minNonZero, static_cast<voxel_T>( lanesMinMinusOne[lane] + 1 ) ); }
+            maxValue = std::max( maxValue, lanesMax[lane] );
+        }
+    }
+
+    // merges the lanes of the float SIMD range kernels
+    static inline void mergeRangeLanesFloat( const float* lanesMin, const float* lanesMax, const int32_t numLanes, float& minValue, float& maxValue ) {
+        for (int32_t lane = 0; lane < numLanes; lane++) {
+            minValue = std::min( minValue, lanesMin[lane] );
+            maxValue = std::max( maxValue, lanesMax[lane] );
+        }
+    }
+
+#if ( GRADIENT_KERNELS_X86 != 0 )
+
+    //-- SSE2 kernels
+
+    // interleaves 4 gradients from SoA registers into 12 consecutive floats
+    TARGET_SSE2 static inline void storeInterleaved4( const __m128 gx, const __m128 gy, const __m128 gz, float* pDst ) {
+        const __m128 xy01 = _mm_unpacklo_ps( gx, gy );                          // x0 y0 x1 y1
+        const __m128 xy23 = _mm_unpackhi_ps( gx, gy );                          // x2 y2 x3 y3
+        const __m128 zx01 = _mm_shuffle_ps( gz, gx, _MM_SHUFFLE( 1, 1, 0, 0 ) );  // z0 z0 x1 x1
+        const __m128 yz11 = _mm_shuffle_ps( gy, gz, _MM_SHUFFLE( 1, 1, 1, 1 ) );  // y1 y1 z1 z1
+        const __m128 zx23 = _mm_shuffle_ps( gz, gx, _MM_SHUFFLE( 3, 3, 2, 2 ) );  // z2 z2 x3 x3
+        const __m128 yz33 = _mm_shuffle_ps( gy, gz, _MM_SHUFFLE( 3, 3, 3, 3 ) );  // y3 y3 z3 z3
+        _mm_storeu_ps( pDst + 0, _mm_shuffle_ps( xy01, zx01, _MM_SHUFFLE( 2, 0, 1, 0 ) ) ); // x0 y0 z0 x1
+        _mm_storeu_ps( pDst + 4, _mm_shuffle_ps( yz11, xy23, _MM_SHUFFLE( 1, 0, 2, 0 ) ) ); // y1 z1 x2 y2
+        _mm_storeu_ps( pDst + 8, _mm_shuffle_ps( zx23, yz33, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ); // z2 x3 y3 z3
+    }
+
+    // 8 integer voxels widened to two times 4 x int32_t
+    TARGET_SSE2 static inline void loadWiden_sse2( const uint16_t* pSrc, __m128i& lo, __m128i& hi ) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSrc ) );
+        lo = _mm_unpacklo_epi16( v, zero );
+        hi = _mm_unpackhi_epi16( v, zero );
+    }
+
+    TARGET_SSE2 static inline void loadWiden_sse2( const uint8_t* pSrc, __m128i& lo, __m128i& hi ) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i v = _mm_unpacklo_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pSrc ) ), zero );
+        lo = _mm_unpacklo_epi16( v, zero );
+        hi = _mm_unpackhi_epi16( v, zero );
+    }
+
+    template< typename voxel_T >
+    TARGET_SSE2 static void sobelRowYZ_sse2( const voxel_T* const rows[3][3], const int32_t dimX, int32_t* syA, int32_t* dyA, int32_t* syB ) {
+        int32_t x = 0;
+        for (; x + 8 <= dimX; x += 8) { // 8 voxels as two 4-lane halves
+            __m128i r[3][3][2];
+            for (int32_t dz = 0; dz < 3; dz++) {
+                for (int32_t dy = 0; dy < 3; dy++) {
+                    loadWiden_sse2( rows[dz][dy] + x, r[dz][dy][0], r[dz][dy][1] );
+                }
+            }
+            for (int32_t h = 0; h < 2; h++) {
+                __m128i a[3], b[3];
+                for (int32_t dy = 0; dy < 3; dy++) {
+                    a[dy] = _mm_add_epi32( _mm_add_epi32( r[0][dy][h], r[2][dy][h] ), _mm_slli_epi32( r[1][dy][h], 1 ) );
+                    b[dy] = _mm_sub_epi32( r[2][dy][h], r[0][dy][h] );
+                }
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( syA + x + 4 * h ), _mm_add_epi32( _mm_add_epi32( a[0], a[2] ), _mm_slli_epi32( a[1], 1 ) ) );
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( dyA + x + 4 * h ), _mm_sub_epi32( a[2], a[0] ) );
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( syB + x + 4 * h ), _mm_add_epi32( _mm_add_epi32( b[0], b[2] ), _mm_slli_epi32( b[1], 1 ) ) );
+            }
+        }
+        for (; x < dimX; x++) {
+            sobelVoxelYZ( rows, x, syA, dyA, syB );
+        }
+    }
+
+    TARGET_SSE2 static inline __m128i loadI32_sse2( const int32_t* pSrc ) {
+        return _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSrc ) );
+    }
+
+    TARGET_SSE2 static inline __m128i smoothX_sse2( const int32_t* pRow ) { // [1 2 1] centered on pRow[0..3]
+        return _mm_add_epi32( _mm_add_epi32( loadI32_sse2( pRow - 1 ), loadI32_sse2( pRow + 1 ) ), _mm_slli_epi32( loadI32_sse2( pRow ), 1 ) );
+    }
+
+    TARGET_SSE2 static void sobelRowX_sse2( const int32_t* syA, const int32_t* dyA, const int32_t* syB, const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { sobelVoxelX( syA, dyA, syB, xm, x, xp, gx, gy, gz ); } );
+        const __m128 norm = _mm_set1_ps( sobelNorm );
+        int32_t x = 1;
+        for (; x + 4 <= dimX - 1; x += 4) {
+            _mm_storeu_ps( gx + x, _mm_mul_ps( _mm_cvtepi32_ps( _mm_sub_epi32( loadI32_sse2( syA + x + 1 ), loadI32_sse2( syA + x - 1 ) ) ), norm ) );
+            _mm_storeu_ps( gy + x, _mm_mul_ps( _mm_cvtepi32_ps( smoothX_sse2( dyA + x ) ), norm ) );
+            _mm_storeu_ps( gz + x, _mm_mul_ps( _mm_cvtepi32_ps( smoothX_sse2( syB + x ) ), norm ) );
+        }
+        for (; x < dimX - 1; x++) {
+            sobelVoxelX( syA, dyA, syB, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    template< typename voxel_T >
+    TARGET_SSE2 static void centralDifferencesRow_sse2( const voxel_T* const rows[5], const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { centralDifferencesVoxel( rows, xm, x, xp, gx, gy, gz ); } );
+        const __m128 half = _mm_set1_ps( 0.5f );
+        int32_t x = 1;
+        for (; x + 8 <= dimX - 1; x += 8) {
+            __m128i xm[2], xp[2], ym[2], yp[2], zm[2], zp[2];
+            loadWiden_sse2( rows[4] + x - 1, xm[0], xm[1] );
+            loadWiden_sse2( rows[4] + x + 1, xp[0], xp[1] );
+            loadWiden_sse2( rows[0] + x, ym[0], ym[1] );
+            loadWiden_sse2( rows[1] + x, yp[0], yp[1] );
+            loadWiden_sse2( rows[2] + x, zm[0], zm[1] );
+            loadWiden_sse2( rows[3] + x, zp[0], zp[1] );
+            for (int32_t h = 0; h < 2; h++) {
+                _mm_storeu_ps( gx + x + 4 * h, _mm_mul_ps( _mm_cvtepi32_ps( _mm_sub_epi32( xp[h], xm[h] ) ), half ) );
+                _mm_storeu_ps( gy + x + 4 * h, _mm_mul_ps( _mm_cvtepi32_ps( _mm_sub_epi32( yp[h], ym[h] ) ), half ) );
+                _mm_storeu_ps( gz + x + 4 * h, _mm_mul_ps( _mm_cvtepi32_ps( _mm_sub_epi32( zp[h], zm[h] ) ), half ) );
+            }
+        }
+        for (; x < dimX - 1; x++) {
+            centralDifferencesVoxel( rows, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    //-- float voxels, same order of operations as the scalar kernels
+
+    TARGET_SSE2 static inline __m128 smoothXFloat_sse2( const float* pRow ) { // [1 2 1] centered on pRow[0..3]
+        return _mm_add_ps( _mm_add_ps( _mm_loadu_ps( pRow - 1 ), _mm_mul_ps( _mm_set1_ps( 2.0f ), _mm_loadu_ps( pRow ) ) ), _mm_loadu_ps( pRow + 1 ) );
+    }
+
+    TARGET_SSE2 static void sobelRowYZFloat_sse2( const float* const rows[3][3], const int32_t dimX, float* syA, float* dyA, float* syB ) {
+        const __m128 two = _mm_set1_ps( 2.0f );
+        int32_t x = 0;
+        for (; x + 4 <= dimX; x += 4) {
+            __m128 a[3], b[3];
+            for (int32_t dy = 0; dy < 3; dy++) {
+                const __m128 zm = _mm_loadu_ps( rows[0][dy] + x );
+                const __m128 zc = _mm_loadu_ps( rows[1][dy] + x );
+                const __m128 zp = _mm_loadu_ps( rows[2][dy] + x );
+                a[dy] = _mm_add_ps( _mm_add_ps( zm, _mm_mul_ps( two, zc ) ), zp );
+                b[dy] = _mm_sub_ps( zp, zm );
+            }
+            _mm_storeu_ps( syA + x, _mm_add_ps( _mm_add_ps( a[0], _mm_mul_ps( two, a[1] ) ), a[2] ) );
+            _mm_storeu_ps( dyA + x, _mm_sub_ps( a[2], a[0] ) );
+            _mm_storeu_ps( syB + x, _mm_add_ps( _mm_add_ps( b[0], _mm_mul_ps( two, b[1] ) ), b[2] ) );
+        }
+        for (; x < dimX; x++) {
+            sobelVoxelYZ( rows, x, syA, dyA, syB );
+        }
+    }
+
+    TARGET_SSE2 static void sobelRowXFloat_sse2( const float* syA, const float* dyA, const float* syB, const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { sobelVoxelX( syA, dyA, syB, xm, x, xp, gx, gy, gz ); } );
+        const __m128 norm = _mm_set1_ps( sobelNorm );
+        int32_t x = 1;
+        for (; x + 4 <= dimX - 1; x += 4) {
+            _mm_storeu_ps( gx + x, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( syA + x + 1 ), _mm_loadu_ps( syA + x - 1 ) ), norm ) );
+            _mm_storeu_ps( gy + x, _mm_mul_ps( smoothXFloat_sse2( dyA + x ), norm ) );
+            _mm_storeu_ps( gz + x, _mm_mul_ps( smoothXFloat_sse2( syB + x ), norm ) );
+        }
+        for (; x < dimX - 1; x++) {
+            sobelVoxelX( syA, dyA, syB, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    TARGET_SSE2 static void centralDifferencesRowFloat_sse2( const float* const rows[5], const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { centralDifferencesVoxel( rows, xm, x, xp, gx, gy, gz ); } );
+        const __m128 half = _mm_set1_ps( 0.5f );
+        int32_t x = 1;
+        for (; x + 4 <= dimX - 1; x += 4) {
+            _mm_storeu_ps( gx + x, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( rows[4] + x + 1 ), _mm_loadu_ps( rows[4] + x - 1 ) ), half ) );
+            _mm_storeu_ps( gy + x, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( rows[1] + x ), _mm_loadu_ps( rows[0] + x ) ), half ) );
+            _mm_storeu_ps( gz + x, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( rows[3] + x ), _mm_loadu_ps( rows[2] + x ) ), half ) );
+        }
+        for (; x < dimX - 1; x++) {
+            centralDifferencesVoxel( rows, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    TARGET_SSE2 static void storeRowFloat3_sse2( const float* gx, const float* gy, const float* gz, const int32_t dimX, vec3_t* normals ) {
+        int32_t x = 0;
+        for (; x + 4 <= dimX; x += 4) {
+            storeInterleaved4( _mm_loadu_ps( gx + x ), _mm_loadu_ps( gy + x ), _mm_loadu_ps( gz + x ), normals[x].data() );
+        }
+        storeRowFloat3_scalar( gx + x, gy + x, gz + x, dimX - x, normals + x );
+    }
+
+    TARGET_SSE2 static inline __m128 abs_sse2( const __m128 v ) { return _mm_andnot_ps( _mm_set1_ps( -0.0f ), v ); }
+    TARGET_SSE2 static inline __m128 select_sse2( const __m128 mask, const __m128 a, const __m128 b ) { return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) ); }
+    TARGET_SSE2 static inline __m128i quantizeU16_sse2( const __m128 v ) {
+        return _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( v, _mm_setzero_ps() ), _mm_set1_ps( 65535.0f ) ) );
+    }
+
+    // mirrors octahedralVoxel() operation by operation
+    TARGET_SSE2 static void storeRowOctahedral_sse2( const float* gx, const float* gy, const float* gz, const int32_t dimX, const float magnitudeScale, packedNormal_t* normals ) {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps( 1.0f );
+        const __m128 minusOne = _mm_set1_ps( -1.0f );
+        const __m128 half = _mm_set1_ps( 0.5f );
+        const __m128 maxU16 = _mm_set1_ps( 65535.0f );
+        const __m128 magScale = _mm_set1_ps( magnitudeScale );
+        int32_t x = 0;
+        for (; x + 4 <= dimX; x += 4) {
+            const __m128 vx = _mm_loadu_ps( gx + x );
+            const __m128 vy = _mm_loadu_ps( gy + x );
+            const __m128 vz = _mm_loadu_ps( gz + x );
+            const __m128 l1 = _mm_add_ps( _mm_add_ps( abs_sse2( vx ), abs_sse2( vy ) ), abs_sse2( vz ) );
+            const __m128 recipL1 = _mm_and_ps( _mm_cmpgt_ps( l1, zero ), _mm_div_ps( one, _mm_max_ps( l1, _mm_set1_ps( 1e-30f ) ) ) );
+            const __m128 px = _mm_mul_ps( vx, recipL1 );
+            const __m128 py = _mm_mul_ps( vy, recipL1 );
+            const __m128 foldedX = _mm_mul_ps( _mm_sub_ps( one, abs_sse2( py ) ), select_sse2( _mm_cmpge_ps( px, zero ), one, minusOne ) );
+            const __m128 foldedY = _mm_mul_ps( _mm_sub_ps( one, abs_sse2( px ) ), select_sse2( _mm_cmpge_ps( py, zero ), one, minusOne ) );
+            const __m128 lowerHemisphere = _mm_cmplt_ps( vz, zero );
+            const __m128 ox = select_sse2( lowerHemisphere, foldedX, px );
+            const __m128 oy = select_sse2( lowerHemisphere, foldedY, py );
+            const __m128 mag = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( vx, vx ), _mm_mul_ps( vy, vy ) ), _mm_mul_ps( vz, vz ) ) );
+
+            alignas( 16 ) int32_t qu[4], qv[4], qm[4];
+            _mm_store_si128( reinterpret_cast<__m128i*>( qu ), quantizeU16_sse2( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( ox, half ), half ), maxU16 ) ) );
+            _mm_store_si128( reinterpret_cast<__m128i*>( qv ), quantizeU16_sse2( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( oy, half ), half ), maxU16 ) ) );
+            _mm_store_si128( reinterpret_cast<__m128i*>( qm ), quantizeU16_sse2( _mm_mul_ps( mag, magScale ) ) );
+            for (int32_t i = 0; i < 4; i++) {
+                normals[x + i] = packedNormal_t{ static_cast<uint16_t>( qu[i] ), static_cast<uint16_t>( qv[i] ), static_cast<uint16_t>( qm[i] ) };
+            }
+        }
+        storeRowOctahedral_scalar( gx + x, gy + x, gz + x, dimX - x, magnitudeScale, normals + x );
+    }
+
+    // SSE2 only has signed 16 bit min/max, flipping the sign bit maps the unsigned order onto the signed one
+    TARGET_SSE2 static void densityRangeU16_sse2( const uint16_t* densities, const int32_t count, uint16_t& minNonZero, uint16_t& maxDensity ) {
+        const __m128i signBit = _mm_set1_epi16( static_cast<int16_t>( 0x8000 ) );
+        const __m128i one = _mm_set1_epi16( 1 );
+        __m128i minMinusOne = _mm_set1_epi16( 0x7FFF ); // 0xFFFF with flipped sign bit
+        __m128i maxValue = signBit;                       // 0 with flipped sign bit
+        int32_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( densities + i ) );
+            minMinusOne = _mm_min_epi16( minMinusOne, _mm_xor_si128( _mm_sub_epi16( v, one ), signBit ) );
+            maxValue = _mm_max_epi16( maxValue, _mm_xor_si128( v, signBit ) );
+        }
+        alignas( 16 ) uint16_t lanesMin[8], lanesMax[8];
+        _mm_store_si128( reinterpret_cast<__m128i*>( lanesMin ), _mm_xor_si128( minMinusOne, signBit ) );
+        _mm_store_si128( reinterpret_cast<__m128i*>( lanesMax ), _mm_xor_si128( maxValue, signBit ) );
+        mergeRangeLanes( lanesMin, lanesMax, 8, minNonZero, maxDensity );
+        densityRange_scalar( densities + i, count - i, minNonZero, maxDensity );
+    }
+
+    TARGET_SSE2 static void densityRangeU8_sse2( const uint8_t* densities, const int32_t count, uint8_t& minNonZero, uint8_t& maxDensity ) {
+        const __m128i one = _mm_set1_epi8( 1 );
+        __m128i minMinusOne = _mm_set1_epi8( static_cast<int8_t>( 0xFF ) );
+        __m128i maxValue = _mm_setzero_si128();
+        int32_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( densities + i ) );
+            minMinusOne = _mm_min_epu8( minMinusOne, _mm_sub_epi8( v, one ) );
+            maxValue = _mm_max_epu8( maxValue, v );
+        }
+        alignas( 16 ) uint8_t lanesMin[16], lanesMax[16];
+        _mm_store_si128( reinterpret_cast<__m128i*>( lanesMin ), minMinusOne );
+        _mm_store_si128( reinterpret_cast<__m128i*>( lanesMax ), maxValue );
+        mergeRangeLanes( lanesMin, lanesMax, 16, minNonZero, maxDensity );
+        densityRange_scalar( densities + i, count - i, minNonZero, maxDensity );
+    }
+
+    TARGET_SSE2 static void densityRangeFloat_sse2( const float* values, const int32_t count, float& minValue, float& maxValue ) {
+        __m128 lowest = _mm_set1_ps( minValue );
+        __m128 highest = _mm_set1_ps( maxValue );
+        int32_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const __m128 v = _mm_loadu_ps( values + i );
+            lowest = _mm_min_ps( v, lowest );
+            highest = _mm_max_ps( v, highest );
+        }
+        alignas( 16 ) float lanesMin[4], lanesMax[4];
+        _mm_store_ps( lanesMin, lowest );
+        _mm_store_ps( lanesMax, highest );
+        mergeRangeLanesFloat( lanesMin, lanesMax, 4, minValue, maxValue );
+        densityRange_scalar( values + i, count - i, minValue, maxValue );
+    }
+
+    // unsigned min/max from the saturating subtraction: min( a, b ) = a - ( a -sat b ), max( a, b ) = b + ( a -sat b )
+    TARGET_SSE2 static void columnMinMaxU16_sse2( const uint16_t* densities, const int32_t count, uint16_t* columnMin, uint16_t* columnMax ) {
+        int32_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( densities + i ) );
+            const __m128i colMin = _mm_loadu_si128( reinterpret_cast<const __m128i*>( columnMin + i ) );
+            const __m128i colMax = _mm_loadu_si128( reinterpret_cast<const __m128i*>( columnMax + i ) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( columnMin + i ), _mm_sub_epi16( colMin, _mm_subs_epu16( colMin, v ) ) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( columnMax + i ), _mm_add_epi16( colMax, _mm_subs_epu16( v, colMax ) ) );
+        }
+        columnMinMax_scalar( densities + i, count - i, columnMin + i, columnMax + i );
+    }
+
+    TARGET_SSE2 static void columnMinMaxU8_sse2( const uint8_t* densities, const int32_t count, uint8_t* columnMin, uint8_t* columnMax ) {
+        int32_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( densities + i ) );
+            __m128i* const pColMin = reinterpret_cast<__m128i*>( columnMin + i );
+            __m128i* const pColMax = reinterpret_cast<__m128i*>( columnMax + i );
+            _mm_storeu_si128( pColMin, _mm_min_epu8( _mm_loadu_si128( pColMin ), v ) );
+            _mm_storeu_si128( pColMax, _mm_max_epu8( _mm_loadu_si128( pColMax ), v ) );
+        }
+        columnMinMax_scalar( densities + i, count - i, columnMin + i, columnMax + i );
+    }
+
+    TARGET_SSE2 static void columnMinMaxFloat_sse2( const float* values, const int32_t count, float* columnMin, float* columnMax ) {
+        int32_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const __m128 v = _mm_loadu_ps( values + i );
+            _mm_storeu_ps( columnMin + i, _mm_min_ps( v, _mm_loadu_ps( columnMin + i ) ) );
+            _mm_storeu_ps( columnMax + i, _mm_max_ps( v, _mm_loadu_ps( columnMax + i ) ) );
+        }
+        columnMinMax_scalar( values + i, count - i, columnMin + i, columnMax + i );
+    }
+
+    // the remainder of a sampling kernel, the gradient outputs are optional
+    template< typename voxel_T >
+    static inline void sampleTrilinearRemainder( const trilinearGrid_t< voxel_T >& grid, const float* px, const float* py, const float* pz, const int32_t first,
+                                                 const int32_t count, float* densities, float* gx, float* gy, float* gz ) {
+        if (gx) {
+            sampleTrilinear_scalar( grid, px + first, py + first, pz + first, count - first, densities + first, gx + first, gy + first, gz + first );
+        } else {
+            sampleTrilinear_scalar( grid, px + first, py + first, pz + first, count - first, densities + first, nullptr, nullptr, nullptr );
+        }
+    }
+
+    // mirrors trilinearAxis()
+    TARGET_SSE2 static inline void trilinearAxis_sse2( const __m128 p, const __m128 maxCoord, const __m128 maxCorner, __m128& c0, __m128& f ) {
+        const __m128 c = _mm_min_ps( _mm_max_ps( p, _mm_setzero_ps() ), maxCoord );
+        c0 = _mm_min_ps( _mm_cvtepi32_ps( _mm_cvttps_epi32( c ) ), maxCorner );
+        f = _mm_sub_ps( c, c0 );
+    }
+
+    // mirrors trilinearVoxel() operation by operation
+    TARGET_SSE2 static inline void trilinearVoxel_sse2( const __m128 d[8], const __m128 fx, const __m128 fy, const __m128 fz, const int32_t i,
+                                                        float* densities, float* gx, float* gy, float* gz ) {
+        const __m128 ex00 = _mm_sub_ps( d[1], d[0] );
+        const __m128 ex10 = _mm_sub_ps( d[3], d[2] );
+        const __m128 ex01 = _mm_sub_ps( d[5], d[4] );
+        const __m128 ex11 = _mm_sub_ps( d[7], d[6] );
+        const __m128 c00 = _mm_add_ps( d[0], _mm_mul_ps( fx, ex00 ) );
+        const __m128 c10 = _mm_add_ps( d[2], _mm_mul_ps( fx, ex10 ) );
+        const __m128 c01 = _mm_add_ps( d[4], _mm_mul_ps( fx, ex01 ) );
+        const __m128 c11 = _mm_add_ps( d[6], _mm_mul_ps( fx, ex11 ) );
+        const __m128 ey0 = _mm_sub_ps( c10, c00 );
+        const __m128 ey1 = _mm_sub_ps( c11, c01 );
+        const __m128 c0 = _mm_add_ps( c00, _mm_mul_ps( fy, ey0 ) );
+        const __m128 c1 = _mm_add_ps( c01, _mm_mul_ps( fy, ey1 ) );
+        _mm_storeu_ps( densities + i, _mm_add_ps( c0, _mm_mul_ps( fz, _mm_sub_ps( c1, c0 ) ) ) );
+        if (gx) {
+            const __m128 ex0 = _mm_add_ps( ex00, _mm_mul_ps( fy, _mm_sub_ps( ex10, ex00 ) ) );
+            const __m128 ex1 = _mm_add_ps( ex01, _mm_mul_ps( fy, _mm_sub_ps( ex11, ex01 ) ) );
+            _mm_storeu_ps( gx + i, _mm_add_ps( ex0, _mm_mul_ps( fz, _mm_sub_ps( ex1, ex0 ) ) ) );
+            _mm_storeu_ps( gy + i, _mm_add_ps( ey0, _mm_mul_ps( fz, _mm_sub_ps( ey1, ey0 ) ) ) );
+            _mm_storeu_ps( gz + i, _mm_sub_ps( c1, c0 ) );
+        }
+    }
+
+    // SSE2 has no gathers and no 32 bit multiply, the corners are addressed and loaded per lane
+    template< typename voxel_T >
+    TARGET_SSE2 static void sampleTrilinear_sse2( const trilinearGrid_t< voxel_T >& grid, const float* px, const float* py, const float* pz, const int32_t count,
+                                                  float* densities, float* gx, float* gy, float* gz ) {
+        if (grid.numBricks[0] != 0) {
+            sampleTrilinear_scalar( grid, px, py, pz, count, densities, gx, gy, gz );
+            return;
+        }
+        __m128 maxCoord[3], maxCorner[3];
+        for (int32_t axis = 0; axis < 3; axis++) {
+            maxCoord[axis] = _mm_set1_ps( static_cast<float>( grid.dim[axis] - 1 ) );
+            maxCorner[axis] = _mm_set1_ps( static_cast<float>( std::max( grid.dim[axis] - 2, 0 ) ) );
+        }
+        // a single voxel along an axis is its own neighbour
+        const uint64_t stepX = ( grid.dim[0] > 1 ) ? 1 : 0;
+        const uint64_t stepY = ( grid.dim[1] > 1 ) ? grid.dim[0] : 0;
+        const uint64_t stepZ = ( grid.dim[2] > 1 ) ? static_cast<uint64_t>( grid.dim[0] ) * grid.dim[1] : 0;
+        int32_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 c0[3], f[3];
+            trilinearAxis_sse2( _mm_loadu_ps( px + i ), maxCoord[0], maxCorner[0], c0[0], f[0] );
+            trilinearAxis_sse2( _mm_loadu_ps( py + i ), maxCoord[1], maxCorner[1], c0[1], f[1] );
+            trilinearAxis_sse2( _mm_loadu_ps( pz + i ), maxCoord[2], maxCorner[2], c0[2], f[2] );
+            alignas( 16 ) int32_t corner0[3][4];
+            for (int32_t axis = 0; axis < 3; axis++) { _mm_store_si128( reinterpret_cast<__m128i*>( corner0[axis] ), _mm_cvttps_epi32( c0[axis] ) ); }
+            alignas( 16 ) float d[8][4];
+            for (int32_t lane = 0; lane < 4; lane++) {
+                const voxel_T* const p = grid.pVoxels + ( static_cast<uint64_t>( corner0[2][lane] ) * grid.dim[1] + corner0[1][lane] ) * grid.dim[0] + corner0[0][lane];
+                d[0][lane] = p[0];
+                d[1][lane] = p[stepX];
+                d[2][lane] = p[stepY];
+                d[3][lane] = p[stepY + stepX];
+                d[4][lane] = p[stepZ];
+                d[5][lane] = p[stepZ + stepX];
+                d[6][lane] = p[stepZ + stepY];
+                d[7][lane] = p[stepZ + stepY + stepX];
+            }
+            __m128 vd[8];
+            for (int32_t corner = 0; corner < 8; corner++) { vd[corner] = _mm_load_ps( d[corner] ); }
+            trilinearVoxel_sse2( vd, f[0], f[1], f[2], i, densities, gx, gy, gz );
+        }
+        sampleTrilinearRemainder( grid, px, py, pz, i, count, densities, gx, gy, gz );
+    }
+
+    //-- AVX2 kernels, 8 voxels per iteration
+
+    // same shuffles as storeInterleaved4() within each 128-bit lane, then the lane halves are put in order
+    TARGET_AVX2 static inline void storeInterleaved8( const __m256 gx, const __m256 gy, const __m256 gz, float* pDst ) {
+        const __m256 xy01 = _mm256_unpacklo_ps( gx, gy );
+        const __m256 xy23 = _mm256_unpackhi_ps( gx, gy );
+        const __m256 zx01 = _mm256_shuffle_ps( gz, gx, _MM_SHUFFLE( 1, 1, 0, 0 ) );
+        const __m256 yz11 = _mm256_shuffle_ps( gy, gz, _MM_SHUFFLE( 1, 1, 1, 1 ) );
+        const __m256 zx23 = _mm256_shuffle_ps( gz, gx, _MM_SHUFFLE( 3, 3, 2, 2 ) );
+        const __m256 yz33 = _mm256_shuffle_ps( gy, gz, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+        const __m256 out0 = _mm256_shuffle_ps( xy01, zx01, _MM_SHUFFLE( 2, 0, 1, 0 ) ); // voxels 0 | 4
+        const __m256 out1 = _mm256_shuffle_ps( yz11, xy23, _MM_SHUFFLE( 1, 0, 2, 0 ) ); // voxels 1,2 | 5,6
+        const __m256 out2 = _mm256_shuffle_ps( zx23, yz33, _MM_SHUFFLE( 2, 0, 2, 0 ) ); // voxels 2,3 | 6,7
+        _mm256_storeu_ps( pDst +  0, _mm256_permute2f128_ps( out0, out1, 0x20 ) );
+        _mm256_storeu_ps( pDst +  8, _mm256_permute2f128_ps( out2, out0, 0x30 ) );
+        _mm256_storeu_ps( pDst + 16, _mm256_permute2f128_ps( out1, out2, 0x31 ) );
+    }
+
+    // 8 integer voxels widened to 8 x int32_t
+    TARGET_AVX2 static inline __m256i loadWiden_avx2( const uint16_t* pSrc ) {
+        return _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSrc ) ) );
+    }
+
+    TARGET_AVX2 static inline __m256i loadWiden_avx2( const uint8_t* pSrc ) {
+        return _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pSrc ) ) );
+    }
+
+    TARGET_AVX2 static inline __m256i loadI32_avx2( const int32_t* pSrc ) {
+        return _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSrc ) );
+    }
+
+    TARGET_AVX2 static inline __m256i smoothX_avx2( const int32_t* pRow ) {
+        return _mm256_add_epi32( _mm256_add_epi32( loadI32_avx2( pRow - 1 ), loadI32_avx2( pRow + 1 ) ), _mm256_slli_epi32( loadI32_avx2( pRow ), 1 ) );
+    }
+
+    template< typename voxel_T >
+    TARGET_AVX2 static void sobelRowYZ_avx2( const voxel_T* const rows[3][3], const int32_t dimX, int32_t* syA, int32_t* dyA, int32_t* syB ) {
+        int32_t x = 0;
+        for (; x + 8 <= dimX; x += 8) {
+            __m256i a[3], b[3];
+            for (int32_t dy = 0; dy < 3; dy++) {
+                const __m256i zm = loadWiden_avx2( rows[0][dy] + x );
+                const __m256i zc = loadWiden_avx2( rows[1][dy] + x );
+                const __m256i zp = loadWiden_avx2( rows[2][dy] + x );
+                a[dy] = _mm256_add_epi32( _mm256_add_epi32( zm, zp ), _mm256_slli_epi32( zc, 1 ) );
+                b[dy] = _mm256_sub_epi32( zp, zm );
+            }
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>( syA + x ), _mm256_add_epi32( _mm256_add_epi32( a[0], a[2] ), _mm256_slli_epi32( a[1], 1 ) ) );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>( dyA + x ), _mm256_sub_epi32( a[2], a[0] ) );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>( syB + x ), _mm256_add_epi32( _mm256_add_epi32( b[0], b[2] ), _mm256_slli_epi32( b[1], 1 ) ) );
+        }
+        for (; x < dimX; x++) {
+            sobelVoxelYZ( rows, x, syA, dyA, syB );
+        }
+    }
+
+    TARGET_AVX2 static void sobelRowX_avx2( const int32_t* syA, const int32_t* dyA, const int32_t* syB, const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { sobelVoxelX( syA, dyA, syB, xm, x, xp, gx, gy, gz ); } );
+        const __m256 norm = _mm256_set1_ps( sobelNorm );
+        int32_t x = 1;
+        for (; x + 8 <= dimX - 1; x += 8) {
+            _mm256_storeu_ps( gx + x, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_sub_epi32( loadI32_avx2( syA + x + 1 ), loadI32_avx2( syA + x - 1 ) ) ), norm ) );
+            _mm256_storeu_ps( gy + x, _mm256_mul_ps( _mm256_cvtepi32_ps( smoothX_avx2( dyA + x ) ), norm ) );
+            _mm256_storeu_ps( gz + x, _mm256_mul_ps( _mm256_cvtepi32_ps( smoothX_avx2( syB + x ) ), norm ) );
+        }
+        for (; x < dimX - 1; x++) {
+            sobelVoxelX( syA, dyA, syB, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    template< typename voxel_T >
+    TARGET_AVX2 static void centralDifferencesRow_avx2( const voxel_T* const rows[5], const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { centralDifferencesVoxel( rows, xm, x, xp, gx, gy, gz ); } );
+        const __m256 half = _mm256_set1_ps( 0.5f );
+        int32_t x = 1;
+        for (; x + 8 <= dimX - 1; x += 8) {
+            _mm256_storeu_ps( gx + x, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_sub_epi32( loadWiden_avx2( rows[4] + x + 1 ), loadWiden_avx2( rows[4] + x - 1 ) ) ), half ) );
+            _mm256_storeu_ps( gy + x, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_sub_epi32( loadWiden_avx2( rows[1] + x ), loadWiden_avx2( rows[0] + x ) ) ), half ) );
+            _mm256_storeu_ps( gz + x, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_sub_epi32( loadWiden_avx2( rows[3] + x ), loadWiden_avx2( rows[2] + x ) ) ), half ) );
+        }
+        for (; x < dimX - 1; x++) {
+            centralDifferencesVoxel( rows, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    //-- float voxels, same order of operations as the scalar kernels
+
+    TARGET_AVX2 static inline __m256 smoothXFloat_avx2( const float* pRow ) {
+        return _mm256_add_ps( _mm256_add_ps( _mm256_loadu_ps( pRow - 1 ), _mm256_mul_ps( _mm256_set1_ps( 2.0f ), _mm256_loadu_ps( pRow ) ) ), _mm256_loadu_ps( pRow + 1 ) );
+    }
+
+    TARGET_AVX2 static void sobelRowYZFloat_avx2( const float* const rows[3][3], const int32_t dimX, float* syA, float* dyA, float* syB ) {
+        const __m256 two = _mm256_set1_ps( 2.0f );
+        int32_t x = 0;
+        for (; x + 8 <= dimX; x += 8) {
+            __m256 a[3], b[3];
+            for (int32_t dy = 0; dy < 3; dy++) {
+                const __m256 zm = _mm256_loadu_ps( rows[0][dy] + x );
+                const __m256 zc = _mm256_loadu_ps( rows[1][dy] + x );
+                const __m256 zp = _mm256_loadu_ps( rows[2][dy] + x );
+                a[dy] = _mm256_add_ps( _mm256_add_ps( zm, _mm256_mul_ps( two, zc ) ), zp );
+                b[dy] = _mm256_sub_ps( zp, zm );
+            }
+            _mm256_storeu_ps( syA + x, _mm256_add_ps( _mm256_add_ps( a[0], _mm256_mul_ps( two, a[1] ) ), a[2] ) );
+            _mm256_storeu_ps( dyA + x, _mm256_sub_ps( a[2], a[0] ) );
+            _mm256_storeu_ps( syB + x, _mm256_add_ps( _mm256_add_ps( b[0], _mm256_mul_ps( two, b[1] ) ), b[2] ) );
+        }
+        for (; x < dimX; x++) {
+            sobelVoxelYZ( rows, x, syA, dyA, syB );
+        }
+    }
+
+    TARGET_AVX2 static void sobelRowXFloat_avx2( const float* syA, const float* dyA, const float* syB, const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { sobelVoxelX( syA, dyA, syB, xm, x, xp, gx, gy, gz ); } );
+        const __m256 norm = _mm256_set1_ps( sobelNorm );
+        int32_t x = 1;
+        for (; x + 8 <= dimX - 1; x += 8) {
+            _mm256_storeu_ps( gx + x, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( syA + x + 1 ), _mm256_loadu_ps( syA + x - 1 ) ), norm ) );
+            _mm256_storeu_ps( gy + x, _mm256_mul_ps( smoothXFloat_avx2( dyA + x ), norm ) );
+            _mm256_storeu_ps( gz + x, _mm256_mul_ps( smoothXFloat_avx2( syB + x ), norm ) );
+        }
+        for (; x < dimX - 1; x++) {
+            sobelVoxelX( syA, dyA, syB, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    TARGET_AVX2 static void centralDifferencesRowFloat_avx2( const float* const rows[5], const int32_t dimX, float* gx, float* gy, float* gz ) {
+        rowBorders( dimX, [&]( int32_t xm, int32_t x, int32_t xp ) { centralDifferencesVoxel( rows, xm, x, xp, gx, gy, gz ); } );
+        const __m256 half = _mm256_set1_ps( 0.5f );
+        int32_t x = 1;
+        for (; x + 8 <= dimX - 1; x += 8) {
+            _mm256_storeu_ps( gx + x, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( rows[4] + x + 1 ), _mm256_loadu_ps( rows[4] + x - 1 ) ), half ) );
+            _mm256_storeu_ps( gy + x, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( rows[1] + x ), _mm256_loadu_ps( rows[0] + x ) ), half ) );
+            _mm256_storeu_ps( gz + x, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( rows[3] + x ), _mm256_loadu_ps( rows[2] + x ) ), half ) );
+        }
+        for (; x < dimX - 1; x++) {
+            centralDifferencesVoxel( rows, x - 1, x, x + 1, gx, gy, gz );
+        }
+    }
+
+    TARGET_AVX2 static void storeRowFloat3_avx2( const float* gx, const float* gy, const float* gz, const int32_t dimX, vec3_t* normals ) {
+        int32_t x = 0;
+        for (; x + 8 <= dimX; x += 8) {
+            storeInterleaved8( _mm256_loadu_ps( gx + x ), _mm256_loadu_ps( gy + x ), _mm256_loadu_ps( gz + x ), normals[x].data() );
+        }
+        storeRowFloat3_scalar( gx + x, gy + x, gz + x, dimX - x, normals + x );
+    }
+
+    TARGET_AVX2 static inline __m256 abs_avx2( const __m256 v ) { return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), v ); }
+    TARGET_AVX2 static inline __m256i quantizeU16_avx2( const __m256 v ) {
+        return _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( v, _mm256_setzero_ps() ), _mm256_set1_ps( 65535.0f ) ) );
+    }
+
+    // mirrors octahedralVoxel() operation by operation
+    TARGET_AVX2 static void storeRowOctahedral_avx2( const float* gx, const float* gy, const float* gz, const int32_t dimX, const float magnitudeScale, packedNormal_t* normals ) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps( 1.0f );
+        const __m256 minusOne = _mm256_set1_ps( -1.0f );
+        const __m256 half = _mm256_set1_ps( 0.5f );
+        const __m256 maxU16 = _mm256_set1_ps( 65535.0f );
+        const __m256 magScale = _mm256_set1_ps( magnitudeScale );
+        int32_t x = 0;
+        for (; x + 8 <= dimX; x += 8) {
+            const __m256 vx = _mm256_loadu_ps( gx + x );
+            const __m256 vy = _mm256_loadu_ps( gy + x );
+            const __m256 vz = _mm256_loadu_ps( gz + x );
+            const __m256 l1 = _mm256_add_ps( _mm256_add_ps( abs_avx2( vx ), abs_avx2( vy ) ), abs_avx2( vz ) );
+            const __m256 recipL1 = _mm256_and_ps( _mm256_cmp_ps( l1, zero, _CMP_GT_OQ ), _mm256_div_ps( one, _mm256_max_ps( l1, _mm256_set1_ps( 1e-30f ) ) ) );
+            const __m256 px = _mm256_mul_ps( vx, recipL1 );
+            const __m256 py = _mm256_mul_ps( vy, recipL1 );
+            const __m256 foldedX = _mm256_mul_ps( _mm256_sub_ps( one, abs_avx2( py ) ), _mm256_blendv_ps( minusOne, one, _mm256_cmp_ps( px, zero, _CMP_GE_OQ ) ) );
+            const __m256 foldedY = _mm256_mul_ps( _mm256_sub_ps( one, abs_avx2( px ) ), _mm256_blendv_ps( minusOne, one, _mm256_cmp_ps( py, zero, _CMP_GE_OQ ) ) );
+            const __m256 lowerHemisphere = _mm256_cmp_ps( vz, zero, _CMP_LT_OQ );
+            const __m256 ox = _mm256_blendv_ps( px, foldedX, lowerHemisphere );
+            const __m256 oy = _mm256_blendv_ps( py, foldedY, lowerHemisphere );
+            const __m256 mag = _mm256_sqrt_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( vx, vx ), _mm256_mul_ps( vy, vy ) ), _mm256_mul_ps( vz, vz ) ) );
+
+            alignas( 32 ) int32_t qu[8], qv[8], qm[8];
+            _mm256_store_si256( reinterpret_cast<__m256i*>( qu ), quantizeU16_avx2( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( ox, half ), half ), maxU16 ) ) );
+            _mm256_store_si256( reinterpret_cast<__m256i*>( qv ), quantizeU16_avx2( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( oy, half ), half ), maxU16 ) ) );
+            _mm256_store_si256( reinterpret_cast<__m256i*>( qm ), quantizeU16_avx2( _mm256_mul_ps( mag, magScale ) ) );
+            for (int32_t i = 0; i < 8; i++) {
+                normals[x + i] = packedNormal_t{ static_cast<uint16_t>( qu[i] ), static_cast<uint16_t>( qv[i] ), static_cast<uint16_t>( qm[i] ) };
+            }
+        }
+        storeRowOctahedral_scalar( gx + x, gy + x, gz + x, dimX - x, magnitudeScale, normals + x );
+    }
+
+    // 16 densities per iteration
+    TARGET_AVX2 static void densityRangeU16_avx2( const uint16_t* densities, const int32_t count, uint16_t& minNonZero, uint16_t& maxDensity ) {
+        const __m256i one = _mm256_set1_epi16( 1 );
+        __m256i minMinusOne = _mm256_set1_epi16( static_cast<int16_t>( 0xFFFF ) );
+        __m256i maxValue = _mm256_setzero_si256();
+        int32_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( densities + i ) );
+            minMinusOne = _mm256_min_epu16( minMinusOne, _mm256_sub_epi16( v, one ) );
+            maxValue = _mm256_max_epu16( maxValue, v );
+        }
+        alignas( 32 ) uint16_t lanesMin[16], lanesMax[16];
+        _mm256_store_si256( reinterpret_cast<__m256i*>( lanesMin ), minMinusOne );
+        _mm256_store_si256( reinterpret_cast<__m256i*>( lanesMax ), maxValue );
+        mergeRangeLanes( lanesMin, lanesMax, 16, minNonZero, maxDensity );
+        densityRange_scalar( densities + i, count - i, minNonZero, maxDensity );
+    }
+
+    TARGET_AVX2 static void densityRangeU8_avx2( const uint8_t* densities, const int32_t count, uint8_t& minNonZero, uint8_t& maxDensity ) {
+        const __m256i one = _mm256_set1_epi8( 1 );
+        __m256i minMinusOne = _mm256_set1_epi8( static_cast<int8_t>( 0xFF ) );
+        __m256i maxValue = _mm256_setzero_si256();
+        int32_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+            const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( densities + i ) );
+            minMinusOne = _mm256_min_epu8( minMinusOne, _mm256_sub_epi8( v, one ) );
+            maxValue = _mm256_max_epu8( maxValue, v );
+        }
+        alignas( 32 ) uint8_t lanesMin[32], lanesMax[32];
+        _mm256_store_si256( reinterpret_cast<__m256i*>( lanesMin ), minMinusOne );
+        _mm256_store_si256( reinterpret_cast<__m256i*>( lanesMax ), maxValue );
+        mergeRangeLanes( lanesMin, lanesMax, 32, minNonZero, maxDensity );
+        densityRange_scalar( densities + i, count - i, minNonZero, maxDensity );
+    }
+
+    TARGET_AVX2 static void densityRangeFloat_avx2( const float* values, const int32_t count, float& minValue, float& maxValue ) {
+        __m256 lowest = _mm256_set1_ps( minValue );
+        __m256 highest = _mm256_set1_ps( maxValue );
+        int32_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256 v = _mm256_loadu_ps( values + i );
+            lowest = _mm256_min_ps( v, lowest );
+            highest = _mm256_max_ps( v, highest );
+        }
+        alignas( 32 ) float lanesMin[8], lanesMax[8];
+        _mm256_store_ps( lanesMin, lowest );
+        _mm256_store_ps( lanesMax, highest );
+        mergeRangeLanesFloat( lanesMin, lanesMax, 8, minValue, maxValue );
+        densityRange_scalar( values + i, count - i, minValue, maxValue );
+    }
+
+    TARGET_AVX2 static void columnMinMaxU16_avx2( const uint16_t* densities, const int32_t count, uint16_t* columnMin, uint16_t* columnMax ) {
+        int32_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( densities + i ) );
+            __m256i* const pColMin = reinterpret_cast<__m256i*>( columnMin + i );
+            __m256i* const pColMax = reinterpret_cast<__m256i*>( columnMax + i );
+            _mm256_storeu_si256( pColMin, _mm256_min_epu16( _mm256_loadu_si256( pColMin ), v ) );
+            _mm256_storeu_si256( pColMax, _mm256_max_epu16( _mm256_loadu_si256( pColMax ), v ) );
+        }
+        columnMinMax_scalar( densities + i, count - i, columnMin + i, columnMax + i );
+    }
+
+    TARGET_AVX2 static void columnMinMaxU8_avx2( const uint8_t* densities, const int32_t count, uint8_t* columnMin, uint8_t* columnMax ) {
+        int32_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+            const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( densities + i ) );
+            __m256i* const pColMin = reinterpret_cast<__m256i*>( columnMin + i );
+            __m256i* const pColMax = reinterpret_cast<__m256i*>( columnMax + i );
+            _mm256_storeu_si256( pColMin, _mm256_min_epu8( _mm256_loadu_si256( pColMin ), v ) );
+            _mm256_storeu_si256( pColMax, _mm256_max_epu8( _mm256_loadu_si256( pColMax ), v ) );
+        }
+        columnMinMax_scalar( densities + i, count - i, columnMin + i, columnMax + i );
+    }
+
+    TARGET_AVX2 static void columnMinMaxFloat_avx2( const float* values, const int32_t count, float* columnMin, float* columnMax ) {
+        int32_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const __m256 v = _mm256_loadu_ps( values + i );
+            _mm256_storeu_ps( columnMin + i, _mm256_min_ps( v, _mm256_loadu_ps( columnMin + i ) ) );
+            _mm256_storeu_ps( columnMax + i, _mm256_max_ps( v, _mm256_loadu_ps( columnMax + i ) ) );
+        }
+        columnMinMax_scalar( values + i, count - i, columnMin + i, columnMax + i );
+    }
+
+    TARGET_AVX2 static inline void trilinearAxis_avx2( const __m256 p, const __m256 maxCoord, const __m256 maxCorner, __m256& c0, __m256& f ) {
+        const __m256 c = _mm256_min_ps( _mm256_max_ps( p, _mm256_setzero_ps() ), maxCoord );
+        c0 = _mm256_min_ps( _mm256_cvtepi32_ps( _mm256_cvttps_epi32( c ) ), maxCorner );
+        f = _mm256_sub_ps( c, c0 );
+    }
+
+    TARGET_AVX2 static inline void trilinearVoxel_avx2( const __m256 d[8], const __m256 fx, const __m256 fy, const __m256 fz, const int32_t i,
+                                                        float* densities, float* gx, float* gy, float* gz ) {
+        const __m256 ex00 = _mm256_sub_ps( d[1], d[0] );
+        const __m256 ex10 = _mm256_sub_ps( d[3], d[2] );
+        const __m256 ex01 = _mm256_sub_ps( d[5], d[4] );
+        const __m256 ex11 = _mm256_sub_ps( d[7], d[6] );
+        const __m256 c00 = _mm256_add_ps( d[0], _mm256_mul_ps( fx, ex00 ) );
+        const __m256 c10 = _mm256_add_ps( d[2], _mm256_mul_ps( fx, ex10 ) );
+        const __m256 c01 = _mm256_add_ps( d[4], _mm256_mul_ps( fx, ex01 ) );
+        const __m256 c11 = _mm256_add_ps( d[6], _mm256_mul_ps( fx, ex11 ) );
+        const __m256 ey0 = _mm256_sub_ps( c10, c00 );
+        const __m256 ey1 = _mm256_sub_ps( c11, c01 );
+        const __m256 c0 = _mm256_add_ps( c00, _mm256_mul_ps( fy, ey0 ) );
+        const __m256 c1 = _mm256_add_ps( c01, _mm256_mul_ps( fy, ey1 ) );
+        _mm256_storeu_ps( densities + i, _mm256_add_ps( c0, _mm256_mul_ps( fz, _mm256_sub_ps( c1, c0 ) ) ) );
+        if (gx) {
+            const __m256 ex0 = _mm256_add_ps( ex00, _mm256_mul_ps( fy, _mm256_sub_ps( ex10, ex00 ) ) );
+            const __m256 ex1 = _mm256_add_ps( ex01, _mm256_mul_ps( fy, _mm256_sub_ps( ex11, ex01 ) ) );
+            _mm256_storeu_ps( gx + i, _mm256_add_ps( ex0, _mm256_mul_ps( fz, _mm256_sub_ps( ex1, ex0 ) ) ) );
+            _mm256_storeu_ps( gy + i, _mm256_add_ps( ey0, _mm256_mul_ps( fz, _mm256_sub_ps( ey1, ey0 ) ) ) );
+            _mm256_storeu_ps( gz + i, _mm256_sub_ps( c1, c0 ) );
+        }
+    }
+
+    // corner addresses of the four rows ( y0 | y1, z0 | z1 ) of the cells, in voxels
+    TARGET_AVX2 static inline void trilinearRowAddrs_avx2( const __m256 c0[3], const int32_t dim[3], __m256i rowAddr[4] ) {
+        const __m256i stepY = _mm256_set1_epi32( ( dim[1] > 1 ) ? dim[0] : 0 );
+        const __m256i stepZ = _mm256_set1_epi32( ( dim[2] > 1 ) ? dim[0] * dim[1] : 0 );
+        const __m256i addr = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_add_epi32( _mm256_mullo_epi32( _mm256_cvttps_epi32( c0[2] ), _mm256_set1_epi32( dim[1] ) ),
+                                                                                     _mm256_cvttps_epi32( c0[1] ) ), _mm256_set1_epi32( dim[0] ) ),
+                                               _mm256_cvttps_epi32( c0[0] ) );
+        rowAddr[0] = addr;
+        rowAddr[1] = _mm256_add_epi32( addr, stepY );
+        rowAddr[2] = _mm256_add_epi32( addr, stepZ );
+        rowAddr[3] = _mm256_add_epi32( _mm256_add_epi32( addr, stepY ), stepZ );
+    }
+
+    // Every 32 bit gather fetches the voxel pair ( x0, x0 + 1 ) of one of the four corner rows, which never reads past the
+    // grid as long as x0 <= dimX - 2. The gather indices are signed 32 bit, larger grids take the SSE2 kernel.
+    TARGET_AVX2 static void sampleTrilinearU16_avx2( const trilinearGrid_t< uint16_t >& grid, const float* px, const float* py, const float* pz, const int32_t count,
+                                                     float* densities, float* gx, float* gy, float* gz ) {
+        const uint64_t numVoxels = static_cast<uint64_t>( grid.dim[0] ) * grid.dim[1] * grid.dim[2];
+        if (grid.numBricks[0] != 0 || grid.dim[0] < 2 || numVoxels > static_cast<uint64_t>( INT32_MAX )) {
+            sampleTrilinear_sse2( grid, px, py, pz, count, densities, gx, gy, gz );
+            return;
+        }
+        __m256 maxCoord[3], maxCorner[3];
+        for (int32_t axis = 0; axis < 3; axis++) {
+            maxCoord[axis] = _mm256_set1_ps( static_cast<float>( grid.dim[axis] - 1 ) );
+            maxCorner[axis] = _mm256_set1_ps( static_cast<float>( std::max( grid.dim[axis] - 2, 0 ) ) );
+        }
+        const __m256i lowHalf = _mm256_set1_epi32( 0xFFFF );
+        const int* const pPairs = reinterpret_cast<const int*>( grid.pVoxels );
+        int32_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 c0[3], f[3];
+            trilinearAxis_avx2( _mm256_loadu_ps( px + i ), maxCoord[0], maxCorner[0], c0[0], f[0] );
+            trilinearAxis_avx2( _mm256_loadu_ps( py + i ), maxCoord[1], maxCorner[1], c0[1], f[1] );
+            trilinearAxis_avx2( _mm256_loadu_ps( pz + i ), maxCoord[2], maxCorner[2], c0[2], f[2] );
+            __m256i rowAddr[4];
+            trilinearRowAddrs_avx2( c0, grid.dim, rowAddr );
+            __m256 d[8];
+            for (int32_t row = 0; row < 4; row++) {
+                const __m256i pair = _mm256_i32gather_epi32( pPairs, rowAddr[row], 2 );
+                d[2 * row] = _mm256_cvtepi32_ps( _mm256_and_si256( pair, lowHalf ) );
+                d[2 * row + 1] = _mm256_cvtepi32_ps( _mm256_srli_epi32( pair, 16 ) );
+            }
+            trilinearVoxel_avx2( d, f[0], f[1], f[2], i, densities, gx, gy, gz );
+        }
+        sampleTrilinearRemainder( grid, px, py, pz, i, count, densities, gx, gy, gz );
+    }
+
+    // two float gathers per corner row, same limits as the uint16_t kernel
+    TARGET_AVX2 static void sampleTrilinearFloat_avx2( const trilinearGrid_t< float >& grid, const float* px, const float* py, const float* pz, const int32_t count,
+                                                       float* densities, float* gx, float* gy, float* gz ) {
+        const uint64_t numVoxels = static_cast<uint64_t>( grid.dim[0] ) * grid.dim[1] * grid.dim[2];
+        if (grid.numBricks[0] != 0 || grid.dim[0] < 2 || numVoxels > static_cast<uint64_t>( INT32_MAX )) {
+            sampleTrilinear_sse2( grid, px, py, pz, count, densities, gx, gy, gz );
+            return;
+        }
+        __m256 maxCoord[3], maxCorner[3];
+        for (int32_t axis = 0; axis < 3; axis++) {
+            maxCoord[axis] = _mm256_set1_ps( static_cast<float>( grid.dim[axis] - 1 ) );
+            maxCorner[axis] = _mm256_set1_ps( static_cast<float>( std::max( grid.dim[axis] - 2, 0 ) ) );
+        }
+        int32_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 c0[3], f[3];
+            trilinearAxis_avx2( _mm256_loadu_ps( px + i ), maxCoord[0], maxCorner[0], c0[0], f[0] );
+            trilinearAxis_avx2( _mm256_loadu_ps( py + i ), maxCoord[1], maxCorner[1], c0[1], f[1] );
+            trilinearAxis_avx2( _mm256_loadu_ps( pz + i ), maxCoord[2], maxCorner[2], c0[2], f[2] );
+            __m256i rowAddr[4];
+            trilinearRowAddrs_avx2( c0, grid.dim, rowAddr );
+            __m256 d[8];
+            for (int32_t row = 0; row < 4; row++) {
+                d[2 * row] = _mm256_i32gather_ps( grid.pVoxels, rowAddr[row], 4 );
+                d[2 * row + 1] = _mm256_i32gather_ps( grid.pVoxels + 1, rowAddr[row], 4 );
+            }
+            trilinearVoxel_avx2( d, f[0], f[1], f[2], i, densities, gx, gy, gz );
+        }
+        sampleTrilinearRemainder( grid, px, py, pz, i, count, densities, gx, gy, gz );
+    }
+
+    static simdLevel_t queryCpuSimdLevel() {
+    #if defined( _MSC_VER ) && !defined( __clang__ )
+        int32_t info[4];
+        __cpuid( info, 0 );
+        const int32_t maxLeaf = info[0];
+        __cpuid( info, 1 );
+        const bool hasSse2 = ( info[3] & ( 1 << 26 ) ) != 0;
+        const bool hasAvx = ( info[2] & ( 1 << 28 ) ) != 0;
+        const bool hasOsXsave = ( info[2] & ( 1 << 27 ) ) != 0;
+        const bool osSavesYmm = hasOsXsave && ( ( _xgetbv( 0 ) & 0x6 ) == 0x6 );
+        bool hasAvx2 = false;
+        if (maxLeaf >= 7) {
+            __cpuidex( info, 7, 0 );
+            hasAvx2 = ( info[1] & ( 1 << 5 ) ) != 0;
+        }
+        if (hasAvx && hasAvx2 && osSavesYmm) { return simdLevel_t::AVX2; }
+        if (hasSse2) { return simdLevel_t::SSE2; }
+    #else
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports( "avx2" )) { return simdLevel_t::AVX2; }
+        if (__builtin_cpu_supports( "sse2" )) { return simdLevel_t::SSE2; }
+    #endif
+        return simdLevel_t::SCALAR;
+    }
+
+#endif // GRADIENT_KERNELS_X86
+
+    template< typename voxel_T >
+    constexpr voxelKernels_t< voxel_T > voxelKernelsScalar{
+        sobelRowYZ_scalar< voxel_T >, sobelRowX_scalar< sum_t< voxel_T > >, centralDifferencesRow_scalar< voxel_T >, 
+        densityRange_scalar< voxel_T >, columnMinMax_scalar< voxel_T >, sampleTrilinear_scalar< voxel_T > };
+
+    constexpr rowKernels_t rowKernelsScalar{ 
+        voxelKernelsScalar< uint8_t >, voxelKernelsScalar< uint16_t >, voxelKernelsScalar< float >, 
+        storeRowFloat3_scalar, storeRowOctahedral_scalar, simdLevel_t::SCALAR };
+#if ( GRADIENT_KERNELS_X86 != 0 )
+    constexpr rowKernels_t rowKernelsSse2{ 
+        { sobelRowYZ_sse2< uint8_t >, sobelRowX_sse2, centralDifferencesRow_sse2< uint8_t >, densityRangeU8_sse2, columnMinMaxU8_sse2, sampleTrilinear_sse2< uint8_t > },
+        { sobelRowYZ_sse2< uint16_t >, sobelRowX_sse2, centralDifferencesRow_sse2< uint16_t >, densityRangeU16_sse2, columnMinMaxU16_sse2, sampleTrilinear_sse2< uint16_t > },
+        { sobelRowYZFloat_sse2, sobelRowXFloat_sse2, centralDifferencesRowFloat_sse2, densityRangeFloat_sse2, columnMinMaxFloat_sse2, sampleTrilinear_sse2< float > },
+        storeRowFloat3_sse2, storeRowOctahedral_sse2, simdLevel_t::SSE2 };
+    // 8 bit voxels have no pair gather (a 32 bit gather at the last voxel pair would read past the grid), they sample with SSE2
+    constexpr rowKernels_t rowKernelsAvx2{ 
+        { sobelRowYZ_avx2< uint8_t >, sobelRowX_avx2, centralDifferencesRow_avx2< uint8_t >, densityRangeU8_avx2, columnMinMaxU8_avx2, sampleTrilinear_sse2< uint8_t > },
+        { sobelRowYZ_avx2< uint16_t >, sobelRowX_avx2, centralDifferencesRow_avx2< uint16_t >, densityRangeU16_avx2, columnMinMaxU16_avx2, sampleTrilinearU16_avx2 },
+        { sobelRowYZFloat_avx2, sobelRowXFloat_avx2, centralDifferencesRowFloat_avx2, densityRangeFloat_avx2, columnMinMaxFloat_avx2, sampleTrilinearFloat_avx2 },
+        storeRowFloat3_avx2, storeRowOctahedral_avx2, simdLevel_t::AVX2 };
+#endif
+}
+
+simdLevel_t gradientKernels::detectSimdLevel() {
+#if ( GRADIENT_KERNELS_X86 != 0 )
+    static const simdLevel_t simdLevel = queryCpuSimdLevel();
+    return simdLevel;
+#else
+    return simdLevel_t::SCALAR;
+#endif
+}
+
+const rowKernels_t& gradientKernels::getRowKernels( const simdLevel_t simdLevel ) {
+#if ( GRADIENT_KERNELS_X86 != 0 )
+    if (simdLevel == simdLevel_t::AVX2) { return rowKernelsAvx2; }
+    if (simdLevel == simdLevel_t::SSE2) { return rowKernelsSse2; }
+#endif
+    (void)simdLevel;
+    return rowKernelsScalar;
+}
@@ -0,0 +1,89 @@
+#ifndef _VOLUMEGRADIENTKERNELS_H_FAAC5033_5D73_40D3_A065_CB522BA1BB3C
+#define _VOLUMEGRADIENTKERNELS_H_FAAC5033_5D73_40D3_A065_CB522BA1BB3C
+
+#include <stdint.h>
+
+#include <array>
+#include <type_traits>
+
+namespace FileLoader {
+    namespace gradientKernels {
+
+        enum class simdLevel_t {
+            SCALAR  = 0,
+            SSE2    = 1,
+            AVX2    = 2,
+        };
+
+        // 2x16 bit octahedral direction + 16 bit magnitude, see VolumeData::normalStorage_t
+        using packedNormal_t = std::array<uint16_t, 3>;
+
+        // voxel grid read by the trilinear sampling kernels
+        template< typename voxel_T >
+        struct trilinearGrid_t {
+            const voxel_T*  pVoxels;
+            int32_t         dim[3];
+            // BRICKED layout (see VolumeData::calcDensityAddr()): bricks of 2^brickSizeLog2 voxels per axis, numBricks[0] == 0: LINEAR
+            int32_t         numBricks[2];
+            int32_t         brickSizeLog2;
+        };
+
+        // Kernels reading the voxels of a volume, there is one table per voxel type (uint8_t, uint16_t, float). The row kernels 
+        // process a row (segment) of dimX voxels and clamp at both of its ends, the clamping of the y/z neighbour rows is done 
+        // by the caller when it picks the row pointers. Integer voxels are summed exactly in int32_t, float voxels in float 
+        // with the same order of operations on all levels, so every level produces the same bits.
+        template< typename voxel_T >
+        struct voxelKernels_t {
+            using sum_t = typename std::conditional< std::is_floating_point< voxel_T >::value, float, int32_t >::type;
+
+            // yz-pass of the separable Sobel; rows[dz][dy] point to the rows at (y-1+dy, z-1+dz)
+            void (*sobelRowYZ)( const voxel_T* const rows[3][3], const int32_t dimX, sum_t* syA, sum_t* dyA, sum_t* syB );
+            // x-pass of the separable Sobel, produces the final gradients of the row
+            void (*sobelRowX)( const sum_t* syA, const sum_t* dyA, const sum_t* syB, const int32_t dimX, float* gx, float* gy, float* gz );
+            // rows[0..4] point to the rows at (y-1,z), (y+1,z), (y,z-1), (y,z+1), (y,z)
+            void (*centralDifferencesRow)( const voxel_T* const rows[5], const int32_t dimX, float* gx, float* gy, float* gz );
+
+            // Lowers minValue to the smallest voxel and raises maxValue to the largest voxel of the run. 
+            // Integer voxels skip 0 (the background) for the minimum, float voxels take all values.
+            void (*densityRange)( const voxel_T* voxels, const int32_t count, voxel_T& minValue, voxel_T& maxValue );
+            // element-wise columnMin[i] = min( columnMin[i], voxels[i] ) and columnMax[i] = max( columnMax[i], voxels[i] )
+            void (*columnMinMax)( const voxel_T* voxels, const int32_t count, voxel_T* columnMin, voxel_T* columnMax );
+
+            // Trilinear samples at count positions (px, py, pz) in voxel coordinates, clamped to [0, dim - 1] per axis.
+            // gx == nullptr: densities only, otherwise gx, gy, gz receive the derivatives of the interpolant at the clamped positions.
+            // The SIMD levels gather the corners of LINEAR grids, BRICKED grids are sampled by the scalar kernel.
+            void (*sampleTrilinear)( const trilinearGrid_t< voxel_T >& grid, const float* px, const float* py, const float* pz, const int32_t count,
+                                     float* densities, float* gx, float* gy, float* gz );
+        };
+
+        // Kernels of the gradient passes and scans of one SIMD level. The gradient kernels write a row as three float 
+        // channels (gx, gy, gz), the store kernels then move the row into the normal storage of the volume.
+        struct rowKernels_t {
+            voxelKernels_t< uint8_t >   voxelsU8;
+            voxelKernels_t< uint16_t >  voxelsU16;
+            voxelKernels_t< float >     voxelsFloat;
+
+            // interleaves the gradient channels into float triples
+            void (*storeRowFloat3)( const float* gx, const float* gy, const float* gz, const int32_t dimX, std::array<float, 3>* normals );
+            // octahedral encoding of the direction, the magnitude is quantized as round( |g| * magnitudeScale )
+            void (*storeRowOctahedral)( const float* gx, const float* gy, const float* gz, const int32_t dimX, const float magnitudeScale, packedNormal_t* normals );
+
+            simdLevel_t simdLevel;
+
+            template< typename voxel_T >
+            const voxelKernels_t< voxel_T >& voxels() const;
+        };
+
+        template<> inline const voxelKernels_t< uint8_t >&  rowKernels_t::voxels< uint8_t >() const  { return voxelsU8; }
+        template<> inline const voxelKernels_t< uint16_t >& rowKernels_t::voxels< uint16_t >() const { return voxelsU16; }
+        template<> inline const voxelKernels_t< float >&    rowKernels_t::voxels< float >() const    { return voxelsFloat; }
+
+        // highest SIMD level supported by the CPU we are running on (queried once via CPUID)
+        simdLevel_t detectSimdLevel();
+
+        // kernels for the requested level; levels not compiled in fall back to the next lower one
+        const rowKernels_t& getRowKernels( const simdLevel_t simdLevel );
+        inline const rowKernels_t& getRowKernels() { return getRowKernels( detectSimdLevel() ); }
+    }
+}
+#endif // _VOLUMEGRADIENTKERNELS_H_FAAC5033_5D73_40D3_A065_CB522BA1BB3C
@@ -0,0 +1,341 @@
+#include "volumeData.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace FileLoader;
+
+namespace {
+    // cell layers per task; fixed, so that the vertex and triangle order does not depend on the thread count
+    constexpr int32_t isosurfaceSlabDepth = 8;
+
+    // vertex ids of the plane that the next slab owns carry this bit plus their rank in the scan order of that plane
+    constexpr uint32_t foreignVertexBit = 0x80000000u;
+
+    // Corner i of a cell is at ( x + ( i & 1 ), y + ( ( i >> 1 ) & 1 ), z + ( i >> 2 ) ). Edge e runs along the
+    // axis e >> 2 from its lower corner, whose bits of the two other axes are e & 3 (the lower axis in bit 0).
+    static int32_t edgeIndex( const int32_t corner0, const int32_t corner1 ) {
+        const int32_t axis = ( ( corner0 ^ corner1 ) == 1 ) ? 0 : ( ( corner0 ^ corner1 ) == 2 ) ? 1 : 2;
+        const int32_t lowerCorner = std::min( corner0, corner1 );
+        const int32_t lowAxis = ( axis == 0 ) ? 1 : 0;
+        const int32_t highAxis = ( axis == 2 ) ? 1 : 2;
+        return axis * 4 + ( ( lowerCorner >> lowAxis ) & 1 ) + ( ( ( lowerCorner >> highAxis ) & 1 ) << 1 );
+    }
+
+    // bit 2 * axis + side for each of the two cell faces the edge lies in
+    static uint32_t edgeFaces( const int32_t edge ) {
+        const int32_t axis = edge >> 2;
+        const int32_t lowAxis = ( axis == 0 ) ? 1 : 0;
+        const int32_t highAxis = ( axis == 2 ) ? 1 : 2;
+        return ( 1u << ( 2 * lowAxis + ( edge & 1 ) ) ) | ( 1u << ( 2 * highAxis + ( ( edge >> 1 ) & 1 ) ) );
+    }
+
+    // triangles of the 256 inside/outside configurations of a cell, as edge indices
+    struct caseTable_t {
+        uint8_t     numIndices[256];
+        int8_t      edges[256][30];  // at most 12 edge vertices in loops of at least 3, so at most 10 triangles
+    };
+
+    // Instead of the classic hand-made table, the cases are derived from the faces of the cell: on every face the
+    // iso lines cut off the inside corners, so that both cells sharing a face always agree and the mesh has no cracks
+    // (on faces with two diagonal inside corners the classic table is not consistent). Each cut runs from the crossing
+    // where a counterclockwise walk around the face (seen from outside the cell) leaves the inside corners back to
+    // where it entered them; the cuts of all faces chain up to closed loops, which are triangulated as fans.
+    static caseTable_t buildCaseTable() {
+        caseTable_t table = {};
+        for (int32_t caseIdx = 0; caseIdx < 256; caseIdx++) {
+            auto inside = [caseIdx]( const int32_t corner ) { return ( ( caseIdx >> corner ) & 1 ) != 0; };
+
+            int32_t nextEdge[12];
+            std::fill( nextEdge, nextEdge + 12, -1 );
+            for (int32_t axis = 0; axis < 3; axis++) {
+                for (int32_t side = 0; side < 2; side++) {
+                    const int32_t u = 1 << ( ( axis + 1 ) % 3 );
+                    const int32_t v = 1 << ( ( axis + 2 ) % 3 );
+                    const int32_t base = side << axis;
+                    int32_t corners[4] = { base, base | u, base | u | v, base | v }; // counterclockwise around +axis
+                    if (side == 0) { std::reverse( corners, corners + 4 ); }
+
+                    for (int32_t j = 0; j < 4; j++) {
+                        if (!inside( corners[j] ) || inside( corners[( j + 1 ) & 3] )) { continue; }
+                        for (int32_t k = 1; k < 4; k++) {
+                            if (!inside( corners[( j - k ) & 3] )) {
+                                nextEdge[ edgeIndex( corners[j], corners[( j + 1 ) & 3] ) ] = edgeIndex( corners[( j - k ) & 3], corners[( j - k + 1 ) & 3] );
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+
+            bool visited[12] = {};
+            uint8_t numIndices = 0;
+            for (int32_t firstEdge = 0; firstEdge < 12; firstEdge++) {
+                if (nextEdge[firstEdge] < 0 || visited[firstEdge]) { continue; }
+                int32_t loop[12];
+                int32_t loopSize = 0;
+                for (int32_t edge = firstEdge; !visited[edge]; edge = nextEdge[edge]) {
+                    visited[edge] = true;
+                    loop[loopSize++] = edge;
+                }
+                // The fan starts at the loop vertex with the fewest diagonals to vertices on a common face; such a diagonal
+                // would lay a triangle into the face, where the neighbouring cell may put one as well.
+                int32_t fanStart = 0;
+                int32_t minNumFaceDiagonals = std::numeric_limits< int32_t >::max();
+                for (int32_t start = 0; start < loopSize; start++) {
+                    int32_t numFaceDiagonals = 0;
+                    for (int32_t i = 2; i + 1 < loopSize; i++) {
+                        numFaceDiagonals += ( edgeFaces( loop[start] ) & edgeFaces( loop[( start + i ) % loopSize] ) ) != 0;
+                    }
+                    if (numFaceDiagonals < minNumFaceDiagonals) {
+                        minNumFaceDiagonals = numFaceDiagonals;
+                        fanStart = start;
+                    }
+                }
+                // the loops run counterclockwise seen from the inside corners, the triangles are turned towards the outside
+                for (int32_t i = 1; i + 1 < loopSize; i++) {
+                    table.edges[caseIdx][numIndices++] = static_cast<int8_t>( loop[fanStart] );
+                    table.edges[caseIdx][numIndices++] = static_cast<int8_t>( loop[( fanStart + i + 1 ) % loopSize] );
+                    table.edges[caseIdx][numIndices++] = static_cast<int8_t>( loop[( fanStart + i ) % loopSize] );
+                }
+            }
+            table.numIndices[caseIdx] = numIndices;
+        }
+        return table;
+    }
+
+    static const caseTable_t& getCaseTable() {
+        static const caseTable_t caseTable = buildCaseTable();
+        return caseTable;
+    }
+
+    struct isoVertex_t {
+        float       coord[3];
+        float       t;          // position between the voxels addr0 and addr1, for the normal
+        uint64_t    addr0;
+        uint64_t    addr1;
+    };
+}
+
+eRetVal VolumeData::extractIsosurface( const float isoValue, isosurface_t& isosurface ) {
+    isosurface.coords.clear();
+    isosurface.normals.clear();
+    isosurface.indices.clear();
+
+    const int32_t dimX = mDim[0];
+    const int32_t dimY = mDim[1];
+    const int32_t dimZ = mDim[2];
+    if (mNumVoxels == 0 || dimX < 2 || dimY < 2 || dimZ < 2) { return eRetVal::OK; } // no cells
+
+    // density >= isoValue <=> density >= threshold for integer densities. Float voxels are compared with isoValue itself,
+    // the threshold is the density key of isoValue for the min/max tree then: every value below isoValue has a tree key 
+    // below it, every value above one at or above it. Only NaN voxels can be outside if isoValue <= the smallest value, 
+    // their key 0 is not below the threshold 0, so the tree does not cull anything then.
+    const bool floatVoxels = ( mVoxelType == voxelType_t::FLOAT32 );
+    const int32_t threshold = ( floatVoxels ) ? static_cast<int32_t>( ceil( densityKeyOf( isoValue ) ) ) 
+                                              : static_cast<int32_t>( std::min( std::max( ceilf( isoValue ), 0.0f ), 65536.0f ) );
+    const bool cullMacroCells = !mMinMaxLevels.empty() && !( floatVoxels && isoValue <= mValueRange[0] );
+    const caseTable_t& caseTable = getCaseTable();
+
+    const size_t planeSize = static_cast<size_t>( dimX ) * dimY;
+    const int32_t numMacroCellsX = ( dimX + mMacroCellSize - 1 ) >> mMacroCellSizeLog2;
+    auto isMacroCellActive = [&]( const int32_t cellX, const int32_t cellY, const int32_t cellZ ) {
+        if (!cullMacroCells) { return true; }
+        const u16vec2_t& minMax = getMacroCellMinMax( 0, cellX, cellY, cellZ );
+        return minMax[0] < threshold && minMax[1] >= threshold;
+    };
+
+    struct slab_t {
+        std::vector< isoVertex_t >  vertices;
+        std::vector< uint32_t >     indices;    // into vertices, or foreignVertexBit | rank in the first plane of the next slab
+        i32vec3_t                   boxMin = { std::numeric_limits< int32_t >::max(), std::numeric_limits< int32_t >::max(), std::numeric_limits< int32_t >::max() };
+        i32vec3_t                   boxMax = { 0, 0, 0 };
+    };
+    // the vertex ids of the x- and y-edges of the planes z and z + 1 and of the z-edges in between
+    struct slabScratch_t {
+        std::vector< uint8_t >      planes[2];  // bricked densities only
+        std::vector< uint32_t >     xEdgeIds[2];
+        std::vector< uint32_t >     yEdgeIds[2];
+        std::vector< uint32_t >     zEdgeIds;
+    };
+
+    const int32_t numCellLayers = dimZ - 1;
+    const int32_t numSlabs = ( numCellLayers + isosurfaceSlabDepth - 1 ) / isosurfaceSlabDepth;
+    std::vector< slab_t > slabs( numSlabs );
+    std::vector< slabScratch_t > slabScratches( mpExecutionContext->getNumThreads() );
+
+    // the slabs are scanned with the voxels at their own width
+    visitVoxelType( [&]( auto voxelTag ) {
+        using voxel_T = decltype( voxelTag );
+        const auto inside = [&]( const voxel_T density ) -> bool {
+            return ( floatVoxels ) ? static_cast<float>( density ) >= isoValue : static_cast<int32_t>( density ) >= threshold;
+        };
+
+        mpExecutionContext->parallelForSlots( 0, numSlabs, 1, [&]( const int64_t slabIdx, const uint32_t slot ) {
+            slab_t& slab = slabs[slabIdx];
+            slabScratch_t& scratch = slabScratches[slot];
+            for (int32_t i = 0; i < 2; i++) {
+                scratch.xEdgeIds[i].resize( planeSize );
+                scratch.yEdgeIds[i].resize( planeSize );
+                if (mDensityLayout != densityLayout_t::LINEAR) { scratch.planes[i].resize( planeSize * sizeof( voxel_T ) ); }
+            }
+            scratch.zEdgeIds.resize( planeSize );
+
+            auto getPlane = [&]( const int32_t z ) -> const voxel_T* {
+                if (mDensityLayout == densityLayout_t::LINEAR) { return voxelData< voxel_T >() + calcAddr( 0, 0, z ); }
+                voxel_T* const pPlane = reinterpret_cast< voxel_T* >( scratch.planes[z & 1].data() );
+                for (int32_t y = 0; y < dimY; y++) { gatherDensityRow( 0, dimX, y, z, pPlane + static_cast<size_t>( y ) * dimX ); }
+                return pPlane;
+            };
+
+            uint32_t numForeignVertices = 0;
+            auto addVertex = [&]( const bool owned, const int32_t x, const int32_t y, const int32_t z, const int32_t axis,
+                                  const float density0, const float density1 ) -> uint32_t {
+                if (!owned) { return foreignVertexBit | numForeignVertices++; }
+                // an edge to a NaN voxel gets its vertex at the other end
+                float t = ( isoValue - density0 ) / ( density1 - density0 );
+                t = ( t >= 0.0f ) ? std::min( t, 1.0f ) : 0.0f;
+                isoVertex_t vertex = { { static_cast<float>( x ), static_cast<float>( y ), static_cast<float>( z ) }, t, calcAddr( x, y, z ), 0 };
+                i32vec3_t voxel1 = { x, y, z };
+                voxel1[axis]++;
+                vertex.coord[axis] += t;
+                vertex.addr1 = calcAddr( voxel1[0], voxel1[1], voxel1[2] );
+                for (int32_t dimIdx = 0; dimIdx < 3; dimIdx++) {
+                    slab.boxMin[dimIdx] = std::min( slab.boxMin[dimIdx], ( dimIdx == 0 ) ? x : ( dimIdx == 1 ) ? y : z );
+                    slab.boxMax[dimIdx] = std::max( slab.boxMax[dimIdx], voxel1[dimIdx] + 1 );
+                }
+                slab.vertices.push_back( vertex );
+                return static_cast<uint32_t>( slab.vertices.size() - 1 );
+            };
+
+            // Vertices on the x- and y-edges of plane z, in row order. The next slab starts with its first plane, so
+            // the slab before it can tell the rank of each vertex there by scanning the plane the same way.
+            auto scanPlaneEdges = [&]( const voxel_T* pPlane, const int32_t z, const bool owned, uint32_t* pXEdgeIds, uint32_t* pYEdgeIds ) {
+                for (int32_t y = 0; y < dimY; y++) {
+                    const voxel_T* const pRow = pPlane + static_cast<size_t>( y ) * dimX;
+                    for (int32_t cellX = 0; cellX < numMacroCellsX; cellX++) {
+                        if (!isMacroCellActive( cellX, y >> mMacroCellSizeLog2, z >> mMacroCellSizeLog2 )) { continue; }
+                        for (int32_t x = cellX * mMacroCellSize, xEnd = std::min( x + mMacroCellSize, dimX ); x < xEnd; x++) {
+                            const bool isInside = inside( pRow[x] );
+                            if (x + 1 < dimX && inside( pRow[x + 1] ) != isInside) {
+                                pXEdgeIds[ y * dimX + x ] = addVertex( owned, x, y, z, 0, pRow[x], pRow[x + 1] );
+                            }
+                            if (y + 1 < dimY && inside( pRow[x + dimX] ) != isInside) {
+                                pYEdgeIds[ y * dimX + x ] = addVertex( owned, x, y, z, 1, pRow[x], pRow[x + dimX] );
+                            }
+                        }
+                    }
+                }
+            };
+            auto scanZEdges = [&]( const voxel_T* pPlane0, const voxel_T* pPlane1, const int32_t z ) {
+                for (int32_t y = 0; y < dimY; y++) {
+                    const size_t rowOffset = static_cast<size_t>( y ) * dimX;
+                    for (int32_t cellX = 0; cellX < numMacroCellsX; cellX++) {
+                        if (!isMacroCellActive( cellX, y >> mMacroCellSizeLog2, z >> mMacroCellSizeLog2 )) { continue; }
+                        for (int32_t x = cellX * mMacroCellSize, xEnd = std::min( x + mMacroCellSize, dimX ); x < xEnd; x++) {
+                            const voxel_T density0 = pPlane0[ rowOffset + x ];
+                            const voxel_T density1 = pPlane1[ rowOffset + x ];
+                            if (inside( density0 ) != inside( density1 )) {
+                                scratch.zEdgeIds[ rowOffset + x ] = addVertex( true, x, y, z, 2, density0, density1 );
+                            }
+                        }
+                    }
+                }
+            };
+            auto triangulateLayer = [&]( const voxel_T* pPlane0, const voxel_T* pPlane1, const int32_t z ) {
+                for (int32_t y = 0; y + 1 < dimY; y++) {
+                    const size_t rowOffset = static_cast<size_t>( y ) * dimX;
+                    const voxel_T* const rows[4] = { pPlane0 + rowOffset, pPlane0 + rowOffset + dimX, pPlane1 + rowOffset, pPlane1 + rowOffset + dimX };
+                    for (int32_t cellX = 0; cellX < numMacroCellsX; cellX++) {
+                        if (!isMacroCellActive( cellX, y >> mMacroCellSizeLog2, z >> mMacroCellSizeLog2 )) { continue; }
+                        for (int32_t x = cellX * mMacroCellSize, xEnd = std::min( x + mMacroCellSize, dimX - 1 ); x < xEnd; x++) {
+                            int32_t caseIdx = 0;
+                            for (int32_t corner = 0; corner < 8; corner++) {
+                                caseIdx |= static_cast<int32_t>( inside( rows[corner >> 1][x + ( corner & 1 )] ) ) << corner;
+                            }
+                            for (uint32_t i = 0; i < caseTable.numIndices[caseIdx]; i++) {
+                                const int32_t edge = caseTable.edges[caseIdx][i];
+                                const int32_t lowBit = edge & 1;
+                                const int32_t highBit = ( edge >> 1 ) & 1;
+                                switch (edge >> 2) {
+                                    case 0: slab.indices.push_back( scratch.xEdgeIds[highBit][ rowOffset + lowBit * dimX + x ] ); break;
+                                    case 1: slab.indices.push_back( scratch.yEdgeIds[highBit][ rowOffset + x + lowBit ] ); break;
+                                    default: slab.indices.push_back( scratch.zEdgeIds[ rowOffset + highBit * dimX + x + lowBit ] ); break;
+                                }
+                            }
+                        }
+                    }
+                }
+            };
+
+            const int32_t zBegin = static_cast<int32_t>( slabIdx ) * isosurfaceSlabDepth;
+            const int32_t zEnd = std::min( zBegin + isosurfaceSlabDepth, numCellLayers );
+            const voxel_T* pPlane0 = getPlane( zBegin );
+            scanPlaneEdges( pPlane0, zBegin, true, scratch.xEdgeIds[0].data(), scratch.yEdgeIds[0].data() );
+            for (int32_t z = zBegin; z < zEnd; z++) {
+                const voxel_T* const pPlane1 = getPlane( z + 1 );
+                scanZEdges( pPlane0, pPlane1, z );
+                // the last plane of a slab is the first of the next one, which owns its vertices
+                const bool ownsPlane1 = ( z + 1 < zEnd ) || ( zEnd == numCellLayers );
+                scanPlaneEdges( pPlane1, z + 1, ownsPlane1, scratch.xEdgeIds[1].data(), scratch.yEdgeIds[1].data() );
+                triangulateLayer( pPlane0, pPlane1, z );
+
+                std::swap( scratch.xEdgeIds[0], scratch.xEdgeIds[1] );
+                std::swap( scratch.yEdgeIds[0], scratch.yEdgeIds[1] );
+                pPlane0 = pPlane1;
+            }
+        } );
+    } );
+
+    // the vertices of each slab follow those of the slabs before it
+    std::vector< uint64_t > vertexOffsets( numSlabs + 1, 0 );
+    std::vector< uint64_t > indexOffsets( numSlabs + 1, 0 );
+    for (int32_t slabIdx = 0; slabIdx < numSlabs; slabIdx++) {
+        if (slabs[slabIdx].vertices.size() >= foreignVertexBit) { return eRetVal::ERROR; }
+        vertexOffsets[slabIdx + 1] = vertexOffsets[slabIdx] + slabs[slabIdx].vertices.size();
+        indexOffsets[slabIdx + 1] = indexOffsets[slabIdx] + slabs[slabIdx].indices.size();
+    }
+    if (vertexOffsets[numSlabs] > std::numeric_limits< uint32_t >::max()) { return eRetVal::ERROR; }
+
+    for (const slab_t& slab : slabs) {
+        if (!slab.vertices.empty()) { ensureNormals( slab.boxMin, slab.boxMax ); }
+    }
+
+    const size_t numVertices = static_cast<size_t>( vertexOffsets[numSlabs] );
+    isosurface.coords.resize( numVertices * 3 );
+    isosurface.normals.resize( numVertices * 3 );
+    isosurface.indices.resize( static_cast<size_t>( indexOffsets[numSlabs] ) );
+
+    mpExecutionContext->parallelFor( 0, numSlabs, 1, [&]( const int64_t slabIdx ) {
+        const slab_t& slab = slabs[slabIdx];
+        float* const pCoords = isosurface.coords.data() + vertexOffsets[slabIdx] * 3;
+        float* const pNormals = isosurface.normals.data() + vertexOffsets[slabIdx] * 3;
+        for (size_t vertexIdx = 0; vertexIdx < slab.vertices.size(); vertexIdx++) {
+            const isoVertex_t& vertex = slab.vertices[vertexIdx];
+            const vec3_t gradient0 = getNormal( vertex.addr0 );
+            const vec3_t gradient1 = getNormal( vertex.addr1 );
+            float normal[3];
+            float lengthSq = 0.0f;
+            for (int32_t i = 0; i < 3; i++) {
+                normal[i] = -( gradient0[i] + vertex.t * ( gradient1[i] - gradient0[i] ) );
+                lengthSq += normal[i] * normal[i];
+            }
+            const float invLength = ( lengthSq > 0.0f ) ? 1.0f / sqrtf( lengthSq ) : 0.0f;
+            for (int32_t i = 0; i < 3; i++) {
+                pCoords[vertexIdx * 3 + i] = vertex.coord[i];
+                pNormals[vertexIdx * 3 + i] = normal[i] * invLength;
+            }
+        }
+
+        uint32_t* const pIndices = isosurface.indices.data() + indexOffsets[slabIdx];
+        const uint32_t ownOffset = static_cast<uint32_t>( vertexOffsets[slabIdx] );
+        const uint32_t nextOffset = static_cast<uint32_t>( vertexOffsets[slabIdx + 1] );
+        for (size_t i = 0; i < slab.indices.size(); i++) {
+            const uint32_t vertexId = slab.indices[i];
+            pIndices[i] = ( vertexId & foreignVertexBit ) ? nextOffset + ( vertexId & ~foreignVertexBit ) : ownOffset + vertexId;
+        }
+    } );
+    return eRetVal::OK;
+}